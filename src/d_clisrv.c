@@ -43,6 +43,9 @@
 #include "m_argv.h"
 #include "p_setup.h"
 #include "lzf.h"
+#ifdef HAVE_ZLIB
+#include "zlib.h"
+#endif
 #include "lua_script.h"
 #include "lua_hook.h"
 #include "k_kart.h"
@@ -92,6 +95,8 @@ UINT8 playernode[MAXPLAYERS];
 // The actual timeout will be longer depending on the savegame length
 tic_t jointimeout = (3*TICRATE);
 static boolean sendingsavegame[MAXNETNODES]; // Are we sending the savegame?
+static UINT8 nodenetcaps[MAXNETNODES]; // NETCAP_ flags sent by the node when joining
+static boolean cl_nobaseline; // a join snapshot's level baseline didn't match ours
 static tic_t freezetimeout[MAXNETNODES]; // Until when can this node freeze the server before getting a timeout?
 
 UINT16 pingmeasurecount = 1;
@@ -205,7 +210,142 @@ static inline void *G_ScpyTiccmd(ticcmd_t* dest, void* src, const size_t n)
 	return ret+n;
 }
 
+// Delta-encoded tics (SERVERTICS_DELTA): each tic starts with a bitmap of
+// the slots whose ticcmd differs from the same slot in the previous tic of
+// the packet (the first tic is compared against an empty ticcmd). Each of
+// those slots then has a TD_ mask followed by the fields that changed.
+// Slots that stay the same, empty ones included, only cost their bit.
+#define TD_FORWARDMOVE 0x01
+#define TD_SIDEMOVE    0x02
+#define TD_ANGLETURN   0x04
+#define TD_AIMING      0x08
+#define TD_BUTTONS     0x10
+#define TD_DRIFTTURN   0x20
+#define TD_LATENCY     0x40
+
+#define DELTATICMAXSIZE ((MAXPLAYERS+7)/8 + MAXPLAYERS*(1+sizeof (ticcmd_t)))
+
+/** Encodes a tic of ticcmds against the previous one
+  *
+  * \param dest Where to write the tic, at least DELTATICMAXSIZE bytes
+  * \param cmds The ticcmds for the tic
+  * \param prev The ticcmds of the previous tic, updated to match cmds
+  * \param numslots Number of slots in the tic
+  * \return The position after the written tic
+  *
+  */
+static UINT8 *G_PackDeltaTic(UINT8 *dest, const ticcmd_t *cmds, ticcmd_t *prev, size_t numslots)
+{
+	UINT8 *bitmap = dest;
+	const size_t bitmapsize = (numslots+7)/8;
+	size_t i;
+
+	memset(bitmap, 0, bitmapsize);
+	dest += bitmapsize;
+
+	for (i = 0; i < numslots; i++)
+	{
+		const ticcmd_t *cmd = &cmds[i];
+		ticcmd_t *ref = &prev[i];
+		UINT8 *mask = dest;
+
+		*mask = 0;
+		dest++;
+
+		if (cmd->forwardmove != ref->forwardmove)
+		{
+			*mask |= TD_FORWARDMOVE;
+			WRITESINT8(dest, cmd->forwardmove);
+		}
+		if (cmd->sidemove != ref->sidemove)
+		{
+			*mask |= TD_SIDEMOVE;
+			WRITESINT8(dest, cmd->sidemove);
+		}
+		if (cmd->angleturn != ref->angleturn)
+		{
+			*mask |= TD_ANGLETURN;
+			WRITEINT16(dest, cmd->angleturn);
+		}
+		if (cmd->aiming != ref->aiming)
+		{
+			*mask |= TD_AIMING;
+			WRITEINT16(dest, cmd->aiming);
+		}
+		if (cmd->buttons != ref->buttons)
+		{
+			*mask |= TD_BUTTONS;
+			WRITEUINT16(dest, cmd->buttons);
+		}
+		if (cmd->driftturn != ref->driftturn)
+		{
+			*mask |= TD_DRIFTTURN;
+			WRITEINT16(dest, cmd->driftturn);
+		}
+		if (cmd->latency != ref->latency)
+		{
+			*mask |= TD_LATENCY;
+			WRITEUINT8(dest, cmd->latency);
+		}
+
+		if (*mask)
+		{
+			bitmap[i/8] |= 1<<(i%8);
+			*ref = *cmd;
+		}
+		else
+			dest--; // unchanged, the bitmap says it all
+	}
+
+	return dest;
+}
+
+/** Decodes a tic written by G_PackDeltaTic
+  *
+  * \param cmds Where to put the ticcmds, or NULL to only skip the tic
+  * \param prev The ticcmds of the previous tic, updated to the decoded ones
+  * \param src The encoded tic
+  * \param numslots Number of slots in the tic
+  * \return The position after the tic
+  *
+  */
+static UINT8 *G_UnpackDeltaTic(ticcmd_t *cmds, ticcmd_t *prev, UINT8 *src, size_t numslots)
+{
+	const UINT8 *bitmap = src;
+	size_t i;
+
+	src += (numslots+7)/8;
+
+	for (i = 0; i < numslots; i++)
+	{
+		ticcmd_t *ref = &prev[i];
+
+		if (bitmap[i/8] & (1<<(i%8)))
+		{
+			const UINT8 mask = READUINT8(src);
+
+			if (mask & TD_FORWARDMOVE)
+				ref->forwardmove = READSINT8(src);
+			if (mask & TD_SIDEMOVE)
+				ref->sidemove = READSINT8(src);
+			if (mask & TD_ANGLETURN)
+				ref->angleturn = READINT16(src);
+			if (mask & TD_AIMING)
+				ref->aiming = READINT16(src);
+			if (mask & TD_BUTTONS)
+				ref->buttons = READUINT16(src);
+			if (mask & TD_DRIFTTURN)
+				ref->driftturn = READINT16(src);
+			if (mask & TD_LATENCY)
+				ref->latency = READUINT8(src);
+		}
+
+		if (cmds)
+			cmds[i] = *ref;
+	}
 
+	return src;
+}
 
 // Some software don't support largest packet
 // (original sersetup, not exactely, but the probability of sending a packet
@@ -1382,6 +1522,13 @@ static boolean CL_SendJoin(void)
 		localplayers++;
 
 	netbuffer->u.clientcfg.localplayers = localplayers;
+	netbuffer->u.clientcfg.netcaps = NETCAP_DELTATICS;
+	if (!cl_nobaseline)
+		netbuffer->u.clientcfg.netcaps |= NETCAP_BASELINE;
+	netbuffer->u.clientcfg.netcaps |= NETCAP_WINDOWEDFILES;
+#ifdef HAVE_ZLIB
+	netbuffer->u.clientcfg.netcaps |= NETCAP_ZSNAPSHOT;
+#endif
 	netbuffer->u.clientcfg._255 = 255;
 	netbuffer->u.clientcfg.packetversion = PACKETVERSION;
 	netbuffer->u.clientcfg.version = VERSION;
@@ -1712,72 +1859,181 @@ static boolean SV_SendServerConfig(INT32 node)
 #ifdef JOININGAME
 #define SAVEGAMESIZE (768*1024)
 
-static void SV_SendSaveGame(INT32 node)
+// Set in the savegame header's length field when the rest is deflated
+// instead of LZF compressed. Only used for NETCAP_ZSNAPSHOT nodes.
+#define SAVEGAME_DEFLATED 0x80000000
+
+static CV_PossibleValue_t joincompression_cons_t[] = {{0, "MIN"}, {9, "MAX"}, {0, NULL}};
+consvar_t cv_joincompression = {"joincompression", "9", CV_SAVE, joincompression_cons_t, NULL, 0, NULL, NULL, 0, 0, NULL};
+
+// Compressed savegames already made this tic, one per format, so that
+// everyone joining at once shares a single copy.
+#define JOINSNAP_BASELINE 1
+#define JOINSNAP_DEFLATE  2
+#define NUMJOINSNAPS      4
+
+typedef struct
+{
+	tic_t tic;
+	INT16 map;
+	UINT8 *data; // SV_AllocSharedRam block, or NULL
+	size_t length;
+} joinsnap_t;
+
+static joinsnap_t joinsnaps[NUMJOINSNAPS];
+
+/** Drops the cache's references to join snapshots
+  *
+  * \param all Drop every snapshot, not just those from earlier tics
+  *
+  */
+static void SV_ExpireJoinSnapshots(boolean all)
+{
+	INT32 i;
+
+	for (i = 0; i < NUMJOINSNAPS; i++)
+		if (joinsnaps[i].data && (all || joinsnaps[i].tic != gametic))
+		{
+			SV_ReleaseSharedRam(joinsnaps[i].data);
+			joinsnaps[i].data = NULL;
+		}
+}
+
+/** Saves and compresses the game state for a node
+  *
+  * \param format JOINSNAP_ flags for the node
+  * \param length Set to the size of the returned block
+  * \return A block from SV_AllocSharedRam, or NULL
+  *
+  */
+static UINT8 *SV_MakeJoinSnapshot(UINT8 format, size_t *length)
 {
-	size_t length, compressedlen;
+	size_t savelength, compressedlen = 0;
 	UINT8 *savebuffer;
 	UINT8 *compressedsave;
-	UINT8 *buffertosend;
+	UINT8 *snapshot;
 
 	// first save it in a malloced buffer
 	savebuffer = (UINT8 *)malloc(SAVEGAMESIZE);
 	if (!savebuffer)
-	{
-		CONS_Alert(CONS_ERROR, M_GetText("No more free memory for savegame\n"));
-		return;
-	}
+		return NULL;
 
 	// Leave room for the uncompressed length.
 	save_p = savebuffer + sizeof(UINT32);
 
+	savebaselines = (format & JOINSNAP_BASELINE) != 0;
 	P_SaveNetGame();
+	savebaselines = false;
 
-	length = save_p - savebuffer;
-	if (length > SAVEGAMESIZE)
+	savelength = save_p - savebuffer;
+	save_p = NULL;
+	if (savelength > SAVEGAMESIZE)
 	{
 		free(savebuffer);
-		save_p = NULL;
 		I_Error("Savegame buffer overrun");
 	}
+	savelength -= sizeof(UINT32);
 
 	// Allocate space for compressed save: one byte fewer than for the
 	// uncompressed data to ensure that the compression is worthwhile.
-	compressedsave = malloc(length - 1);
+	compressedsave = malloc(savelength - 1);
 	if (!compressedsave)
 	{
-		CONS_Alert(CONS_ERROR, M_GetText("No more free memory for savegame\n"));
-		return;
+		free(savebuffer);
+		return NULL;
 	}
 
 	// Attempt to compress it.
-	if((compressedlen = lzf_compress(savebuffer + sizeof(UINT32), length - sizeof(UINT32), compressedsave + sizeof(UINT32), length - sizeof(UINT32) - 1)))
+#ifdef HAVE_ZLIB
+	if (format & JOINSNAP_DEFLATE)
 	{
-		// Compressing succeeded; send compressed data
+		uLongf destlen = (uLongf)(savelength - 1);
+		if (compress2(compressedsave, &destlen, savebuffer + sizeof(UINT32), (uLong)savelength, cv_joincompression.value) == Z_OK)
+			compressedlen = destlen;
+	}
+	else
+#endif
+		compressedlen = lzf_compress(savebuffer + sizeof(UINT32), savelength, compressedsave, savelength - 1);
 
-		free(savebuffer);
+	if (compressedlen)
+	{
+		// Compressing succeeded; send compressed data
+		*length = compressedlen + sizeof(UINT32);
+		snapshot = SV_AllocSharedRam(*length);
+		if (snapshot)
+		{
+			UINT8 *p = snapshot;
 
-		// State that we're compressed.
-		buffertosend = compressedsave;
-		WRITEUINT32(compressedsave, length - sizeof(UINT32));
-		length = compressedlen + sizeof(UINT32);
+			// State that we're compressed.
+			WRITEUINT32(p, (format & JOINSNAP_DEFLATE) ? savelength | SAVEGAME_DEFLATED : savelength);
+			M_Memcpy(p, compressedsave, compressedlen);
+		}
 	}
 	else
 	{
 		// Compression failed to make it smaller; send original
+		*length = savelength + sizeof(UINT32);
+		snapshot = SV_AllocSharedRam(*length);
+		if (snapshot)
+		{
+			UINT8 *p = snapshot;
+
+			// State that we're not compressed
+			WRITEUINT32(p, 0);
+			M_Memcpy(p, savebuffer + sizeof(UINT32), savelength);
+		}
+	}
+
+	free(compressedsave);
+	free(savebuffer);
+	return snapshot;
+}
 
-		free(compressedsave);
+static void SV_SendSaveGame(INT32 node)
+{
+	joinsnap_t *snap;
+	UINT8 format = 0;
+	tic_t savetime = I_GetTime();
+
+	if (nodenetcaps[node] & NETCAP_BASELINE)
+		format |= JOINSNAP_BASELINE;
+#ifdef HAVE_ZLIB
+	if ((nodenetcaps[node] & NETCAP_ZSNAPSHOT) && cv_joincompression.value)
+		format |= JOINSNAP_DEFLATE;
+#endif
 
-		// State that we're not compressed
-		buffertosend = savebuffer;
-		WRITEUINT32(savebuffer, 0);
+	// Nothing runs between joins within a tic, so the game state is the same for all of them
+	SV_ExpireJoinSnapshots(false);
+	snap = &joinsnaps[format];
+	if (snap->data && snap->map != gamemap)
+	{
+		SV_ReleaseSharedRam(snap->data);
+		snap->data = NULL;
 	}
 
-	SV_SendRam(node, buffertosend, length, SF_RAM, 0);
-	save_p = NULL;
+	if (snap->data)
+		CONS_Debug(DBG_NETPLAY, "Savegame for node %d: sharing %s bytes made this tic\n",
+			node, sizeu1(snap->length));
+	else
+	{
+		snap->data = SV_MakeJoinSnapshot(format, &snap->length);
+		if (!snap->data)
+		{
+			CONS_Alert(CONS_ERROR, M_GetText("No more free memory for savegame\n"));
+			return;
+		}
+		snap->tic = gametic;
+		snap->map = gamemap;
+
+		CONS_Debug(DBG_NETPLAY, "Savegame for node %d: %s bytes to send, made in %u tics\n",
+			node, sizeu1(snap->length), I_GetTime() - savetime);
+	}
+
+	SV_SendRam(node, snap->data, snap->length, SF_SHAREDRAM, 0);
 
 	// Remember when we started sending the savegame so we can handle timeouts
 	sendingsavegame[node] = true;
-	freezetimeout[node] = I_GetTime() + jointimeout + length / 1024; // 1 extra tic for each kilobyte
+	freezetimeout[node] = I_GetTime() + jointimeout + snap->length / 1024; // 1 extra tic for each kilobyte
 }
 
 #ifdef DUMPCONSISTENCY
@@ -1831,6 +2087,7 @@ static void CL_LoadReceivedSavegame(void)
 	UINT8 *savebuffer = NULL;
 	size_t length, decompressedlen;
 	XBOXSTATIC char tmpsave[264];
+	tic_t loadtime = I_GetTime();
 
 	sprintf(tmpsave, "%s" PATHSEP TMPSAVENAME, srb2home);
 
@@ -1847,6 +2104,19 @@ static void CL_LoadReceivedSavegame(void)
 
 	// Decompress saved game if necessary.
 	decompressedlen = READUINT32(save_p);
+#ifdef HAVE_ZLIB
+	if (decompressedlen & SAVEGAME_DEFLATED)
+	{
+		uLongf destlen = decompressedlen &= ~SAVEGAME_DEFLATED;
+		UINT8 *decompressedbuffer = Z_Malloc(decompressedlen, PU_STATIC, NULL);
+		if (uncompress(decompressedbuffer, &destlen, save_p, (uLong)(length - sizeof(UINT32))) != Z_OK
+			|| destlen != decompressedlen)
+			I_Error("Can't decompress savegame sent");
+		Z_Free(savebuffer);
+		save_p = savebuffer = decompressedbuffer;
+	}
+	else
+#endif
 	if(decompressedlen > 0)
 	{
 		UINT8 *decompressedbuffer = Z_Malloc(decompressedlen, PU_STATIC, NULL);
@@ -1883,6 +2153,21 @@ static void CL_LoadReceivedSavegame(void)
 		save_p = NULL;
 		if (unlink(tmpsave) == -1)
 			CONS_Alert(CONS_ERROR, M_GetText("Can't delete %s\n"), tmpsave);
+
+		if (baselinemismatch)
+		{
+			// Ask for the whole level next time
+			cl_nobaseline = true;
+			D_QuitNetGame();
+			CL_Reset();
+			D_StartTitle();
+			M_StartMessage(M_GetText(
+				"The level couldn't be rebuilt\n"
+				"from the server's snapshot.\n"
+				"Please reconnect.\n\n"
+				"Press ESC\n"
+			), NULL, MM_NOTHING);
+		}
 		return;
 	}
 
@@ -1891,6 +2176,7 @@ static void CL_LoadReceivedSavegame(void)
 	save_p = NULL;
 	if (unlink(tmpsave) == -1)
 		CONS_Alert(CONS_ERROR, M_GetText("Can't delete %s\n"), tmpsave);
+	CONS_Debug(DBG_NETPLAY, "Savegame loaded in %u tics\n", I_GetTime() - loadtime);
 	consistancy[gametic%TICQUEUE] = Consistancy();
 	CON_ToggleOff();
 }
@@ -3090,6 +3376,24 @@ static void Command_Nodes(void)
 			CONS_Printf("\n");
 		}
 	}
+
+	if (!server)
+		return;
+
+	for (i = 0; i < MAXNETNODES; i++)
+	{
+		filesendstats_t stats;
+
+		if (!SV_GetFileSendStats(i, &stats))
+			continue;
+
+		CONS_Printf(M_GetText("Node %.2d: sending %d file(s), %s KB/s, %s KB sent"),
+			i, stats.numfiles, sizeu1(stats.rate >> 10), sizeu2(stats.ackedbytes >> 10));
+		if (stats.windowed)
+			CONS_Printf(M_GetText(", RTT %d ms, window %d/%d, %s resent"),
+				stats.rtt, stats.inflight, stats.window, sizeu3(stats.resent));
+		CONS_Printf("\n");
+	}
 }
 
 static void Command_Ban(void)
@@ -3500,6 +3804,15 @@ consvar_t cv_noticedownload = {"noticedownload", "Off", CV_SAVE, CV_OnOff, NULL,
 static CV_PossibleValue_t downloadspeed_cons_t[] = {{0, "MIN"}, {32, "MAX"}, {0, NULL}};
 consvar_t cv_downloadspeed = {"downloadspeed", "16", CV_SAVE, downloadspeed_cons_t, NULL, 0, NULL, NULL, 0, 0, NULL};
 
+static void CompressDownloads_OnChange(void);
+consvar_t cv_compressdownloads = {"compressdownloads", "Off", CV_SAVE|CV_CALL, CV_OnOff, CompressDownloads_OnChange, 0, NULL, NULL, 0, 0, NULL};
+
+static void CompressDownloads_OnChange(void)
+{
+	if (server && serverrunning && cv_compressdownloads.value)
+		SV_PrepareCompressedFiles();
+}
+
 static void Got_AddPlayer(UINT8 **p, INT32 playernum);
 static void Got_RemovePlayer(UINT8 **p, INT32 playernum);
 
@@ -3578,6 +3891,7 @@ static void ResetNode(INT32 node)
 	nodewaiting[node] = 0;
 	playerpernode[node] = 0;
 	sendingsavegame[node] = false;
+	nodenetcaps[node] = 0;
 }
 
 void SV_ResetServer(void)
@@ -3600,6 +3914,10 @@ void SV_ResetServer(void)
 		SV_InitResynchVars(i);
 	}
 
+#ifdef JOININGAME
+	SV_ExpireJoinSnapshots(true);
+#endif
+
 	for (i = 0; i < MAXPLAYERS; i++)
 	{
 #ifdef HAVE_BLUA
@@ -3657,6 +3975,8 @@ static inline void SV_GenContext(void)
 //
 void D_QuitNetGame(void)
 {
+	Net_StopIOThread();
+
 	if (!netgame || !netbuffer)
 		return;
 
@@ -3937,6 +4257,8 @@ boolean SV_SpawnServer(void)
 		if (netgame && I_NetOpenSocket)
 		{
 			I_NetOpenSocket();
+			if (cv_compressdownloads.value)
+				SV_PrepareCompressedFiles();
 #ifdef MASTERSERVER
 			if (cv_advertise.value)
 				RegisterServer();
@@ -4058,6 +4380,11 @@ static void HandleConnect(SINT8 node)
 
 		// client authorised to join
 		nodewaiting[node] = (UINT8)(netbuffer->u.clientcfg.localplayers - playerpernode[node]);
+		if ((size_t)doomcom->datalength >= BASEPACKETSIZE + sizeof (clientconfig_pak))
+			nodenetcaps[node] = netbuffer->u.clientcfg.netcaps;
+		else
+			nodenetcaps[node] = 0;
+		SV_SetFileCaps(node, (nodenetcaps[node] & NETCAP_WINDOWEDFILES) ? FILECAP_WINDOWED : 0);
 		if (!nodeingame[node])
 		{
 			gamestate_t backupstate = gamestate;
@@ -4393,6 +4720,11 @@ static void HandlePacketFromAwayNode(SINT8 node)
 				Net_CloseConnection(node); // nope
 			break;
 
+		case PT_FILEACK:
+			if (server)
+				Got_FileAckPak(node);
+			break;
+
 		case PT_NODETIMEOUT:
 		case PT_CLIENTQUIT:
 			if (server)
@@ -4456,6 +4788,9 @@ static void HandlePacketFromPlayer(SINT8 node)
 	XBOXSTATIC INT32 netconsole;
 	XBOXSTATIC tic_t realend, realstart;
 	XBOXSTATIC UINT8 *pak, *txtpak, numtxtpak;
+	XBOXSTATIC UINT8 numslots;
+	XBOXSTATIC boolean delta;
+	static ticcmd_t deltaprev[MAXPLAYERS];
 FILESTAMP
 
 	txtpak = NULL;
@@ -4796,8 +5131,23 @@ FILESTAMP
 			realstart = ExpandTics(netbuffer->u.serverpak.starttic, maketic);
 			realend = realstart + netbuffer->u.serverpak.numtics;
 
-			if (!txtpak)
-				txtpak = (UINT8 *)&netbuffer->u.serverpak.cmds[netbuffer->u.serverpak.numslots
+			delta = (netbuffer->u.serverpak.numslots & SERVERTICS_DELTA) != 0;
+			numslots = netbuffer->u.serverpak.numslots & ~SERVERTICS_DELTA;
+			if (numslots > MAXPLAYERS)
+				break;
+
+			if (delta)
+			{
+				// The textcmds start after the last tic
+				tic_t i;
+				memset(deltaprev, 0, sizeof (deltaprev));
+				txtpak = (UINT8 *)&netbuffer->u.serverpak.cmds;
+				for (i = 0; i < netbuffer->u.serverpak.numtics; i++)
+					txtpak = G_UnpackDeltaTic(NULL, deltaprev, txtpak, numslots);
+				memset(deltaprev, 0, sizeof (deltaprev));
+			}
+			else if (!txtpak)
+				txtpak = (UINT8 *)&netbuffer->u.serverpak.cmds[numslots
 					* netbuffer->u.serverpak.numtics];
 
 			if (realend > gametic + BACKUPTICS)
@@ -4815,8 +5165,11 @@ FILESTAMP
 					D_Clearticcmd(i);
 
 					// copy the tics
-					pak = G_ScpyTiccmd(netcmds[i%TICQUEUE], pak,
-						netbuffer->u.serverpak.numslots*sizeof (ticcmd_t));
+					if (delta)
+						pak = G_UnpackDeltaTic(netcmds[i%TICQUEUE], deltaprev, pak, numslots);
+					else
+						pak = G_ScpyTiccmd(netcmds[i%TICQUEUE], pak,
+							numslots*sizeof (ticcmd_t));
 
 					// copy the textcmds
 					numtxtpak = *txtpak++;
@@ -4912,6 +5265,10 @@ FILESTAMP
 			if (client)
 				Got_Filetxpak();
 			break;
+		case PT_FILEACK:
+			if (server)
+				Got_FileAckPak(node);
+			break;
 		default:
 			DEBFILE(va("UNKNOWN PACKET TYPE RECEIVED %d from host %d\n",
 				netbuffer->packettype, node));
@@ -4971,6 +5328,10 @@ FILESTAMP
 		else
 			HandlePacketFromAwayNode(node);
 	}
+
+	// Acknowledge the file fragments that came in all at once
+	if (client)
+		CL_SendFileAcks();
 }
 
 //
@@ -5018,7 +5379,7 @@ static INT16 Consistancy(void)
 	}
 	if (gamestate == GS_LEVEL)
 	{
-		for (th = thinkercap.next; th != &thinkercap; th = th->next)
+		for (th = mobjcap.classnext; th != &mobjcap; th = th->classnext)
 		{
 			if (th->function.acp1 != (actionf_p1)P_MobjThinker)
 				continue;
@@ -5264,6 +5625,10 @@ static void SV_SendTics(void)
 	size_t packsize;
 	UINT8 *bufpos;
 	UINT8 *ntextcmd;
+	boolean delta;
+	static ticcmd_t deltaprev[MAXPLAYERS];
+	static UINT8 deltatic[DELTATICMAXSIZE];
+	UINT8 *deltaend = NULL;
 
 	// send to all client but not to me
 	// for each node create a packet with x tics and send it
@@ -5296,10 +5661,22 @@ static void SV_SendTics(void)
 				realfirsttic = firstticstosend;
 
 			// compute the length of the packet and cut it if too large
+			// delta-encoded tics are written as they are measured
+			delta = (nodenetcaps[n] & NETCAP_DELTATICS) != 0;
+			bufpos = (UINT8 *)&netbuffer->u.serverpak.cmds;
+			if (delta)
+				memset(deltaprev, 0, sizeof (deltaprev));
+
 			packsize = BASESERVERTICSSIZE;
 			for (i = realfirsttic; i < lasttictosend; i++)
 			{
-				packsize += sizeof (ticcmd_t) * doomcom->numslots;
+				if (delta)
+				{
+					deltaend = G_PackDeltaTic(deltatic, netcmds[i%TICQUEUE], deltaprev, doomcom->numslots);
+					packsize += deltaend - deltatic;
+				}
+				else
+					packsize += sizeof (ticcmd_t) * doomcom->numslots;
 				packsize += TotalTextCmdPerTic(i);
 
 				if (packsize > software_MAXPACKETLENGTH)
@@ -5324,7 +5701,15 @@ static void SV_SendTics(void)
 							DEBFILE("sending it anyway\n");
 						}
 					}
+				}
+
+				if (i >= lasttictosend)
 					break;
+
+				if (delta)
+				{
+					M_Memcpy(bufpos, deltatic, deltaend - deltatic);
+					bufpos += deltaend - deltatic;
 				}
 			}
 
@@ -5333,11 +5718,13 @@ static void SV_SendTics(void)
 			netbuffer->u.serverpak.starttic = (UINT8)realfirsttic;
 			netbuffer->u.serverpak.numtics = (UINT8)(lasttictosend - realfirsttic);
 			netbuffer->u.serverpak.numslots = (UINT8)SHORT(doomcom->numslots);
-			bufpos = (UINT8 *)&netbuffer->u.serverpak.cmds;
 
-			for (i = realfirsttic; i < lasttictosend; i++)
+			if (delta)
+				netbuffer->u.serverpak.numslots |= SERVERTICS_DELTA;
+			else
 			{
-				bufpos = G_DcpyTiccmd(bufpos, netcmds[i%TICQUEUE], doomcom->numslots * sizeof (ticcmd_t));
+				for (i = realfirsttic; i < lasttictosend; i++)
+					bufpos = G_DcpyTiccmd(bufpos, netcmds[i%TICQUEUE], doomcom->numslots * sizeof (ticcmd_t));
 			}
 
 			// add textcmds
@@ -5664,6 +6051,11 @@ void NetKeepAlive(void)
 	tic_t nowtime;
 	INT32 realtics;
 
+	// The network thread has the network while the game draws
+	if (Net_NetworkReleased())
+		return;
+	Net_UpdateIOThread();
+
 	nowtime = I_GetTime();
 	realtics = nowtime - gametime;
 
@@ -5707,6 +6099,11 @@ void NetUpdate(void)
 	INT32 i;
 	INT32 realtics;
 
+	// The network thread has the network while the game draws
+	if (Net_NetworkReleased())
+		return;
+	Net_UpdateIOThread(); // for joining mid-level, not just at wipes
+
 	nowtime = I_GetTime();
 	realtics = nowtime - gametime;
 
@@ -5722,6 +6119,9 @@ void NetUpdate(void)
 
 	gametime = nowtime;
 
+	// Everything sent from here on goes out together at the end.
+	Net_QueuePackets();
+
 	UpdatePingTable();
 
 	if (client)
@@ -5760,6 +6160,10 @@ FILESTAMP
 				if (nodeingame[i] && nettics[i] < firstticstosend)
 					firstticstosend = nettics[i];
 
+#ifdef JOININGAME
+			SV_ExpireJoinSnapshots(false);
+#endif
+
 			// Don't erase tics not acknowledged
 			counts = realtics;
 
@@ -5805,6 +6209,19 @@ FILESTAMP
 		CON_Ticker();
 	}
 	SV_FileSendTicker();
+
+	Net_FlushPackets();
+}
+
+/** Handles the packets that came in since the last NetUpdate, without
+  * waiting for the next tic. Used by dedicated servers woken up by the
+  * network between tics.
+  */
+void NetReceivePackets(void)
+{
+	Net_QueuePackets();
+	GetPackets();
+	Net_FlushPackets();
 }
 
 /** Returns the number of players playing.
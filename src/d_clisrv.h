@@ -98,6 +98,7 @@ typedef enum
 	PT_MOREFILESNEEDED, // Server, to client: "you need these (+ more on top of those)"
 
 	PT_PING,          // Packet sent to tell clients the other client's latency to server.
+	PT_FILEACK,       // Client, to server: windowed file fragments received. Never reliable.
 	NUMPACKETTYPE
 } packettype_t;
 
@@ -166,6 +167,10 @@ typedef struct
 	ticcmd_t cmds[45]; // Normally [BACKUPTIC][MAXPLAYERS] but too large
 } ATTRPACK servertics_pak;
 
+// Set in servertics_pak.numslots when cmds holds delta-encoded tics
+// instead of numtics*numslots raw ticcmds. Only sent to NETCAP_DELTATICS nodes.
+#define SERVERTICS_DELTA 0x80
+
 // Sent to client when all consistency data
 // for players has been restored
 typedef struct
@@ -358,8 +363,14 @@ typedef struct
 	UINT8 subversion; // Contains build version
 	UINT8 localplayers;	// number of splitscreen players
 	UINT8 mode;
+	UINT8 netcaps; // NETCAP_ flags; missing from older clients
 } ATTRPACK clientconfig_pak;
 
+#define NETCAP_DELTATICS 0x01 // Client reads SERVERTICS_DELTA packets
+#define NETCAP_BASELINE  0x02 // Client rebuilds level baseline thinkers from join snapshots
+#define NETCAP_ZSNAPSHOT 0x04 // Client inflates deflated join snapshots
+#define NETCAP_WINDOWEDFILES 0x08 // Client acknowledges windowed file fragments, for the savegame
+
 #define SV_SPEEDMASK 0x03		// used to send kartspeed
 #define SV_DEDICATED 0x40		// server is dedicated
 #define SV_LOTSOFADDONS 0x20	// flag used to ask for full file list in d_netfil
@@ -555,7 +566,10 @@ extern consvar_t
 #ifdef VANILLAJOINNEXTROUND
 	cv_joinnextround,
 #endif
-	cv_netticbuffer, cv_allownewplayer, cv_maxplayers, cv_resynchattempts, cv_blamecfail, cv_maxsend, cv_noticedownload, cv_downloadspeed;
+	cv_netticbuffer, cv_allownewplayer, cv_maxplayers, cv_resynchattempts, cv_blamecfail, cv_maxsend, cv_noticedownload, cv_downloadspeed, cv_compressdownloads;
+#ifndef NONET
+extern consvar_t cv_joincompression;
+#endif
 
 extern consvar_t cv_discordinvites;
 
@@ -573,6 +587,7 @@ void SendNetXCmd4(netxcmd_t id, const void *param, size_t nparam); // splitsreen
 // Create any new ticcmds and broadcast to other players.
 void NetKeepAlive(void);
 void NetUpdate(void);
+void NetReceivePackets(void);
 
 void SV_StartSinglePlayerServer(void);
 boolean SV_SpawnServer(void);
@@ -45,6 +45,8 @@ int	snprintf(char *str, size_t n, const char *fmt, ...);
 #include "am_map.h"
 #include "console.h"
 #include "d_net.h"
+#include "d_netcmd.h"
+#include "i_net.h"
 #include "f_finale.h"
 #include "g_game.h"
 #include "hu_stuff.h"
@@ -594,6 +596,8 @@ static void D_Display(void)
 
 			s[sizeof s - 1] = '\0';
 
+			snprintf(s, sizeof s - 1, "%.2f packets/send", sendspercall);
+			V_DrawRightAlignedString(BASEVIDWIDTH, BASEVIDHEIGHT-ST_HEIGHT-50, V_YELLOWMAP, s);
 			snprintf(s, sizeof s - 1, "get %d b/s", getbps);
 			V_DrawRightAlignedString(BASEVIDWIDTH, BASEVIDHEIGHT-ST_HEIGHT-40, V_YELLOWMAP, s);
 			snprintf(s, sizeof s - 1, "send %d b/s", sendbps);
@@ -617,6 +621,86 @@ static void D_Display(void)
 
 tic_t rendergametic;
 
+// How late tics start being processed, for the ticjitter command
+static struct
+{
+	UINT32 samples;
+	UINT64 total, totalsq; // In microseconds
+	UINT32 worst;
+} ticjitter;
+
+/** Gets when a tic starts, on the I_GetTimeMicros clock
+  *
+  * \param tic The tic
+  * \return The first microsecond that I_GetTime counts as that tic
+  *
+  */
+static UINT64 D_TicStartMicros(tic_t tic)
+{
+	return ((UINT64)tic * 1000000 + TICRATE - 1) / TICRATE;
+}
+
+/** Notes how late a tic started being processed
+  *
+  * \param tic The tic
+  *
+  */
+static void D_MeasureTicJitter(tic_t tic)
+{
+	UINT64 now = I_GetTimeMicros(), start = D_TicStartMicros(tic);
+	UINT32 late = now > start ? (UINT32)(now - start) : 0;
+
+	ticjitter.samples++;
+	ticjitter.total += late;
+	ticjitter.totalsq += (UINT64)late * late;
+	if (late > ticjitter.worst)
+		ticjitter.worst = late;
+}
+
+/** Prints how late tics start being processed
+  * "ticjitter reset" starts measuring again.
+  */
+void Command_TicJitter_f(void)
+{
+	double mean, deviation;
+
+	if (COM_Argc() > 1 && !stricmp(COM_Argv(1), "reset"))
+	{
+		memset(&ticjitter, 0, sizeof (ticjitter));
+		CONS_Printf(M_GetText("Tic jitter measurements reset.\n"));
+		return;
+	}
+
+	if (!ticjitter.samples)
+	{
+		CONS_Printf(M_GetText("No tics measured yet.\n"));
+		return;
+	}
+
+	mean = (double)ticjitter.total / ticjitter.samples;
+	deviation = (double)ticjitter.totalsq / ticjitter.samples - mean * mean;
+	deviation = deviation > 0.0 ? sqrt(deviation) : 0.0;
+
+	CONS_Printf(M_GetText("%u tics started %.0f us late on average, deviation %.0f us, worst %u us\n"),
+		ticjitter.samples, mean, deviation, ticjitter.worst);
+	CONS_Printf(M_GetText("Waiting for tics with %s\n"),
+		(dedicated && cv_netwait.value && I_NetWait) ? "the network" : "cpusleep");
+}
+
+/** Waits until a tic starts, handling packets as soon as they arrive
+  * Dedicated servers do this with netwait on, instead of I_Sleep.
+  *
+  * \param tic The tic
+  *
+  */
+static void D_WaitForTic(tic_t tic)
+{
+	UINT64 now = I_GetTimeMicros(), start = D_TicStartMicros(tic);
+
+	if (now < start && I_NetWait((UINT32)(start - now)))
+		NetReceivePackets();
+}
+
 void D_SRB2Loop(void)
 {
 	tic_t oldentertics = 0, entertic = 0, realtics = 0, rendertimeout = INFTICS;
@@ -676,9 +760,19 @@ void D_SRB2Loop(void)
 				debugload--;
 #endif
 
+		if (realtics)
+			D_MeasureTicJitter(entertic);
+
 		if (!realtics && !singletics)
 		{
-			I_Sleep();
+			if (dedicated && cv_netwait.value && I_NetWait)
+				D_WaitForTic(entertic + 1);
+			else
+			{
+				Net_ReleaseNetwork();
+				I_Sleep();
+				Net_ReclaimNetwork();
+			}
 			continue;
 		}
 
@@ -700,7 +794,9 @@ void D_SRB2Loop(void)
 			rendertimeout = entertic+TICRATE/17;
 
 			// Update display, next frame, with current state.
+			Net_ReleaseNetwork();
 			D_Display();
+			Net_ReclaimNetwork();
 
 			if (moviemode)
 				M_SaveFrame();
@@ -709,7 +805,9 @@ void D_SRB2Loop(void)
 		}
 		else if (rendertimeout < entertic) // in case the server hang or netsplit
 		{
+			Net_ReleaseNetwork();
 			D_Display();
+			Net_ReclaimNetwork();
 
 			if (moviemode)
 				M_SaveFrame();
@@ -720,6 +818,9 @@ void D_SRB2Loop(void)
 		// consoleplayer -> displayplayers (hear sounds from viewpoint)
 		S_UpdateSounds(); // move positional sounds
 
+		// keep purgable memory within zonebudget
+		Z_CheckMemCleanup();
+
 		// check for media change, loop music..
 		I_UpdateCD();
 
@@ -1366,6 +1467,9 @@ void D_SRB2Main(void)
 	if (M_CheckParm("-noupload"))
 		COM_BufAddText("downloading 0\n");
 
+	if (M_CheckParm("-zonebudget") && M_IsNextParm())
+		COM_BufAddText(va("zonebudget \"%s\"\n", M_GetNextParm()));
+
 	CONS_Printf("M_Init(): Init miscellaneous info.\n");
 	M_Init();
 
@@ -29,6 +29,7 @@ extern char srb2path[256]; //Alam: SRB2's Home
 
 // the infinite loop of D_SRB2Loop() called from win_main for windows version
 void D_SRB2Loop(void) FUNCNORETURN;
+void Command_TicJitter_f(void);
 
 //
 // D_SRB2Main()
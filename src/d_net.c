@@ -28,6 +28,10 @@
 #include "z_zone.h"
 #include "i_tcp.h"
 #include "d_main.h" // srb2home
+#include "d_netcmd.h" // cv_netthread
+#ifdef HAVE_THREADS
+#include "i_threads.h"
+#endif
 
 //
 // NETWORKING
@@ -68,6 +72,8 @@ INT16 hardware_MAXPACKETLENGTH;
 boolean (*I_NetGet)(void) = NULL;
 void (*I_NetSend)(void) = NULL;
 boolean (*I_NetCanSend)(void) = NULL;
+void (*I_NetFlush)(void) = NULL;
+boolean (*I_NetWait)(UINT32 timeout) = NULL;
 boolean (*I_NetCanGet)(void) = NULL;
 void (*I_NetCloseSocket)(void) = NULL;
 void (*I_NetFreeNodenum)(INT32 nodenum) = NULL;
@@ -89,12 +95,20 @@ INT64 sendbytes = 0;
 static INT32 retransmit = 0, duppacket = 0;
 static INT32 sendackpacket = 0, getackpacket = 0;
 INT32 ticruned = 0, ticmiss = 0;
+UINT32 sendpackets = 0, sendcalls = 0;
 
 // globals
 INT32 getbps, sendbps;
-float lostpercent, duppercent, gamelostpercent;
+float lostpercent, duppercent, gamelostpercent, sendspercall;
+boolean netqueueing = false;
 INT32 packetheaderlength;
 
+#if defined (HAVE_THREADS) && !defined (NONET)
+static boolean netioinside;
+static UINT8 netioclose[MAXNETNODES];
+static void Net_ForgetIOPackets(INT32 node);
+#endif
+
 boolean Net_GetNetStat(void)
 {
 	const tic_t t = I_GetTime();
@@ -117,8 +131,13 @@ boolean Net_GetNetStat(void)
 			gamelostpercent = 100.0f*(float)ticmiss/(float)ticruned;
 		else
 			gamelostpercent = 0.0f;
+		if (sendcalls)
+			sendspercall = (float)sendpackets/(float)sendcalls;
+		else
+			sendspercall = 0.0f;
 
 		ticmiss = ticruned = 0;
+		sendpackets = sendcalls = 0;
 		oldsendbyte = sendbytes;
 		getbytes = 0;
 		sendackpacket = getackpacket = duppacket = retransmit = 0;
@@ -129,6 +148,24 @@ boolean Net_GetNetStat(void)
 	return 0;
 }
 
+/** Lets the network driver hold on to outgoing packets until
+  * Net_FlushPackets, so that it can send them with fewer system calls.
+  */
+void Net_QueuePackets(void)
+{
+	netqueueing = (I_NetFlush != NULL);
+}
+
+/** Sends everything held back since Net_QueuePackets, and goes back to
+  * sending packets right away.
+  */
+void Net_FlushPackets(void)
+{
+	netqueueing = false;
+	if (I_NetFlush)
+		I_NetFlush();
+}
+
 // -----------------------------------------------------------------
 // Some structs and functions for acknowledgement of packets
 // -----------------------------------------------------------------
@@ -314,14 +351,13 @@ static void RemoveAck(INT32 i)
 		Net_CloseConnection(node);
 }
 
-// We have got a packet, proceed the ack request and ack return
-static boolean Processackpak(void)
+// Received an ack return, so remove the ack in the list
+// Doing this twice for the same packet does nothing the second time.
+static void GotAckreturn(void)
 {
 	INT32 i;
-	boolean goodpacket = true;
 	node_t *node = &nodes[doomcom->remotenode];
 
-	// Received an ack return, so remove the ack in the list
 	if (netbuffer->ackreturn && cmpack(node->remotefirstack, netbuffer->ackreturn) < 0)
 	{
 		node->remotefirstack = netbuffer->ackreturn;
@@ -333,6 +369,16 @@ static boolean Processackpak(void)
 				RemoveAck(i);
 			}
 	}
+}
+
+// We have got a packet, proceed the ack request and ack return
+static boolean Processackpak(void)
+{
+	INT32 i;
+	boolean goodpacket = true;
+	node_t *node = &nodes[doomcom->remotenode];
+
+	GotAckreturn();
 
 	// Received a packet with ack, queue it to send the ack back
 	if (netbuffer->ack)
@@ -694,6 +740,16 @@ void Net_CloseConnection(INT32 node)
 		return;
 	}
 
+#ifdef HAVE_THREADS
+	// The network thread can't free anything, so the game does it later
+	if (netioinside)
+	{
+		if (netioclose[node] != 2)
+			netioclose[node] = (UINT8)(forceclose ? 2 : 1);
+		return;
+	}
+#endif
+
 	nodes[node].flags |= NF_CLOSE;
 
 	// try to Send ack back (two army problem)
@@ -716,6 +772,9 @@ void Net_CloseConnection(INT32 node)
 	InitNode(&nodes[node]);
 	SV_AbortSendFiles(node);
 	I_NetFreeNodenum(node);
+#ifdef HAVE_THREADS
+	Net_ForgetIOPackets(node);
+#endif
 #endif
 }
 
@@ -813,7 +872,10 @@ static const char *packettypename[NUMPACKETTYPE] =
 	"CLIENTJOIN",
 	"NODETIMEOUT",
 	"RESYNCHING",
-	"PING"
+	"TELLFILESNEEDED",
+	"MOREFILESNEEDED",
+	"PING",
+	"FILEACK"
 };
 
 static void DebugPrintpacket(const char *header)
@@ -835,8 +897,20 @@ static void DebugPrintpacket(const char *header)
 		case PT_SERVERTICS:
 		{
 			servertics_pak *serverpak = &netbuffer->u.serverpak;
-			UINT8 *cmd = (UINT8 *)(&serverpak->cmds[serverpak->numslots * serverpak->numtics]);
-			size_t ntxtcmd = &((UINT8 *)netbuffer)[doomcom->datalength] - cmd;
+			UINT8 *cmd;
+			size_t ntxtcmd;
+
+			if (serverpak->numslots & SERVERTICS_DELTA)
+			{
+				// Tic sizes vary, so there is no telling where the textcmds start
+				fprintf(debugfile, "    firsttic %u ply %d tics %d delta %s\n",
+					(UINT32)serverpak->starttic, serverpak->numslots & ~SERVERTICS_DELTA, serverpak->numtics,
+					sizeu1(doomcom->datalength - BASESERVERTICSSIZE));
+				break;
+			}
+
+			cmd = (UINT8 *)(&serverpak->cmds[serverpak->numslots * serverpak->numtics]);
+			ntxtcmd = &((UINT8 *)netbuffer)[doomcom->datalength] - cmd;
 
 			fprintf(debugfile, "    firsttic %u ply %d tics %d ntxtcmd %s\n    ",
 				(UINT32)serverpak->starttic, serverpak->numslots, serverpak->numtics, sizeu1(ntxtcmd));
@@ -897,6 +971,9 @@ static void DebugPrintpacket(const char *header)
 		case PT_SERVERREFUSE:
 			fprintf(debugfile, "    reason %s\n", netbuffer->u.serverrefuse.reason);
 			break;
+		case PT_FILEACK:
+			fprintf(debugfile, "    acks %d\n", netbuffer->u.textcmd[0]);
+			break;
 		case PT_FILEFRAGMENT:
 			fprintf(debugfile, "    fileid %d datasize %d position %u\n",
 				netbuffer->u.filetxpak.fileid, (UINT16)SHORT(netbuffer->u.filetxpak.size),
@@ -1096,38 +1173,18 @@ boolean HSendPacket(INT32 node, boolean reliable, UINT8 acknum, size_t packetlen
 	return true;
 }
 
-//
-// HGetPacket
-// Returns false if no packet is waiting
-// Check Datalength and checksum
-//
-boolean HGetPacket(void)
+#ifndef NONET
+/** Takes the next packet from the network driver, checking its length and
+  * checksum and dealing with its acks.
+  *
+  * \param early On the network thread: only look at acks we get back, the
+  *              packet's own ack is looked at when the game takes it.
+  * \return False if no packet is waiting.
+  */
+static boolean Net_ReceivePacket(boolean early)
 {
 	//boolean nodejustjoined;
 
-	// Get a packet from self
-	if (rebound_tail != rebound_head)
-	{
-		M_Memcpy(netbuffer, &reboundstore[rebound_tail], reboundsize[rebound_tail]);
-		doomcom->datalength = reboundsize[rebound_tail];
-		if (netbuffer->packettype == PT_NODETIMEOUT)
-			doomcom->remotenode = netbuffer->u.textcmd[0];
-		else
-			doomcom->remotenode = 0;
-
-		rebound_tail = (rebound_tail+1) % MAXREBOUND;
-#ifdef DEBUGFILE
-		if (debugfile)
-			DebugPrintpacket("GETLOCAL");
-#endif
-		return true;
-	}
-
-	if (!netgame)
-		return false;
-
-#ifndef NONET
-
 	while(true)
 	{
 		//nodejustjoined = I_NetGet();
@@ -1175,7 +1232,9 @@ boolean HGetPacket(void)
 		}*/
 
 		// Proceed the ack and ackreturn field
-		if (!Processackpak())
+		if (early)
+			GotAckreturn();
+		else if (!Processackpak())
 			continue; // discarded (duplicated)
 
 		// A packet with just ackreturn
@@ -1184,8 +1243,346 @@ boolean HGetPacket(void)
 			GotAcks();
 			continue;
 		}
-		break;
+		return true;
 	}
+}
+#endif
+
+#if defined (HAVE_THREADS) && !defined (NONET)
+// With netthread on, a client's network thread gets packets while the game
+// is drawing or sleeping, deals with the acks it gets back, sends what
+// needs resending, and keeps the packets for HGetPacket in the order they
+// came. doomcom, the driver and the ack tables are shared with the game, so
+// whoever uses them holds netiomutex; the game holds it all the time, apart
+// from between Net_ReleaseNetwork and Net_ReclaimNetwork.
+#define NETIOQUEUESIZE 64
+
+typedef struct
+{
+	UINT64 queued; // when it was received, in microseconds
+	INT16 node; // -1 if the node has been closed since
+	INT16 length;
+	UINT8 data[MAXPACKETLENGTH];
+} netiopacket_t;
+
+static netiopacket_t netioqueue[NETIOQUEUESIZE];
+static size_t netiohead, netiotail;
+
+typedef enum
+{
+	NETIO_LOCK, // from packets arriving, to the game letting go of the network
+	NETIO_RECEIVE, // receiving and checking them
+	NETIO_QUEUE, // from being received, to the game taking them
+	NETIO_SEND, // sending acks and packets to resend
+	NUMNETIOSTAGES
+} netiostage_t;
+
+static const char *const netiostagenames[NUMNETIOSTAGES] =
+{
+	"waiting for the game",
+	"receiving",
+	"queued for the game",
+	"sending",
+};
+
+static struct
+{
+	UINT32 samples;
+	UINT64 total;
+	UINT32 worst;
+} netiostats[NUMNETIOSTAGES];
+
+static I_mutex netiomutex;
+static I_cond netiocond;
+static boolean netiorunning; // cleared to make the thread return
+static boolean netioalive; // the thread hasn't returned yet
+static boolean netiothread; // game only: netiomutex is ours unless released
+static boolean netioreleased; // game only: between Net_ReleaseNetwork and Net_ReclaimNetwork
+
+static void Net_NoteIOStage(netiostage_t stage, UINT64 start, UINT64 end)
+{
+	UINT32 t = end > start ? (UINT32)(end - start) : 0;
+
+	netiostats[stage].samples++;
+	netiostats[stage].total += t;
+	if (t > netiostats[stage].worst)
+		netiostats[stage].worst = t;
+}
+
+static boolean Net_IOQueueFull(void)
+{
+	return (netiohead + 1) % NETIOQUEUESIZE == netiotail;
+}
+
+static void Net_ForgetIOPackets(INT32 node)
+{
+	size_t i;
+
+	for (i = netiotail; i != netiohead; i = (i + 1) % NETIOQUEUESIZE)
+		if (netioqueue[i].node == node)
+			netioqueue[i].node = -1;
+}
+
+/** Takes the oldest packet the network thread kept for the game.
+  *
+  * \return False if there are none.
+  */
+static boolean Net_GetIOPacket(void)
+{
+	netiopacket_t *packet;
+
+	while (netiotail != netiohead)
+	{
+		if (Net_IOQueueFull())
+			I_wake_all_cond(&netiocond);
+
+		packet = &netioqueue[netiotail];
+		netiotail = (netiotail + 1) % NETIOQUEUESIZE;
+		if (packet->node == -1)
+			continue;
+
+		doomcom->remotenode = packet->node;
+		doomcom->datalength = packet->length;
+		M_Memcpy(netbuffer, packet->data, packet->length);
+		Net_NoteIOStage(NETIO_QUEUE, packet->queued, I_GetTimeMicros());
+
+		if (Processackpak())
+			return true;
+	}
+	return false;
+}
+
+// Closes the connections the network thread wanted closed
+static void Net_CloseIOConnections(void)
+{
+	INT32 i;
+
+	for (i = 1; i < MAXNETNODES; i++)
+		if (netioclose[i])
+		{
+			INT32 node = (netioclose[i] == 2) ? (i | FORCECLOSE) : i;
+			netioclose[i] = 0;
+			Net_CloseConnection(node);
+		}
+}
+
+static void Net_IOThread(void *userdata)
+{
+	tic_t acktic = 0;
+	UINT64 woke, start, sent;
+	netiopacket_t *packet;
+	boolean backlog = false; // stopped receiving with packets left unread
+
+	(void)userdata;
+
+	I_lock_mutex(&netiomutex);
+	while (netiorunning && !I_thread_is_stopped())
+	{
+		// No room until the game takes some
+		if (Net_IOQueueFull())
+		{
+			I_hold_cond(&netiocond, netiomutex);
+			continue;
+		}
+
+		// Packets may be left from when the queue filled up, don't wait
+		// for more before taking those
+		if (backlog)
+			woke = I_GetTimeMicros();
+		else
+		{
+			I_unlock_mutex(netiomutex);
+			I_NetWait(1000000/TICRATE);
+			woke = I_GetTimeMicros();
+			I_lock_mutex(&netiomutex);
+		}
+
+		if (!netiorunning)
+			break;
+
+		start = I_GetTimeMicros();
+		Net_NoteIOStage(NETIO_LOCK, woke, start);
+		netioinside = true;
+		Net_QueuePackets();
+
+		while (!Net_IOQueueFull() && Net_ReceivePacket(true))
+		{
+			packet = &netioqueue[netiohead];
+			packet->queued = I_GetTimeMicros();
+			packet->node = doomcom->remotenode;
+			packet->length = doomcom->datalength;
+			M_Memcpy(packet->data, netbuffer, doomcom->datalength);
+			netiohead = (netiohead + 1) % NETIOQUEUESIZE;
+		}
+		backlog = Net_IOQueueFull();
+
+		sent = I_GetTimeMicros();
+		Net_NoteIOStage(NETIO_RECEIVE, start, sent);
+
+		if (acktic != I_GetTime())
+		{
+			acktic = I_GetTime();
+			Net_AckTicker();
+		}
+		Net_FlushPackets();
+		Net_NoteIOStage(NETIO_SEND, sent, I_GetTimeMicros());
+		netioinside = false;
+	}
+
+	netioalive = false;
+	I_wake_all_cond(&netiocond);
+	I_unlock_mutex(netiomutex);
+}
+#endif
+
+/** Lets the network thread look after the network while the game draws or
+  * sleeps, until Net_ReclaimNetwork.
+  */
+void Net_ReleaseNetwork(void)
+{
+#if defined (HAVE_THREADS) && !defined (NONET)
+	if (!netiothread || netioreleased)
+		return;
+	netioreleased = true;
+	I_unlock_mutex(netiomutex);
+#endif
+}
+
+/** Takes the network back from the network thread.
+  */
+void Net_ReclaimNetwork(void)
+{
+#if defined (HAVE_THREADS) && !defined (NONET)
+	if (!netioreleased)
+		return;
+	I_lock_mutex(&netiomutex);
+	netioreleased = false;
+	Net_CloseIOConnections();
+#endif
+}
+
+/** Tells if the network belongs to the network thread right now.
+  */
+boolean Net_NetworkReleased(void)
+{
+#if defined (HAVE_THREADS) && !defined (NONET)
+	return netioreleased;
+#else
+	return false;
+#endif
+}
+
+/** Stops the network thread, waiting for it to return. What it already
+  * received is still there for HGetPacket.
+  */
+void Net_StopIOThread(void)
+{
+#if defined (HAVE_THREADS) && !defined (NONET)
+	if (!netiothread)
+		return;
+
+	Net_ReclaimNetwork();
+	netiorunning = false;
+	I_wake_all_cond(&netiocond);
+	while (netioalive)
+		I_hold_cond(&netiocond, netiomutex);
+	netiothread = false;
+	I_unlock_mutex(netiomutex);
+	Net_CloseIOConnections();
+#endif
+}
+
+/** Starts or stops the network thread, to match netthread. Only clients
+  * in a netgame use it, dedicated servers wait on the network already.
+  */
+void Net_UpdateIOThread(void)
+{
+#if defined (HAVE_THREADS) && !defined (NONET)
+	boolean wanted = (cv_netthread.value && netgame && !dedicated && I_NetWait);
+
+#ifdef DEBUGFILE
+	if (debugfile)
+		wanted = false; // keep the log in one piece
+#endif
+
+	if (netiothread && !wanted)
+		Net_StopIOThread();
+	else if (!netiothread && wanted)
+	{
+		I_lock_mutex(&netiomutex);
+		netiothread = netiorunning = netioalive = true;
+		netioreleased = false;
+		I_spawn_thread("net-io", Net_IOThread, NULL);
+	}
+#endif
+}
+
+/** Prints how long packets spend in each stage of the network thread.
+  * "netthreadstats reset" starts measuring again.
+  */
+void Command_NetThreadStats_f(void)
+{
+#if defined (HAVE_THREADS) && !defined (NONET)
+	INT32 i;
+
+	if (COM_Argc() > 1 && !stricmp(COM_Argv(1), "reset"))
+	{
+		memset(netiostats, 0, sizeof (netiostats));
+		CONS_Printf(M_GetText("Network thread measurements reset.\n"));
+		return;
+	}
+
+	CONS_Printf(M_GetText("The network thread is %s\n"), netiothread ? "running" : "not running");
+	for (i = 0; i < NUMNETIOSTAGES; i++)
+	{
+		if (!netiostats[i].samples)
+			continue;
+		CONS_Printf(M_GetText("%s: %u times, %u us on average, worst %u us\n"),
+			netiostagenames[i], netiostats[i].samples,
+			(UINT32)(netiostats[i].total / netiostats[i].samples), netiostats[i].worst);
+	}
+#else
+	CONS_Printf(M_GetText("This build has no network thread.\n"));
+#endif
+}
+
+//
+// HGetPacket
+// Returns false if no packet is waiting
+// Check Datalength and checksum
+//
+boolean HGetPacket(void)
+{
+	// Get a packet from self
+	if (rebound_tail != rebound_head)
+	{
+		M_Memcpy(netbuffer, &reboundstore[rebound_tail], reboundsize[rebound_tail]);
+		doomcom->datalength = reboundsize[rebound_tail];
+		if (netbuffer->packettype == PT_NODETIMEOUT)
+			doomcom->remotenode = netbuffer->u.textcmd[0];
+		else
+			doomcom->remotenode = 0;
+
+		rebound_tail = (rebound_tail+1) % MAXREBOUND;
+#ifdef DEBUGFILE
+		if (debugfile)
+			DebugPrintpacket("GETLOCAL");
+#endif
+		return true;
+	}
+
+	if (!netgame)
+		return false;
+
+#ifndef NONET
+#ifdef HAVE_THREADS
+	// What the network thread got came first
+	if (Net_GetIOPacket())
+		return true;
+#endif
+
+	if (!Net_ReceivePacket(false))
+		return false;
 #endif // ndef NONET
 
 	return true;
@@ -1259,6 +1656,8 @@ boolean D_CheckNetGame(void)
 	I_NetGet = Internal_Get;
 	I_NetSend = Internal_Send;
 	I_NetCanSend = NULL;
+	I_NetFlush = NULL;
+	I_NetWait = NULL;
 	I_NetCloseSocket = NULL;
 	I_NetFreeNodenum = Internal_FreeNodenum;
 	I_NetMakeNodewPort = NULL;
@@ -1440,6 +1839,8 @@ void D_CloseConnection(void)
 {
 	INT32 i;
 
+	Net_StopIOThread();
+
 	if (netgame)
 	{
 		// wait the ackreturn with timout of 5 Sec
@@ -1457,6 +1858,9 @@ void D_CloseConnection(void)
 		I_NetGet = Internal_Get;
 		I_NetSend = Internal_Send;
 		I_NetCanSend = NULL;
+		I_NetFlush = NULL;
+		I_NetWait = NULL;
+		netqueueing = false;
 		I_NetCloseSocket = NULL;
 		I_NetFreeNodenum = Internal_FreeNodenum;
 		I_NetMakeNodewPort = NULL;
@@ -35,6 +35,21 @@ extern INT32 packetheaderlength;
 boolean Net_GetNetStat(void);
 extern INT32 getbytes;
 extern INT64 sendbytes; // Realtime updated
+extern float sendspercall;
+extern UINT32 sendpackets, sendcalls; // Kept up by the network driver
+
+// Outgoing packets can be held back by the driver and sent in one go
+extern boolean netqueueing;
+void Net_QueuePackets(void);
+void Net_FlushPackets(void);
+
+// Clients can have a thread get packets while the game draws or sleeps
+void Net_ReleaseNetwork(void);
+void Net_ReclaimNetwork(void);
+boolean Net_NetworkReleased(void);
+void Net_StopIOThread(void);
+void Net_UpdateIOThread(void);
+void Command_NetThreadStats_f(void);
 
 extern SINT8 nodetoplayer[MAXNETNODES];
 extern SINT8 nodetoplayer2[MAXNETNODES]; // Say the numplayer for this node if any (splitscreen)
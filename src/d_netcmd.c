@@ -32,6 +32,7 @@
 #include "byteptr.h"
 #include "d_netfil.h"
 #include "p_spec.h"
+#include "p_slopes.h" // Command_SlopeStats_f
 #include "m_cheat.h"
 #include "d_clisrv.h"
 #include "v_video.h"
@@ -466,6 +467,10 @@ consvar_t cv_pause = {"pausepermission", "Server", CV_NETVAR, pause_cons_t, NULL
 consvar_t cv_mute = {"mute", "Off", CV_NETVAR|CV_CALL, CV_OnOff, Mute_OnChange, 0, NULL, NULL, 0, 0, NULL};
 
 consvar_t cv_sleep = {"cpusleep", "1", CV_SAVE, sleeping_cons_t, NULL, -1, NULL, NULL, 0, 0, NULL};
+// Dedicated servers wait on the network until the next tic, instead of cpusleep
+consvar_t cv_netwait = {"netwait", "On", CV_SAVE, CV_OnOff, NULL, 0, NULL, NULL, 0, 0, NULL};
+// Clients get packets on another thread while drawing or sleeping
+consvar_t cv_netthread = {"netthread", "Off", CV_SAVE|CV_CALL|CV_NOINIT, CV_OnOff, Net_UpdateIOThread, 0, NULL, NULL, 0, 0, NULL};
 
 INT16 gametype = GT_RACE; // SRB2kart
 boolean forceresetplayers = false;
@@ -584,6 +589,7 @@ void D_RegisterServerCommands(void)
 
 	COM_AddCommand("addfile", Command_Addfile);
 	COM_AddCommand("listwad", Command_ListWADS_f);
+	COM_AddCommand("md5cache", Command_MD5Cache_f);
 
 #ifdef DELFILE
 	COM_AddCommand("delfile", Command_Delfile);
@@ -688,9 +694,11 @@ void D_RegisterServerCommands(void)
 	CV_RegisterVar(&cv_maxsend);
 	CV_RegisterVar(&cv_noticedownload);
 	CV_RegisterVar(&cv_downloadspeed);
+	CV_RegisterVar(&cv_compressdownloads);
 	CV_RegisterVar(&cv_httpsource);
 #ifndef NONET
 	CV_RegisterVar(&cv_allownewplayer);
+	CV_RegisterVar(&cv_joincompression);
 #ifdef VANILLAJOINNEXTROUND
 	CV_RegisterVar(&cv_joinnextround);
 #endif
@@ -704,6 +712,10 @@ void D_RegisterServerCommands(void)
 
 	CV_RegisterVar(&cv_skipmapcheck);
 	CV_RegisterVar(&cv_sleep);
+	CV_RegisterVar(&cv_netwait);
+	COM_AddCommand("ticjitter", Command_TicJitter_f);
+	CV_RegisterVar(&cv_netthread);
+	COM_AddCommand("netthreadstats", Command_NetThreadStats_f);
 	CV_RegisterVar(&cv_maxping);
 	CV_RegisterVar(&cv_pingtimeout);
 	CV_RegisterVar(&cv_showping);
@@ -744,6 +756,8 @@ void D_RegisterClientCommands(void)
 
 	COM_AddCommand("numthinkers", Command_Numthinkers_f);
 	COM_AddCommand("countmobjs", Command_CountMobjs_f);
+	COM_AddCommand("slopestats", Command_SlopeStats_f);
+	COM_AddCommand("benchlookups", Command_BenchLookups_f);
 
 	COM_AddCommand("changeteam", Command_Teamchange_f);
 	COM_AddCommand("changeteam2", Command_Teamchange2_f);
@@ -5316,7 +5330,7 @@ static void Command_Archivetest_f(void)
 
 	// assign mobjnum
 	i = 1;
-	for (th = thinkercap.next; th != &thinkercap; th = th->next)
+	for (th = mobjcap.classnext; th != &mobjcap; th = th->classnext)
 		if (th->function.acp1 == (actionf_p1)P_MobjThinker)
 			((mobj_t *)th)->mobjnum = i++;
 
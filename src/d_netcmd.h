@@ -149,7 +149,7 @@ extern consvar_t cv_showping;
 
 extern consvar_t cv_skipmapcheck;
 
-extern consvar_t cv_sleep;
+extern consvar_t cv_sleep, cv_netwait, cv_netthread;
 
 typedef enum
 {
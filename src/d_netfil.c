@@ -63,17 +63,33 @@
 #include "m_menu.h"
 #include "md5.h"
 #include "filesrch.h"
+#include "i_threads.h"
 
 #include <errno.h>
 
+#ifdef HAVE_ZLIB
+#include "zlib.h"
+#endif
+
+// Partial downloads are kept, and checked with MD5s when resumed
+#if !defined (NOMD5) && !defined (_arch_dreamcast)
+#define RESUMEDOWNLOADS
+#endif
+
 // Prototypes
-static boolean SV_SendFile(INT32 node, const char *filename, UINT8 fileid);
+static boolean SV_SendFile(INT32 node, const char *filename, UINT8 fileid, UINT8 *ranges, UINT8 numranges);
 
 #ifdef HAVE_CURL
 size_t curlwrite_data(void *ptr, size_t size, size_t nmemb, FILE *stream);
 int curlprogress_callback(void *clientp, double dltotal, double dlnow, double ultotal, double ulnow);
 #endif
 
+// A part of a file
+typedef struct
+{
+	UINT32 start, length;
+} filerange_t;
+
 // Sender structure
 typedef struct filetx_s
 {
@@ -85,18 +101,75 @@ typedef struct filetx_s
 	UINT32 size; // Size of the file
 	UINT8 fileid;
 	INT32 node; // Destination
+	const UINT8 *mapping; // The loaded file's mapping, if w_wad has one
+	FILE *file; // Opened on the first read when the file isn't mapped
+	UINT32 position; // Next byte to send for the first time
+	UINT32 unacked; // Fragments still waiting for a PT_FILEACK
+	boolean compressed; // Sending the file's deflated copy
+	filerange_t *skip; // Ranges the node already has, sorted
+	UINT8 numskip, nextskip;
 	struct filetx_s *next; // Next file in the list
 } filetx_t;
 
+// Windowed transfers keep up to this many fragments unacknowledged
+#define FILEWINDOW 256
+// and send this many files from the start of the list at the same time
+#define FILESATONCE 4
+// Slow start ends once the window reaches this size
+#define FILESSTHRESH 64
+
+// A fragment sent to a windowed node that it hasn't acknowledged yet
+typedef struct
+{
+	filetx_t *file; // NULL once acknowledged
+	UINT32 position;
+	UINT32 size;
+	boolean skipped; // Tells the node it has that range, instead of sending it
+	UINT8 resent; // Times it was sent again; RTT isn't sampled from those
+	tic_t senttime;
+} filefrag_t;
+
 // Current transfers (one for each node)
 typedef struct filetran_s
 {
 	filetx_t *txlist; // Linked list of all files for the node
-	UINT32 position; // The current position in the file
-	FILE *currentfile; // The file currently being sent/received
+	UINT8 caps; // FILECAP_ flags the node asked for
+
+	// Windowed transfers only
+	filefrag_t *window; // FILEWINDOW fragments, indexed by sequence number
+	UINT32 head, tail; // Next sequence number, and oldest unacknowledged one
+	INT32 inflight; // Unacknowledged fragments in the window
+	INT32 cwnd, ssthresh, cwndcount; // Congestion window, in fragments
+	INT32 srtt, rttvar; // Smoothed round trip time and its variation, in 1/8 tics
+	tic_t lastloss;
+	INT32 nextfile; // Round robin between the files being sent
+
+	// Statistics, for the nodes command
+	tic_t starttime;
+	UINT32 sentbytes; // Not counting fragments sent again
+	UINT32 ackedbytes;
+	UINT32 resent;
+
+	UINT32 verified; // Bytes MD5'd for ranges it has, while it's connected
 } filetran_t;
 static filetran_t transfer[MAXNETNODES];
 
+#ifdef RESUMEDOWNLOADS
+// The ranges a node says it has are MD5'd right away, on the game thread,
+// so how much of that anyone can ask for is limited. A range over the
+// limits is simply sent again.
+#define RESUMEVERIFYREQUEST (16<<20) // for one PT_REQUESTFILE
+#define RESUMEVERIFYNODE (64<<20) // for one node while it's connected
+#define RESUMEVERIFYPERTIC (1<<20) // for all nodes together, every tic...
+#define RESUMEVERIFYBURST (16<<20) // ...saved up to this much
+
+static UINT32 resumerequestleft; // What's left for the request being handled
+static UINT32 resumeverifyleft; // What's left for all nodes
+static tic_t resumeverifytic; // When resumeverifyleft was last topped up
+#endif
+
+static void SV_ReadFileData(filetx_t *f, UINT32 position, UINT8 *dest, size_t size);
+
 // Read time of file: stat _stmtime
 // Write time of file: utime
 
@@ -221,8 +294,342 @@ void D_ParseFileneeded(INT32 fileneedednum_parm, UINT8 *fileneededstr, UINT16 fi
 	}
 }
 
+// Downloads that can be resumed are written to a .part file, and every
+// chunk of it received whole gets its MD5 written down in a .chunks
+// manifest next to it. When the connection drops, both are kept, and the
+// next request for the file lists the runs of chunks that still check
+// out, which the server then skips once it has checked them too.
+#define PARTEXT ".part"
+#define CHUNKSEXT ".chunks"
+
+typedef struct
+{
+	UINT32 *fill; // Bytes received in each chunk, NULL if not resumable
+	UINT32 numchunks;
+	FILE *manifest; // Open for appending while downloading
+	filerange_t ranges[FILEMAXRANGES]; // Kept from the last attempt
+	UINT8 md5sum[FILEMAXRANGES][16];
+	UINT8 numranges;
+} chunkmap_t;
+
+static chunkmap_t chunkmaps[MAX_WADFILES];
+
+static void CL_FreeChunkMap(INT32 filenum)
+{
+	chunkmap_t *map = &chunkmaps[filenum];
+
+	if (map->manifest)
+		fclose(map->manifest);
+	free(map->fill);
+	memset(map, 0, sizeof (*map));
+}
+
+static void CL_PartialPath(INT32 filenum, const char *ext, char *dest)
+{
+	snprintf(dest, MAX_WADPATH+8, "%s%s", fileneeded[filenum].filename, ext);
+}
+
+#ifdef RESUMEDOWNLOADS
+static UINT8 chunkbuffer[FILECHUNKSIZE];
+
+/** Checks if a download is kept when it gets interrupted
+  * Savegames aren't, nor is anything without an MD5 to tell versions apart.
+  *
+  * \param filenum The file
+  * \return True if the download can be resumed
+  *
+  */
+static boolean CL_Resumable(INT32 filenum)
+{
+	static const UINT8 nomd5sum[16];
+	return memcmp(fileneeded[filenum].md5sum, nomd5sum, 16) != 0;
+}
+
+static void CL_MD5Hex(const UINT8 *md5sum, char *hex)
+{
+	INT32 i;
+	for (i = 0; i < 16; i++)
+		sprintf(&hex[i*2], "%02x", md5sum[i]);
+}
+
+/** Finds the parts of an interrupted download that can be kept
+  * Every chunk in the manifest is read back and checked against its MD5,
+  * and runs of good chunks become the ranges listed in PT_REQUESTFILE.
+  * The last chunk is always sent again, so the server has something left
+  * to send even when nothing else is missing.
+  *
+  * \param filenum The file, named after its place in the download directory
+  *
+  */
+static void CL_LoadPartialDownload(INT32 filenum)
+{
+	fileneeded_t *file = &fileneeded[filenum];
+	chunkmap_t *map = &chunkmaps[filenum];
+	char path[MAX_WADPATH+8], hex[33], md5hex[33];
+	char (*claimed)[33] = NULL;
+	UINT8 (*hashes)[16] = NULL;
+	UINT32 numchunks, offset, length, c, first = 0;
+	boolean inrange = false;
+	FILE *f;
+
+	CL_FreeChunkMap(filenum);
+	numchunks = (UINT32)(((UINT64)file->totalsize + FILECHUNKSIZE - 1) >> FILECHUNKSHIFT);
+	if (!CL_Resumable(filenum) || numchunks < 2)
+		return;
+
+	CL_PartialPath(filenum, CHUNKSEXT, path);
+	f = fopen(path, "r");
+	if (!f)
+		return;
+
+	// The manifest has to be for this version of the file
+	CL_MD5Hex(file->md5sum, md5hex);
+	if (fscanf(f, "%32s %u", hex, &length) != 2 || strcmp(hex, md5hex) || length != file->totalsize
+		|| (claimed = calloc(numchunks, sizeof (*claimed))) == NULL
+		|| (hashes = malloc(numchunks * sizeof (*hashes))) == NULL)
+	{
+		fclose(f);
+		free(claimed);
+		return;
+	}
+
+	// Chunks received again are appended, the latest line wins
+	while (fscanf(f, "%u %u %32s", &offset, &length, hex) == 3)
+		if (!(offset & (FILECHUNKSIZE-1)) && (offset >> FILECHUNKSHIFT) < numchunks - 1 && length == FILECHUNKSIZE)
+			strcpy(claimed[offset >> FILECHUNKSHIFT], hex);
+	fclose(f);
+
+	CL_PartialPath(filenum, PARTEXT, path);
+	f = fopen(path, "rb");
+	for (c = 0; f && c < numchunks - 1; c++)
+	{
+		boolean good = false;
+
+		if (claimed[c][0] && !fseek(f, (long)c << FILECHUNKSHIFT, SEEK_SET)
+			&& fread(chunkbuffer, 1, FILECHUNKSIZE, f) == FILECHUNKSIZE)
+		{
+			md5_buffer((char *)chunkbuffer, FILECHUNKSIZE, hashes[c]);
+			CL_MD5Hex(hashes[c], hex);
+			good = !strcmp(hex, claimed[c]);
+		}
+
+		if (good && !inrange)
+		{
+			if (map->numranges == FILEMAXRANGES)
+				break; // The rest gets sent again
+			first = c;
+			inrange = true;
+		}
+		else if (!good && inrange)
+		{
+			map->ranges[map->numranges].start = first << FILECHUNKSHIFT;
+			map->ranges[map->numranges].length = (c - first) << FILECHUNKSHIFT;
+			md5_buffer((char *)hashes[first], (c - first) * 16, map->md5sum[map->numranges]);
+			map->numranges++;
+			inrange = false;
+		}
+	}
+	if (inrange)
+	{
+		map->ranges[map->numranges].start = first << FILECHUNKSHIFT;
+		map->ranges[map->numranges].length = (c - first) << FILECHUNKSHIFT;
+		md5_buffer((char *)hashes[first], (c - first) * 16, map->md5sum[map->numranges]);
+		map->numranges++;
+	}
+	if (f)
+		fclose(f);
+	free(claimed);
+	free(hashes);
+
+	if (map->numranges)
+	{
+		UINT32 kept = 0;
+		UINT8 i;
+
+		for (i = 0; i < map->numranges; i++)
+			kept += map->ranges[i].length;
+		CONS_Printf(M_GetText("Resuming download of %s, %uK already downloaded\n"), file->filename, kept >> 10);
+	}
+}
+
+/** Lists the ranges kept from interrupted downloads in PT_REQUESTFILE
+  * Files that don't fit are downloaded whole.
+  *
+  * \param p Where to write them, after the FILECAP_ flags
+  * \param end The end of the packet
+  * \return The end of what was written
+  *
+  */
+static char *CL_PutValidRanges(char *p, const char *end)
+{
+	INT32 i;
+	UINT8 j;
+
+	for (i = 0; i < fileneedednum; i++)
+	{
+		chunkmap_t *map = &chunkmaps[i];
+
+		if (fileneeded[i].status != FS_REQUESTED || !map->numranges)
+			continue;
+		if (p + 2 + map->numranges * FILERANGESIZE + 1 > end)
+			continue;
+
+		WRITEUINT8(p, i);
+		WRITEUINT8(p, map->numranges);
+		for (j = 0; j < map->numranges; j++)
+		{
+			WRITEUINT32(p, map->ranges[j].start);
+			WRITEUINT32(p, map->ranges[j].length);
+			WRITEMEM(p, map->md5sum[j], 16);
+		}
+	}
+	WRITEUINT8(p, 0xFF);
+	return p;
+}
+
+/** Writes down the MD5 of a chunk that was received whole
+  *
+  * \param filenum The file
+  * \param start Where the chunk starts
+  * \param length Its length
+  *
+  */
+static void CL_NoteChunk(INT32 filenum, UINT32 start, UINT32 length)
+{
+	FILE *f = fileneeded[filenum].file;
+	long position = ftell(f);
+	UINT8 md5sum[16];
+	char hex[33];
+
+	fflush(f);
+	if (!fseek(f, start, SEEK_SET) && fread(chunkbuffer, 1, length, f) == length)
+	{
+		md5_buffer((char *)chunkbuffer, length, md5sum);
+		CL_MD5Hex(md5sum, hex);
+		fprintf(chunkmaps[filenum].manifest, "%u %u %s\n", start, length, hex);
+		fflush(chunkmaps[filenum].manifest);
+	}
+	fseek(f, position, SEEK_SET);
+}
+#endif
+
+/** Opens the file a download is written to
+  * Resumable downloads go to a .part file, along with their manifest.
+  *
+  * \param filenum The file
+  * \return The file, or NULL if it can't be created
+  *
+  */
+static FILE *CL_OpenDownload(INT32 filenum)
+{
+	fileneeded_t *file = &fileneeded[filenum];
+#ifdef RESUMEDOWNLOADS
+	chunkmap_t *map = &chunkmaps[filenum];
+	char path[MAX_WADPATH+8], md5hex[33];
+	FILE *f = NULL;
+
+	if (!CL_Resumable(filenum))
+	{
+		CL_FreeChunkMap(filenum);
+		return fopen(file->filename, "wb");
+	}
+
+	if (map->manifest)
+		fclose(map->manifest);
+	free(map->fill);
+	map->numchunks = (UINT32)(((UINT64)file->totalsize + FILECHUNKSIZE - 1) >> FILECHUNKSHIFT);
+	map->fill = calloc(max(map->numchunks, 1), sizeof (*map->fill));
+	if (!map->fill)
+		I_Error("CL_OpenDownload: No more memory\n");
+
+	// Add to what's known about the chunks kept, or start over
+	CL_PartialPath(filenum, CHUNKSEXT, path);
+	if (map->numranges)
+		map->manifest = fopen(path, "a");
+	else if ((map->manifest = fopen(path, "w")) != NULL)
+	{
+		CL_MD5Hex(file->md5sum, md5hex);
+		fprintf(map->manifest, "%s %u\n", md5hex, file->totalsize);
+	}
+
+	// Chunks are read back to be hashed
+	CL_PartialPath(filenum, PARTEXT, path);
+	if (map->numranges)
+		f = fopen(path, "r+b");
+	if (!f)
+		f = fopen(path, "w+b");
+	return f;
+#else
+	return fopen(file->filename, "wb");
+#endif
+}
+
+/** Counts part of a download as received
+  * Chunks of resumable downloads it completes are noted in their manifest.
+  *
+  * \param filenum The file
+  * \param position Where the part starts
+  * \param size Its size
+  * \param written False for ranges the server skipped, which are
+  *                already in the manifest
+  *
+  */
+static void CL_DownloadReceived(INT32 filenum, UINT32 position, UINT32 size, boolean written)
+{
+	fileneeded_t *file = &fileneeded[filenum];
+	chunkmap_t *map = &chunkmaps[filenum];
+	UINT32 c, end = position + size;
+
+	file->currentsize += size;
+	if (!map->fill)
+		return;
+
+	for (c = position >> FILECHUNKSHIFT; c < map->numchunks && (c << FILECHUNKSHIFT) < end; c++)
+	{
+		UINT32 start = c << FILECHUNKSHIFT;
+		UINT32 length = min(FILECHUNKSIZE, file->totalsize - start);
+		UINT32 from = max(start, position), to = min(start + length, end);
+
+		if (to <= from)
+			continue;
+		map->fill[c] += to - from;
+#ifdef RESUMEDOWNLOADS
+		if (map->fill[c] == length && written && map->manifest)
+			CL_NoteChunk(filenum, start, length);
+#else
+		(void)written;
+#endif
+	}
+}
+
+/** Gives a finished download its real name, and forgets its chunks
+  *
+  * \param filenum The file
+  * \return True if parts of it were kept from an earlier attempt
+  *
+  */
+static boolean CL_FinishDownload(INT32 filenum)
+{
+	chunkmap_t *map = &chunkmaps[filenum];
+	char path[MAX_WADPATH+8];
+	boolean resumed = map->numranges != 0;
+
+	if (!map->fill)
+		return false;
+	CL_FreeChunkMap(filenum);
+
+	CL_PartialPath(filenum, CHUNKSEXT, path);
+	remove(path);
+	CL_PartialPath(filenum, PARTEXT, path);
+	remove(fileneeded[filenum].filename); // Another version of it
+	if (rename(path, fileneeded[filenum].filename))
+		I_Error("Can't rename %s: %s\n", path, strerror(errno));
+	return resumed;
+}
+
 void CL_PrepareDownloadSaveGame(const char *tmpsave)
 {
+	CL_FreeChunkMap(0);
 	fileneedednum = 1;
 	fileneeded[0].status = FS_REQUESTED;
 	fileneeded[0].totalsize = UINT32_MAX;
@@ -308,6 +715,7 @@ boolean CL_SendRequestFile(void)
 {
 	char *p;
 	INT32 i;
+	UINT8 caps = FILECAP_WINDOWED;
 	INT64 totalfreespaceneeded = 0, availablefreespace;
 
 #ifdef PARANOIA
@@ -334,8 +742,21 @@ boolean CL_SendRequestFile(void)
 			// put it in download dir
 			strcatbf(fileneeded[i].filename, downloaddir, "/");
 			fileneeded[i].status = FS_REQUESTED;
+#ifdef RESUMEDOWNLOADS
+			CL_LoadPartialDownload(i);
+#endif
 		}
 	WRITEUINT8(p, 0xFF);
+#ifdef HAVE_ZLIB
+	caps |= FILECAP_COMPRESSED;
+#endif
+#ifdef RESUMEDOWNLOADS
+	caps |= FILECAP_RANGES;
+#endif
+	WRITEUINT8(p, caps);
+#ifdef RESUMEDOWNLOADS
+	p = CL_PutValidRanges(p, (char *)netbuffer->u.textcmd + software_MAXPACKETLENGTH - BASEPACKETSIZE);
+#endif
 	I_GetDiskFreeSpace(&availablefreespace);
 	if (totalfreespaceneeded > availablefreespace)
 		I_Error("To play on this server you must download %s KB,\n"
@@ -351,16 +772,55 @@ boolean CL_SendRequestFile(void)
 // returns false if a requested file was not found or cannot be sent
 boolean Got_RequestFilePak(INT32 node)
 {
+	static UINT8 *ranges[256]; // By fileid
+	static UINT8 numranges[256];
 	char wad[MAX_WADPATH+1];
 	UINT8 *p = netbuffer->u.textcmd;
-	UINT8 id;
+	UINT8 *end = (UINT8 *)netbuffer + doomcom->datalength;
+	UINT8 id = 0, caps = 0;
+
+	// Newer clients say how they want the files after the list,
+	// which decides what gets queued
+	while (p < netbuffer->u.textcmd + MAXTEXTCMD-1) // Don't allow hacked client to overflow
+	{
+		id = READUINT8(p);
+		if (id == 0xFF)
+			break;
+		READSTRINGN(p, wad, MAX_WADPATH);
+	}
+	if (id == 0xFF && p < end)
+		caps = READUINT8(p);
+	SV_SetFileCaps(node, caps);
+
+	// Then the parts of files it already has
+	memset(numranges, 0, sizeof (numranges));
+	while ((caps & FILECAP_RANGES) && p + 2 <= end)
+	{
+		id = READUINT8(p);
+		if (id >= MAX_WADFILES)
+			break;
+		numranges[id] = READUINT8(p);
+		ranges[id] = p;
+		if (numranges[id] > FILEMAXRANGES || p + numranges[id] * FILERANGESIZE > end)
+		{
+			numranges[id] = 0;
+			break;
+		}
+		p += numranges[id] * FILERANGESIZE;
+	}
+
+#ifdef RESUMEDOWNLOADS
+	resumerequestleft = RESUMEVERIFYREQUEST;
+#endif
+
+	p = netbuffer->u.textcmd;
 	while (p < netbuffer->u.textcmd + MAXTEXTCMD-1) // Don't allow hacked client to overflow
 	{
 		id = READUINT8(p);
 		if (id == 0xFF)
 			break;
 		READSTRINGN(p, wad, MAX_WADPATH);
-		if (!SV_SendFile(node, wad, id))
+		if (!SV_SendFile(node, wad, id, ranges[id], numranges[id]))
 		{
 			SV_AbortSendFiles(node);
 			return false; // don't read the rest of the files
@@ -516,119 +976,541 @@ boolean CL_LoadServerFiles(void)
 	return true;
 }
 
-// Number of files to send
-// Little optimization to quickly test if there is a file in the queue
-static INT32 filestosend = 0;
+#ifdef HAVE_ZLIB
+// With compressdownloads on, clients that can inflate are sent deflated
+// copies of the files. The copies are kept in DLCACHEDIR in srb2home, next
+// to the MD5 cache, named after the file's MD5 so they never go stale.
+// Each is made once, in the background where there are threads, and the
+// file is sent as it is until its copy is ready.
+#define DLCACHEDIR "dlcache"
+#define DLCACHECHUNK (64*1024)
 
-/** Adds a file to the file list for a node
+typedef enum
+{
+	DLC_NONE,
+	DLC_QUEUED,
+	DLC_BUILDING,
+	DLC_READY,
+	DLC_FAILED
+} dlcachestatus_t;
+
+typedef struct
+{
+	dlcachestatus_t status;
+	char source[MAX_WADPATH]; // The file to compress
+	char path[MAX_WADPATH]; // Its compressed copy
+	UINT32 size; // Size of the copy, once ready
+} dlcacheentry_t;
+
+static dlcacheentry_t dlcache[MAX_WADFILES]; // Indexed like wadfiles
+#ifdef HAVE_THREADS
+static boolean dlcacheworking;
+static I_mutex dlcachemutex;
+#endif
+
+/** Deflates a file into another
+  * Runs on a worker thread, so it only uses the C library and zlib.
   *
-  * \param node The node to send the file to
-  * \param filename The file to send
-  * \param fileid ???
-  * \sa SV_SendRam
+  * \param source The file to compress
+  * \param dest Where to put the compressed copy
+  * \param size Set to the size of the copy
+  * \return True if the copy was made
   *
   */
-static boolean SV_SendFile(INT32 node, const char *filename, UINT8 fileid)
+static boolean D_DeflateFile(const char *source, const char *dest, UINT32 *size)
 {
-	filetx_t **q; // A pointer to the "next" field of the last file in the list
-	filetx_t *p; // The new file request
-	INT32 i;
-	char wadfilename[MAX_WADPATH];
-
-	if (cv_noticedownload.value)
-		CONS_Printf("Sending file \"%s\" to node %d (%s)\n", filename, node, I_GetNodeAddress(node));
-
-	// Find the last file in the list and set a pointer to its "next" field
-	q = &transfer[node].txlist;
-	while (*q)
-		q = &((*q)->next);
-
-	// Allocate a file request and append it to the file list
-	p = *q = (filetx_t *)malloc(sizeof (filetx_t));
-	if (!p)
-		I_Error("SV_SendFile: No more memory\n");
-
-	// Initialise with zeros
-	memset(p, 0, sizeof (filetx_t));
-
-	// Allocate the file name
-	p->id.filename = (char *)malloc(MAX_WADPATH);
-	if (!p->id.filename)
-		I_Error("SV_SendFile: No more memory\n");
-
-	// Set the file name and get rid of the path
-	strlcpy(p->id.filename, filename, MAX_WADPATH);
-	nameonly(p->id.filename);
-
-	// Look for the requested file through all loaded files
-	for (i = 0; wadfiles[i]; i++)
+	char tmp[MAX_WADPATH+4];
+	UINT8 *in, *out;
+	FILE *src, *dst;
+	z_stream stream;
+	INT32 flush, ret = Z_OK;
+
+	snprintf(tmp, sizeof tmp, "%s.tmp", dest);
+
+	in = malloc(DLCACHECHUNK);
+	out = malloc(DLCACHECHUNK);
+	src = fopen(source, "rb");
+	dst = fopen(tmp, "wb");
+	memset(&stream, 0, sizeof stream);
+	if (!in || !out || !src || !dst || deflateInit(&stream, Z_BEST_COMPRESSION) != Z_OK)
 	{
-		strlcpy(wadfilename, wadfiles[i]->filename, MAX_WADPATH);
-		nameonly(wadfilename);
-		if (!stricmp(wadfilename, p->id.filename))
+		free(in);
+		free(out);
+		if (src)
+			fclose(src);
+		if (dst)
 		{
-			// Copy file name with full path
-			strlcpy(p->id.filename, wadfiles[i]->filename, MAX_WADPATH);
-			break;
+			fclose(dst);
+			remove(tmp);
 		}
+		return false;
 	}
 
-	// Handle non-loaded file requests
-	if (!wadfiles[i])
+	do
 	{
-		DEBFILE(va("%s not found in wadfiles\n", filename));
-		// This formerly checked if (!findfile(p->id.filename, NULL, true))
-
-		// Not found
-		// Don't inform client (probably someone who thought they could leak 2.2 ACZ)
-		DEBFILE(va("Client %d request %s: not found\n", node, filename));
-		free(p->id.filename);
-		free(p);
-		*q = NULL;
-		return false; // cancel the rest of the requests
-	}
+		stream.avail_in = (uInt)fread(in, 1, DLCACHECHUNK, src);
+		stream.next_in = in;
+		flush = feof(src) || ferror(src) ? Z_FINISH : Z_NO_FLUSH;
+#ifdef HAVE_THREADS
+		if (I_thread_is_stopped())
+			ret = Z_STREAM_ERROR; // Quitting
+#endif
 
-	// Handle huge file requests (i.e. bigger than cv_maxsend.value KB)
-	if (wadfiles[i]->filesize > (UINT32)cv_maxsend.value * 1024)
+		do
+		{
+			stream.avail_out = DLCACHECHUNK;
+			stream.next_out = out;
+			if (ret != Z_STREAM_ERROR)
+				ret = deflate(&stream, flush);
+			if (ret == Z_STREAM_ERROR
+				|| fwrite(out, 1, DLCACHECHUNK - stream.avail_out, dst) != DLCACHECHUNK - stream.avail_out)
+			{
+				ret = Z_STREAM_ERROR;
+				break;
+			}
+		} while (stream.avail_out == 0);
+	} while (flush != Z_FINISH && ret != Z_STREAM_ERROR);
+
+	*size = (UINT32)stream.total_out;
+	deflateEnd(&stream);
+	if (ferror(src))
+		ret = Z_STREAM_ERROR;
+	fclose(src);
+	if (fclose(dst) || ret != Z_STREAM_END || rename(tmp, dest))
 	{
-		// Too big
-		// Don't inform client (client sucks, man)
-		DEBFILE(va("Client %d request %s: file too big, not sending\n", node, filename));
-		free(p->id.filename);
-		free(p);
-		*q = NULL;
-		return false; // cancel the rest of the requests
+		remove(tmp);
+		ret = Z_STREAM_ERROR;
 	}
 
-	DEBFILE(va("Sending file %s (id=%d) to %d\n", filename, fileid, node));
-	p->ram = SF_FILE; // It's a file, we need to close it and free its name once we're done sending it
-	p->fileid = fileid;
-	p->next = NULL; // End of list
-	filestosend++;
-	return true;
+	free(in);
+	free(out);
+	return ret == Z_STREAM_END;
 }
 
-/** Adds a memory block to the file list for a node
+/** Compresses every queued file, on a worker thread where there are any
   *
-  * \param node The node to send the memory block to
-  * \param data The memory block to send
-  * \param size The size of the block in bytes
-  * \param freemethod How to free the block after it has been sent
-  * \param fileid ???
-  * \sa SV_SendFile
+  * \param userdata Unused
   *
   */
-void SV_SendRam(INT32 node, void *data, size_t size, freemethod_t freemethod, UINT8 fileid)
+static void D_DLCacheWorker(void *userdata)
 {
-	filetx_t **q; // A pointer to the "next" field of the last file in the list
-	filetx_t *p; // The new file request
+	dlcacheentry_t *entry;
+	UINT32 size = 0;
+	boolean made;
+	INT32 i;
 
-	// Find the last file in the list and set a pointer to its "next" field
-	q = &transfer[node].txlist;
-	while (*q)
-		q = &((*q)->next);
+	(void)userdata;
 
-	// Allocate a file request and append it to the file list
+	for (;;)
+	{
+		entry = NULL;
+#ifdef HAVE_THREADS
+		I_lock_mutex(&dlcachemutex);
+#endif
+		for (i = 0; i < MAX_WADFILES && !entry; i++)
+			if (dlcache[i].status == DLC_QUEUED)
+			{
+				entry = &dlcache[i];
+				entry->status = DLC_BUILDING;
+			}
+#ifdef HAVE_THREADS
+		if (!entry)
+			dlcacheworking = false;
+		I_unlock_mutex(dlcachemutex);
+#endif
+		if (!entry)
+			return;
+
+		made = D_DeflateFile(entry->source, entry->path, &size);
+
+#ifdef HAVE_THREADS
+		I_lock_mutex(&dlcachemutex);
+#endif
+		entry->size = size;
+		entry->status = made ? DLC_READY : DLC_FAILED;
+#ifdef HAVE_THREADS
+		I_unlock_mutex(dlcachemutex);
+#endif
+	}
+}
+
+/** Finds a loaded file's compressed copy, queueing it to be made
+  * if there isn't one yet
+  *
+  * \param wadnum The file
+  * \param size Set to the size of the copy
+  * \return The copy's path, or NULL if it isn't ready
+  *
+  */
+static const char *SV_CompressedFile(UINT16 wadnum, UINT32 *size)
+{
+	dlcacheentry_t *entry = &dlcache[wadnum];
+	dlcachestatus_t status;
+	struct stat st;
+	INT32 i;
+
+	if (!cv_compressdownloads.value)
+		return NULL;
+
+	// The worker scans every entry under the lock, so this one is filled
+	// in under it too.
+#ifdef HAVE_THREADS
+	I_lock_mutex(&dlcachemutex);
+#endif
+	status = entry->status;
+	if (status == DLC_NONE)
+	{
+		const UINT8 *md5 = wadfiles[wadnum]->md5sum;
+		char md5hex[33];
+
+		for (i = 0; i < 16; i++)
+			sprintf(&md5hex[i*2], "%02x", md5[i]);
+
+		strlcpy(entry->source, wadfiles[wadnum]->filename, MAX_WADPATH);
+		snprintf(entry->path, MAX_WADPATH, "%s" PATHSEP DLCACHEDIR PATHSEP "%s.z", srb2home, md5hex);
+
+		// Made in an earlier session
+		if (stat(entry->path, &st) == 0)
+		{
+			entry->size = (UINT32)st.st_size;
+			entry->status = status = DLC_READY;
+		}
+		else
+		{
+			I_mkdir(va("%s" PATHSEP DLCACHEDIR, srb2home), 0755);
+			CONS_Debug(DBG_NETPLAY, "Compressing %s for downloads\n", entry->source);
+
+			entry->status = status = DLC_QUEUED;
+#ifdef HAVE_THREADS
+			if (!dlcacheworking)
+			{
+				dlcacheworking = true;
+				I_spawn_thread("compress-files", D_DLCacheWorker, NULL);
+			}
+#endif
+		}
+	}
+#ifdef HAVE_THREADS
+	I_unlock_mutex(dlcachemutex);
+#else
+	if (status == DLC_QUEUED)
+	{
+		D_DLCacheWorker(NULL);
+		status = entry->status;
+	}
+#endif
+
+	if (status != DLC_READY)
+		return NULL;
+	*size = entry->size;
+	return entry->path;
+}
+#endif
+
+/** Gets the compressed copies of every file clients may download made
+  * ahead of time, for compressdownloads
+  *
+  */
+void SV_PrepareCompressedFiles(void)
+{
+#ifdef HAVE_ZLIB
+	UINT32 size;
+	UINT16 i;
+
+	for (i = mainwads+1; i < numwadfiles; i++)
+		if (wadfiles[i]->important && wadfiles[i]->filesize <= (UINT32)cv_maxsend.value * 1024)
+			SV_CompressedFile(i, &size);
+#endif
+}
+
+// Number of files to send
+// Little optimization to quickly test if there is a file in the queue
+static INT32 filestosend = 0;
+
+/** Forgets the window and statistics of a node's last transfers,
+  * before it is sent something new
+  *
+  * \param node The destination
+  *
+  */
+static void SV_ResetTransfer(INT32 node)
+{
+	filetran_t *t = &transfer[node];
+
+	if (t->window)
+		free(t->window);
+	t->window = NULL;
+	t->head = t->tail = 0;
+	t->inflight = 0;
+	t->cwnd = 16;
+	t->ssthresh = FILESSTHRESH;
+	t->cwndcount = 0;
+	t->srtt = t->rttvar = 0;
+	t->lastloss = 0;
+	t->nextfile = 0;
+
+	t->starttime = I_GetTime();
+	t->sentbytes = t->ackedbytes = t->resent = 0;
+}
+
+#ifdef RESUMEDOWNLOADS
+/** Takes verifying a range out of what a node may have verified
+  *
+  * \param node The node asking
+  * \param length The length of the range
+  * \return True if the range may be verified
+  *
+  */
+static boolean SV_TakeVerifyBudget(INT32 node, UINT32 length)
+{
+	tic_t now = I_GetTime();
+
+	if (now != resumeverifytic)
+	{
+		UINT64 left = resumeverifyleft + (UINT64)(now - resumeverifytic) * RESUMEVERIFYPERTIC;
+		resumeverifyleft = (UINT32)min(left, RESUMEVERIFYBURST);
+		resumeverifytic = now;
+	}
+
+	if (length > resumerequestleft || length > resumeverifyleft
+		|| length > RESUMEVERIFYNODE - transfer[node].verified)
+	{
+		DEBFILE(va("Not verifying %u bytes for node %d, over the limit\n", length, node));
+		return false;
+	}
+
+	resumerequestleft -= length;
+	resumeverifyleft -= length;
+	transfer[node].verified += length;
+	return true;
+}
+
+/** Checks a range of a file against the MD5 a node has for it
+  *
+  * \param f The file request
+  * \param start Where the range starts
+  * \param length Its length
+  * \param md5sum The node's MD5 of it
+  * \return True if the node has the same data
+  *
+  */
+static boolean SV_CheckFileRange(filetx_t *f, UINT32 start, UINT32 length, const UINT8 *md5sum)
+{
+	UINT32 numchunks = length >> FILECHUNKSHIFT, c;
+	UINT8 (*hashes)[16];
+	UINT8 result[16];
+
+	if ((start | length) & (FILECHUNKSIZE-1))
+		return false; // Not whole chunks
+	hashes = malloc(numchunks * sizeof (*hashes));
+	if (!hashes)
+		return false;
+
+	for (c = 0; c < numchunks; c++)
+	{
+		UINT32 position = start + (c << FILECHUNKSHIFT);
+
+		if (f->mapping)
+			md5_buffer((const char *)&f->mapping[position], FILECHUNKSIZE, hashes[c]);
+		else
+		{
+			SV_ReadFileData(f, position, chunkbuffer, FILECHUNKSIZE);
+			md5_buffer((char *)chunkbuffer, FILECHUNKSIZE, hashes[c]);
+		}
+	}
+	md5_buffer((char *)hashes, numchunks * 16, result);
+	free(hashes);
+
+	return !memcmp(result, md5sum, 16);
+}
+
+/** Makes a file request skip the ranges a node already has
+  * Only ranges that match the file are skipped. They have to be sorted,
+  * and can't reach the end of the file, so there is always something
+  * left to send.
+  *
+  * \param node The node the file is for
+  * \param f The file request
+  * \param ranges The ranges from PT_REQUESTFILE
+  * \param numranges How many there are
+  *
+  */
+static void SV_SkipValidRanges(INT32 node, filetx_t *f, UINT8 *ranges, UINT8 numranges)
+{
+	UINT32 end = 0;
+
+	f->skip = malloc(numranges * sizeof (*f->skip));
+	if (!f->skip)
+		return; // Send it all then
+
+	while (numranges--)
+	{
+		UINT32 start = READUINT32(ranges);
+		UINT32 length = READUINT32(ranges);
+		const UINT8 *md5sum = ranges;
+
+		ranges += 16;
+		if (start < end || !length || start >= f->size || length >= f->size - start
+			|| !SV_TakeVerifyBudget(node, length)
+			|| !SV_CheckFileRange(f, start, length, md5sum))
+			continue;
+
+		f->skip[f->numskip].start = start;
+		f->skip[f->numskip].length = length;
+		f->numskip++;
+		end = start + length;
+	}
+
+	DEBFILE(va("Skipping %d ranges of %s\n", f->numskip, f->id.filename));
+}
+#endif
+
+/** Adds a file to the file list for a node
+  *
+  * \param node The node to send the file to
+  * \param filename The file to send
+  * \param fileid ???
+  * \param ranges Ranges of the file the node says it has, from PT_REQUESTFILE
+  * \param numranges How many there are
+  * \sa SV_SendRam
+  *
+  */
+static boolean SV_SendFile(INT32 node, const char *filename, UINT8 fileid, UINT8 *ranges, UINT8 numranges)
+{
+	filetx_t **q; // A pointer to the "next" field of the last file in the list
+	filetx_t *p; // The new file request
+	INT32 i;
+	char wadfilename[MAX_WADPATH];
+
+	if (cv_noticedownload.value)
+		CONS_Printf("Sending file \"%s\" to node %d (%s)\n", filename, node, I_GetNodeAddress(node));
+
+	if (!transfer[node].txlist)
+		SV_ResetTransfer(node);
+
+	// Find the last file in the list and set a pointer to its "next" field
+	q = &transfer[node].txlist;
+	while (*q)
+		q = &((*q)->next);
+
+	// Allocate a file request and append it to the file list
+	p = *q = (filetx_t *)malloc(sizeof (filetx_t));
+	if (!p)
+		I_Error("SV_SendFile: No more memory\n");
+
+	// Initialise with zeros
+	memset(p, 0, sizeof (filetx_t));
+
+	// Allocate the file name
+	p->id.filename = (char *)malloc(MAX_WADPATH);
+	if (!p->id.filename)
+		I_Error("SV_SendFile: No more memory\n");
+
+	// Set the file name and get rid of the path
+	strlcpy(p->id.filename, filename, MAX_WADPATH);
+	nameonly(p->id.filename);
+
+	// Look for the requested file through all loaded files
+	for (i = 0; wadfiles[i]; i++)
+	{
+		strlcpy(wadfilename, wadfiles[i]->filename, MAX_WADPATH);
+		nameonly(wadfilename);
+		if (!stricmp(wadfilename, p->id.filename))
+		{
+			// Copy file name with full path
+			strlcpy(p->id.filename, wadfiles[i]->filename, MAX_WADPATH);
+			break;
+		}
+	}
+
+	// Handle non-loaded file requests
+	if (!wadfiles[i])
+	{
+		DEBFILE(va("%s not found in wadfiles\n", filename));
+		// This formerly checked if (!findfile(p->id.filename, NULL, true))
+
+		// Not found
+		// Don't inform client (probably someone who thought they could leak 2.2 ACZ)
+		DEBFILE(va("Client %d request %s: not found\n", node, filename));
+		free(p->id.filename);
+		free(p);
+		*q = NULL;
+		return false; // cancel the rest of the requests
+	}
+
+	// Handle huge file requests (i.e. bigger than cv_maxsend.value KB)
+	if (wadfiles[i]->filesize > (UINT32)cv_maxsend.value * 1024)
+	{
+		// Too big
+		// Don't inform client (client sucks, man)
+		DEBFILE(va("Client %d request %s: file too big, not sending\n", node, filename));
+		free(p->id.filename);
+		free(p);
+		*q = NULL;
+		return false; // cancel the rest of the requests
+	}
+
+	DEBFILE(va("Sending file %s (id=%d) to %d\n", filename, fileid, node));
+	p->ram = SF_FILE; // It's a file, we need to close it and free its name once we're done sending it
+	p->fileid = fileid;
+	p->size = wadfiles[i]->filesize;
+	p->mapping = wadfiles[i]->mapping; // Shared by everyone downloading it
+
+#ifdef RESUMEDOWNLOADS
+	if (numranges)
+		SV_SkipValidRanges(node, p, ranges, numranges);
+#else
+	(void)ranges;
+	(void)numranges;
+#endif
+
+#ifdef HAVE_ZLIB
+	// Send the compressed copy instead, if it's ready and any smaller,
+	// unless parts are skipped: those are ranges of the file as it is
+	if ((transfer[node].caps & FILECAP_COMPRESSED) && !p->numskip)
+	{
+		UINT32 size;
+		const char *path = SV_CompressedFile((UINT16)i, &size);
+
+		if (path && size < p->size)
+		{
+			DEBFILE(va("Sending %s compressed, %u bytes instead of %u\n", filename, size, p->size));
+			strlcpy(p->id.filename, path, MAX_WADPATH);
+			p->size = size;
+			p->mapping = NULL;
+			p->compressed = true;
+		}
+	}
+#endif
+	p->next = NULL; // End of list
+	filestosend++;
+	return true;
+}
+
+/** Adds a memory block to the file list for a node
+  *
+  * \param node The node to send the memory block to
+  * \param data The memory block to send
+  * \param size The size of the block in bytes
+  * \param freemethod How to free the block after it has been sent
+  * \param fileid ???
+  * \sa SV_SendFile
+  *
+  */
+void SV_SendRam(INT32 node, void *data, size_t size, freemethod_t freemethod, UINT8 fileid)
+{
+	filetx_t **q; // A pointer to the "next" field of the last file in the list
+	filetx_t *p; // The new file request
+
+	if (!transfer[node].txlist)
+		SV_ResetTransfer(node);
+
+	// Find the last file in the list and set a pointer to its "next" field
+	q = &transfer[node].txlist;
+	while (*q)
+		q = &((*q)->next);
+
+	// Allocate a file request and append it to the file list
 	p = *q = (filetx_t *)malloc(sizeof (filetx_t));
 	if (!p)
 		I_Error("SV_SendRam: No more memory\n");
@@ -638,6 +1520,8 @@ void SV_SendRam(INT32 node, void *data, size_t size, freemethod_t freemethod, UI
 
 	p->ram = freemethod; // Remember how to free the memory block for when we're done sending it
 	p->id.ram = data;
+	if (freemethod == SF_SHAREDRAM)
+		((INT32 *)data)[-1]++; // The transfer holds its own reference
 	p->size = (UINT32)size;
 	p->fileid = fileid;
 	p->next = NULL; // End of list
@@ -647,15 +1531,49 @@ void SV_SendRam(INT32 node, void *data, size_t size, freemethod_t freemethod, UI
 	filestosend++;
 }
 
+/** Allocates a reference counted memory block that can be sent to
+  * several nodes at once with SF_SHAREDRAM
+  *
+  * \param size The size of the block in bytes
+  * \return The block, holding one reference for the caller, or NULL
+  * \sa SV_ReleaseSharedRam
+  *
+  */
+void *SV_AllocSharedRam(size_t size)
+{
+	INT32 *refs = malloc(sizeof (INT32) + size);
+
+	if (!refs)
+		return NULL;
+
+	*refs = 1;
+	return refs + 1;
+}
+
+/** Drops a reference to a block from SV_AllocSharedRam,
+  * freeing it once the last one is gone
+  *
+  * \param data The memory block
+  *
+  */
+void SV_ReleaseSharedRam(void *data)
+{
+	INT32 *refs = (INT32 *)data - 1;
+
+	if (--*refs <= 0)
+		free(refs);
+}
+
 /** Stops sending a file for a node, and removes the file request from the list,
   * either because the file has been fully sent or because the node was disconnected
   *
   * \param node The destination
+  * \param p The file request
   *
   */
-static void SV_EndFileSend(INT32 node)
+static void SV_EndFileSend(INT32 node, filetx_t *p)
 {
-	filetx_t *p = transfer[node].txlist;
+	filetx_t **q;
 
 	// Free the file request according to the freemethod parameter used with SV_SendFile/Ram
 	switch (p->ram)
@@ -663,155 +1581,656 @@ static void SV_EndFileSend(INT32 node)
 		case SF_FILE: // It's a file, close it and free its filename
 			if (cv_noticedownload.value)
 				CONS_Printf("Ending file transfer for node %d\n", node);
-			if (transfer[node].currentfile)
-				fclose(transfer[node].currentfile);
+			if (p->file)
+				fclose(p->file);
 			free(p->id.filename);
+			free(p->skip);
 			break;
 		case SF_Z_RAM: // It's a memory block allocated with Z_Alloc or the likes, use Z_Free
 			Z_Free(p->id.ram);
 			break;
 		case SF_RAM: // It's a memory block allocated with malloc, use free
 			free(p->id.ram);
+			break;
+		case SF_SHAREDRAM: // Other nodes may still be sending it
+			SV_ReleaseSharedRam(p->id.ram);
+			break;
 		case SF_NOFREERAM: // Nothing to free
 			break;
 	}
 
 	// Remove the file request from the list
-	transfer[node].txlist = p->next;
+	for (q = &transfer[node].txlist; *q != p; q = &(*q)->next)
+		;
+	*q = p->next;
 	free(p);
 
-	// Indicate that the transmission is over
-	transfer[node].currentfile = NULL;
-
 	filestosend--;
 }
 
-#define PACKETPERTIC net_bandwidth/(TICRATE*software_MAXPACKETLENGTH)
-
-/** Handles file transmission
+/** Reads part of a file being sent
+  *
+  * \param f The file request
+  * \param position Where to start reading
+  * \param dest Where to put the data
+  * \param size How many bytes to read
+  *
+  */
+static void SV_ReadFileData(filetx_t *f, UINT32 position, UINT8 *dest, size_t size)
+{
+	if (f->ram != SF_FILE)
+		M_Memcpy(dest, &f->id.ram[position], size);
+	else if (f->mapping)
+		M_Memcpy(dest, &f->mapping[position], size);
+	else
+	{
+		if (!f->file)
+		{
+			f->file = fopen(f->id.filename, "rb");
+			if (!f->file)
+				I_Error("File %s does not exist", f->id.filename);
+		}
+
+		// Fragments sent again come from anywhere in the file
+		if ((UINT32)ftell(f->file) != position)
+			fseek(f->file, position, SEEK_SET);
+		if (fread(dest, 1, size, f->file) != size)
+			I_Error("SV_FileSendTicker: can't read %s byte on %s at %d because %s", sizeu1(size), f->id.filename, position, M_FileError(f->file));
+	}
+}
+
+/** Builds a PT_FILEFRAGMENT packet and sends it
+  *
+  * \param node The destination
+  * \param f The file request
+  * \param position Where the fragment starts
+  * \param size The size of the fragment
+  * \param windowed Send it unreliably, to be acknowledged with PT_FILEACK
+  * \return True if the packet was sent
+  *
+  */
+static boolean SV_SendFileFragment(INT32 node, filetx_t *f, UINT32 position, UINT16 size, boolean windowed)
+{
+	filetx_pak *p = &netbuffer->u.filetxpak;
+
+	netbuffer->packettype = PT_FILEFRAGMENT;
+	SV_ReadFileData(f, position, p->data, size);
+	p->position = LONG(position);
+	// Put flag so receiver knows the total size
+	if (position + size == f->size)
+		p->position |= LONG(0x80000000);
+	if (f->compressed)
+		p->position |= LONG(FILETX_COMPRESSED);
+	p->fileid = f->fileid;
+	if (windowed)
+		p->fileid |= FILETX_WINDOWED;
+	p->size = SHORT(size);
+
+	return HSendPacket(node, !windowed, 0, FILETXHEADER + size);
+}
+
+/** Tells a node a range of a file it already has doesn't need to be sent
+  *
+  * \param node The destination
+  * \param f The file request
+  * \param position Where the range starts
+  * \param length Its length
+  * \param windowed Send it unreliably, to be acknowledged with PT_FILEACK
+  * \return True if the packet was sent
+  *
+  */
+static boolean SV_SendFileSkip(INT32 node, filetx_t *f, UINT32 position, UINT32 length, boolean windowed)
+{
+	filetx_pak *p = &netbuffer->u.filetxpak;
+	UINT8 *data = p->data;
+
+	netbuffer->packettype = PT_FILEFRAGMENT;
+	WRITEUINT32(data, length);
+	p->position = LONG(position | FILETX_SKIPPED);
+	p->fileid = f->fileid;
+	if (windowed)
+		p->fileid |= FILETX_WINDOWED;
+	p->size = SHORT(4);
+
+	return HSendPacket(node, !windowed, 0, FILETXHEADER + 4);
+}
+
+#define PACKETPERTIC net_bandwidth/(TICRATE*software_MAXPACKETLENGTH)
+
+// Size of the file fragments sent, header excluded
+#define FILEFRAGMENTSIZE (software_MAXPACKETLENGTH - (FILETXHEADER + BASEPACKETSIZE))
+
+// Receivers of windowed transfers tell fragments apart by their position
+// divided by this, so windowed fragments can't be smaller, the last one aside
+#define FILEFRAGMENTSHIFT 6
+
+/** Gets the size of the next fragment of a file to send
+  *
+  * \param f The file request
+  * \return The size, or 0 if it's the end of the file
+  *         or the start of a range the node already has
+  *
+  */
+static UINT32 SV_NextFragmentSize(filetx_t *f)
+{
+	UINT32 size = FILEFRAGMENTSIZE;
+
+	if (f->size - f->position < size)
+		size = f->size - f->position;
+	// Fragments stop short of skipped ranges
+	if (f->nextskip < f->numskip && f->skip[f->nextskip].start - f->position < size)
+		size = f->skip[f->nextskip].start - f->position;
+	return size;
+}
+
+/** Checks if files are sent to a node with a window instead of reliable packets
+  *
+  * \param node The destination
+  * \return True if the node acknowledges fragments with PT_FILEACK
+  *
+  */
+static boolean SV_WindowedTransfer(INT32 node)
+{
+	return (transfer[node].caps & FILECAP_WINDOWED)
+		&& FILEFRAGMENTSIZE >= (1<<FILEFRAGMENTSHIFT);
+}
+
+/** Gives the time after which an unacknowledged fragment is sent again
+  *
+  * \param t The transfer
+  * \return The timeout, in tics
+  *
+  */
+static tic_t SV_FileFragmentTimeout(filetran_t *t)
+{
+	tic_t rto;
+
+	if (!t->srtt)
+		return TICRATE; // No sample yet
+
+	// Acks wait for the receiver's next NetUpdate, hence the extra tic
+	rto = ((t->srtt + 4*t->rttvar) >> 3) + 1;
+	if (rto < 2)
+		rto = 2;
+	if (rto > 2*TICRATE)
+		rto = 2*TICRATE;
+	return rto;
+}
+
+/** Sends new and lost fragments to a windowed node
+  * Sends are spread over the round trip time, and at most a congestion
+  * window of fragments is left unacknowledged. Fragments not acknowledged
+  * in time are sent again one by one, and shrink the window.
+  *
+  * \param node The destination
+  *
+  */
+static void SV_SendFileWindow(INT32 node)
+{
+	filetran_t *t = &transfer[node];
+	tic_t now = I_GetTime();
+	tic_t rto = SV_FileFragmentTimeout(t);
+	INT32 budget, rtt;
+	UINT32 seq;
+
+	if (!t->window)
+	{
+		t->window = calloc(FILEWINDOW, sizeof (*t->window));
+		if (!t->window)
+			I_Error("SV_SendFileWindow: No more memory\n");
+	}
+
+	// Pace the window over a round trip instead of sending it all at once
+	rtt = t->srtt >> 3;
+	if (rtt < 1)
+		rtt = 1;
+	budget = (t->cwnd + rtt - 1) / rtt;
+
+	// Send lost fragments again first
+	for (seq = t->tail; seq != t->head && budget > 0; seq++)
+	{
+		filefrag_t *frag = &t->window[seq % FILEWINDOW];
+
+		if (!frag->file || now - frag->senttime < rto)
+			continue;
+
+		if (frag->skipped ? !SV_SendFileSkip(node, frag->file, frag->position, frag->size, true)
+			: !SV_SendFileFragment(node, frag->file, frag->position, (UINT16)frag->size, true))
+			return;
+		budget--;
+
+		// One loss per round trip is enough to halve the window
+		if (!frag->resent && now - t->lastloss > (tic_t)rtt)
+		{
+			t->ssthresh = max(t->inflight / 2, 2);
+			t->cwnd = t->ssthresh;
+			t->cwndcount = 0;
+			t->lastloss = now;
+		}
+		if (frag->resent < UINT8_MAX)
+			frag->resent++;
+		frag->senttime = now;
+		t->resent++;
+	}
+
+	// Then new fragments, taking turns between the first few files
+	while (budget > 0 && t->inflight < t->cwnd && t->head - t->tail < FILEWINDOW)
+	{
+		filefrag_t *frag;
+		filetx_t *f = NULL, *g;
+		UINT32 size;
+		boolean skipped;
+		INT32 i;
+
+		for (i = 0; i < FILESATONCE && !f; i++)
+		{
+			INT32 n = (t->nextfile + i) % FILESATONCE, j;
+
+			for (g = t->txlist, j = 0; g && j < n; g = g->next, j++)
+				;
+			// Empty files still get their one empty fragment
+			if (g && (g->position < g->size || (!g->size && !g->unacked)))
+				f = g;
+		}
+		if (!f)
+			break; // Everything was sent, waiting for acks
+		t->nextfile = (t->nextfile + i) % FILESATONCE;
+
+		size = SV_NextFragmentSize(f);
+		skipped = (f->nextskip < f->numskip && f->skip[f->nextskip].start == f->position);
+		if (skipped)
+		{
+			size = f->skip[f->nextskip].length;
+			if (!SV_SendFileSkip(node, f, f->position, size, true))
+				return;
+			f->nextskip++;
+		}
+		else if (!SV_SendFileFragment(node, f, f->position, (UINT16)size, true))
+			return;
+		budget--;
+
+		frag = &t->window[t->head++ % FILEWINDOW];
+		frag->file = f;
+		frag->position = f->position;
+		frag->size = size;
+		frag->skipped = skipped;
+		frag->resent = 0;
+		frag->senttime = now;
+
+		f->position += size;
+		f->unacked++;
+		t->inflight++;
+		if (!skipped)
+			t->sentbytes += size;
+	}
+}
+
+/** Handles a PT_FILEACK packet, which lists fragments a node received
+  *
+  * \param node The node that sent it
+  *
+  */
+void Got_FileAckPak(INT32 node)
+{
+	filetran_t *t = &transfer[node];
+	UINT8 *p = netbuffer->u.textcmd;
+	UINT8 *end = (UINT8 *)netbuffer + doomcom->datalength;
+	tic_t now = I_GetTime();
+	UINT8 count;
+
+	if (!t->window || p >= end)
+		return;
+
+	count = READUINT8(p);
+	while (count-- && p + 5 <= end)
+	{
+		UINT8 fileid = READUINT8(p);
+		UINT32 position = READUINT32(p);
+		filefrag_t *frag = NULL;
+		filetx_t *f;
+		UINT32 seq;
+
+		// Acks mostly come in order, so this is quick
+		for (seq = t->tail; seq != t->head; seq++)
+		{
+			frag = &t->window[seq % FILEWINDOW];
+			if (frag->file && frag->file->fileid == fileid && frag->position == position)
+				break;
+		}
+		if (seq == t->head)
+			continue; // Already acknowledged
+
+		f = frag->file;
+		frag->file = NULL;
+		t->inflight--;
+		if (!frag->skipped)
+			t->ackedbytes += frag->size;
+
+		// Karn: only trust the round trip of fragments sent once
+		if (!frag->resent)
+		{
+			INT32 sample = (INT32)(now - frag->senttime) << 3;
+
+			if (!t->srtt)
+			{
+				t->srtt = max(sample, 1);
+				t->rttvar = sample / 2;
+			}
+			else
+			{
+				INT32 delta = sample - t->srtt;
+				t->srtt = max(t->srtt + delta / 8, 1);
+				t->rttvar += (abs(delta) - t->rttvar) / 4;
+			}
+		}
+
+		// Grow the window: doubling each round trip, then by one
+		if (t->cwnd < t->ssthresh)
+			t->cwnd++;
+		else if (++t->cwndcount >= t->cwnd)
+		{
+			t->cwnd++;
+			t->cwndcount = 0;
+		}
+		if (t->cwnd > FILEWINDOW)
+			t->cwnd = FILEWINDOW;
+
+		if (!--f->unacked && f->position == f->size)
+			SV_EndFileSend(node, f);
+	}
+
+	while (t->tail != t->head && !t->window[t->tail % FILEWINDOW].file)
+		t->tail++;
+}
+
+/** Handles file transmission
+  *
+  * Nodes that asked for FILECAP_WINDOWED get several files at once through
+  * a window of unreliable fragments, which they acknowledge with PT_FILEACK.
+  * Older nodes get one file at a time through reliable packets.
+  *
+  */
+void SV_FileSendTicker(void)
+{
+	static INT32 currentnode = 0;
+	size_t size;
+	filetx_t *f;
+	INT32 packetsent, i, j;
+	INT32 maxpacketsent;
+
+	if (!filestosend) // No file to send
+		return;
+
+	for (i = 0; i < MAXNETNODES; i++)
+		if (transfer[i].txlist && SV_WindowedTransfer(i))
+			SV_SendFileWindow(i);
+
+	if (cv_downloadspeed.value) // New (and experimental) behavior
+	{
+		packetsent = cv_downloadspeed.value;
+		// Don't send more packets than we have free acks
+#ifndef NONET
+		maxpacketsent = Net_GetFreeAcks(false) - 5; // Let 5 extra acks just in case
+#else
+		maxpacketsent = 1;
+#endif
+		if (packetsent > maxpacketsent && maxpacketsent > 0) // Send at least one packet
+			packetsent = maxpacketsent;
+	}
+	else // Old behavior
+	{
+		packetsent = PACKETPERTIC;
+		if (!packetsent)
+			packetsent = 1;
+	}
+
+	// (((sendbytes-nowsentbyte)*TICRATE)/(I_GetTime()-starttime)<(UINT32)net_bandwidth)
+	while (packetsent-- && filestosend != 0)
+	{
+		for (i = currentnode, j = 0; j < MAXNETNODES;
+			i = (i+1) % MAXNETNODES, j++)
+		{
+			if (transfer[i].txlist && !SV_WindowedTransfer(i))
+				goto found;
+		}
+		// no transfer to do
+		break;
+	found:
+		currentnode = (i+1) % MAXNETNODES;
+		f = transfer[i].txlist;
+
+		// Skip what the node already has
+		if (f->nextskip < f->numskip && f->skip[f->nextskip].start == f->position)
+		{
+			if (!SV_SendFileSkip(i, f, f->position, f->skip[f->nextskip].length, false))
+				break;
+			f->position += f->skip[f->nextskip++].length;
+			continue;
+		}
+
+		// Build a packet containing a file fragment
+		size = SV_NextFragmentSize(f);
+
+		// Send the packet
+		if (SV_SendFileFragment(i, f, f->position, (UINT16)size, false)) // Reliable SEND
+		{ // Success
+			f->position = (UINT32)(f->position + size);
+			transfer[i].sentbytes += (UINT32)size;
+			transfer[i].ackedbytes += (UINT32)size;
+			if (f->position == f->size) // Finish?
+				SV_EndFileSend(i, f);
+		}
+		else
+		{ // Not sent for some odd reason, retry at next call
+			// Exit the while (can't send this one so why should i send the next?)
+			break;
+		}
+	}
+}
+
+// Client side of windowed transfers: fragments received so far, one bit
+// per fragment position >> FILEFRAGMENTSHIFT, and acks not sent yet
+static UINT8 *fragmentmap[MAX_WADFILES];
+static UINT32 fragmentmapsize[MAX_WADFILES];
+
+#define FILEACKBATCH 48 // Fits in u.textcmd
+static UINT8 fileacks[FILEACKBATCH*5];
+static INT32 numfileacks = 0;
+
+/** Marks a fragment of a windowed transfer as received
+  *
+  * \param filenum The file
+  * \param position The position of the fragment
+  * \return False if it was already received
+  *
+  */
+static boolean CL_MarkFragment(INT32 filenum, UINT32 position)
+{
+	UINT32 bit = position >> FILEFRAGMENTSHIFT;
+
+	if (bit / 8 >= fragmentmapsize[filenum])
+	{
+		UINT32 newsize = max(fragmentmapsize[filenum] * 2, bit / 8 + 1);
+		UINT8 *newmap = realloc(fragmentmap[filenum], newsize);
+
+		if (!newmap)
+			I_Error("CL_MarkFragment: No more memory\n");
+		memset(newmap + fragmentmapsize[filenum], 0, newsize - fragmentmapsize[filenum]);
+		fragmentmap[filenum] = newmap;
+		fragmentmapsize[filenum] = newsize;
+	}
+
+	if (fragmentmap[filenum][bit / 8] & (1 << (bit & 7)))
+		return false;
+	fragmentmap[filenum][bit / 8] |= (UINT8)(1 << (bit & 7));
+	return true;
+}
+
+static void CL_FreeFragmentMap(INT32 filenum)
+{
+	free(fragmentmap[filenum]);
+	fragmentmap[filenum] = NULL;
+	fragmentmapsize[filenum] = 0;
+}
+
+#ifdef HAVE_ZLIB
+// Compressed downloads are inflated as their fragments come in, in order.
+// Fragments that arrive early wait here until the ones before them do.
+typedef struct pendingfrag_s
+{
+	UINT32 position;
+	UINT16 size;
+	struct pendingfrag_s *next;
+	UINT8 data[1];
+} pendingfrag_t;
+
+typedef struct
+{
+	z_stream stream;
+	UINT32 position; // Compressed bytes inflated so far
+	pendingfrag_t *pending; // Sorted by position
+} inflater_t;
+
+static inflater_t *inflaters[MAX_WADFILES];
+
+static void CL_FreeInflater(INT32 filenum)
+{
+	inflater_t *z = inflaters[filenum];
+	pendingfrag_t *frag, *next;
+
+	if (!z)
+		return;
+
+	for (frag = z->pending; frag; frag = next)
+	{
+		next = frag->next;
+		free(frag);
+	}
+	inflateEnd(&z->stream);
+	free(z);
+	inflaters[filenum] = NULL;
+}
+
+/** Inflates the next part of a compressed download into its file
   *
-  * \todo Use an acknowledging method more adapted to file transmission
-  *       The current download speed suffers from lack of ack packets,
-  *       especially when the one downloading has high latency
+  * \param filenum The file
+  * \param data The compressed data
+  * \param size Its size
+  * \return True if the end of the stream was reached
   *
   */
-void SV_FileSendTicker(void)
+static boolean CL_InflateData(INT32 filenum, UINT8 *data, UINT16 size)
 {
-	static INT32 currentnode = 0;
-	filetx_pak *p;
-	size_t size;
-	filetx_t *f;
-	INT32 packetsent, ram, i, j;
-	INT32 maxpacketsent;
+	static UINT8 out[16384];
+	fileneeded_t *file = &fileneeded[filenum];
+	inflater_t *z = inflaters[filenum];
+	INT32 ret;
+	size_t have;
 
-	if (!filestosend) // No file to send
-		return;
+	z->stream.next_in = data;
+	z->stream.avail_in = size;
+	z->position += size;
 
-	if (cv_downloadspeed.value) // New (and experimental) behavior
+	do
 	{
-		packetsent = cv_downloadspeed.value;
-		// Don't send more packets than we have free acks
-#ifndef NONET
-		maxpacketsent = Net_GetFreeAcks(false) - 5; // Let 5 extra acks just in case
-#else
-		maxpacketsent = 1;
-#endif
-		if (packetsent > maxpacketsent && maxpacketsent > 0) // Send at least one packet
-			packetsent = maxpacketsent;
-	}
-	else // Old behavior
+		z->stream.next_out = out;
+		z->stream.avail_out = sizeof out;
+		ret = inflate(&z->stream, Z_NO_FLUSH);
+		if (ret != Z_OK && ret != Z_STREAM_END && ret != Z_BUF_ERROR)
+			I_Error("Can't decompress %s: %s\n", file->filename, z->stream.msg ? z->stream.msg : "bad data");
+
+		have = sizeof out - z->stream.avail_out;
+		if (have && fwrite(out, 1, have, file->file) != have)
+			I_Error("Can't write to %s: %s\n", file->filename, M_FileError(file->file));
+		CL_DownloadReceived(filenum, file->currentsize, (UINT32)have, true);
+	} while (ret != Z_STREAM_END && z->stream.avail_out == 0);
+
+	return ret == Z_STREAM_END;
+}
+
+/** Handles a fragment of a compressed download
+  *
+  * \param filenum The file
+  * \param position Where the fragment starts in the compressed stream
+  * \param data The fragment
+  * \param size Its size
+  * \return True if the file is complete
+  *
+  */
+static boolean CL_InflateFragment(INT32 filenum, UINT32 position, UINT8 *data, UINT16 size)
+{
+	inflater_t *z = inflaters[filenum];
+	pendingfrag_t *frag, **q;
+	boolean done;
+
+	if (!z)
 	{
-		packetsent = PACKETPERTIC;
-		if (!packetsent)
-			packetsent = 1;
+		z = inflaters[filenum] = calloc(1, sizeof (*z));
+		if (!z || inflateInit(&z->stream) != Z_OK)
+			I_Error("CL_InflateFragment: No more memory\n");
 	}
 
-	netbuffer->packettype = PT_FILEFRAGMENT;
+	if (position < z->position)
+		return false; // Already had it
 
-	// (((sendbytes-nowsentbyte)*TICRATE)/(I_GetTime()-starttime)<(UINT32)net_bandwidth)
-	while (packetsent-- && filestosend != 0)
+	if (position > z->position)
 	{
-		for (i = currentnode, j = 0; j < MAXNETNODES;
-			i = (i+1) % MAXNETNODES, j++)
-		{
-			if (transfer[i].txlist)
-				goto found;
-		}
-		// no transfer to do
-		I_Error("filestosend=%d but no file to send found\n", filestosend);
-	found:
-		currentnode = (i+1) % MAXNETNODES;
-		f = transfer[i].txlist;
-		ram = f->ram;
+		// Keep it for later
+		for (q = &z->pending; *q && (*q)->position < position; q = &(*q)->next)
+			;
+		if (*q && (*q)->position == position)
+			return false;
 
-		// Open the file if it isn't open yet, or
-		if (!transfer[i].currentfile)
-		{
-			if (!ram) // Sending a file
-			{
-				long filesize;
+		frag = malloc(sizeof (*frag) + size);
+		if (!frag)
+			I_Error("CL_InflateFragment: No more memory\n");
+		frag->position = position;
+		frag->size = size;
+		M_Memcpy(frag->data, data, size);
+		frag->next = *q;
+		*q = frag;
+		return false;
+	}
 
-				transfer[i].currentfile =
-					fopen(f->id.filename, "rb");
+	done = CL_InflateData(filenum, data, size);
 
-				if (!transfer[i].currentfile)
-					I_Error("File %s does not exist",
-						f->id.filename);
+	// Then whatever was waiting for it
+	while (!done && (frag = z->pending) != NULL && frag->position <= z->position)
+	{
+		z->pending = frag->next;
+		if (frag->position == z->position)
+			done = CL_InflateData(filenum, frag->data, frag->size);
+		free(frag);
+	}
 
-				fseek(transfer[i].currentfile, 0, SEEK_END);
-				filesize = ftell(transfer[i].currentfile);
+	return done;
+}
+#endif
 
-				// Nobody wants to transfer a file bigger
-				// than 4GB!
-				if (filesize >= LONG_MAX)
-					I_Error("filesize of %s is too large", f->id.filename);
-				if (filesize == -1)
-					I_Error("Error getting filesize of %s", f->id.filename);
+/** Sends the server a PT_FILEACK for the windowed fragments received
+  * since the last one
+  *
+  */
+void CL_SendFileAcks(void)
+{
+	UINT8 *p;
 
-				f->size = (UINT32)filesize;
-				fseek(transfer[i].currentfile, 0, SEEK_SET);
-			}
-			else // Sending RAM
-				transfer[i].currentfile = (FILE *)1; // Set currentfile to a non-null value to indicate that it is open
-			transfer[i].position = 0;
-		}
+	if (!numfileacks)
+		return;
 
-		// Build a packet containing a file fragment
-		p = &netbuffer->u.filetxpak;
-		size = software_MAXPACKETLENGTH - (FILETXHEADER + BASEPACKETSIZE);
-		if (f->size-transfer[i].position < size)
-			size = f->size-transfer[i].position;
-		if (ram)
-			M_Memcpy(p->data, &f->id.ram[transfer[i].position], size);
-		else if (fread(p->data, 1, size, transfer[i].currentfile) != size)
-			I_Error("SV_FileSendTicker: can't read %s byte on %s at %d because %s", sizeu1(size), f->id.filename, transfer[i].position, M_FileError(transfer[i].currentfile));
-		p->position = LONG(transfer[i].position);
-		// Put flag so receiver knows the total size
-		if (transfer[i].position + size == f->size)
-			p->position |= LONG(0x80000000);
-		p->fileid = f->fileid;
-		p->size = SHORT((UINT16)size);
+	netbuffer->packettype = PT_FILEACK;
+	p = netbuffer->u.textcmd;
+	WRITEUINT8(p, numfileacks);
+	WRITEMEM(p, fileacks, numfileacks*5);
+	HSendPacket(servernode, false, 0, p - netbuffer->u.textcmd);
 
-		// Send the packet
-		if (HSendPacket(i, true, 0, FILETXHEADER + size)) // Reliable SEND
-		{ // Success
-			transfer[i].position = (UINT32)(transfer[i].position + size);
-			if (transfer[i].position == f->size) // Finish?
-				SV_EndFileSend(i);
-		}
-		else
-		{ // Not sent for some odd reason, retry at next call
-			if (!ram)
-				fseek(transfer[i].currentfile,transfer[i].position, SEEK_SET);
-			// Exit the while (can't send this one so why should i send the next?)
-			break;
-		}
-	}
+	numfileacks = 0;
 }
 
 void Got_Filetxpak(void)
 {
-	INT32 filenum = netbuffer->u.filetxpak.fileid;
+	INT32 filenum = netbuffer->u.filetxpak.fileid & ~FILETX_WINDOWED;
+	boolean windowed = (netbuffer->u.filetxpak.fileid & FILETX_WINDOWED) != 0;
 	fileneeded_t *file = &fileneeded[filenum];
 	char *filename = file->filename;
 	static INT32 filetime = 0;
@@ -830,48 +2249,120 @@ void Got_Filetxpak(void)
 		))
 		I_Error("Tried to download \"%s\"", filename);
 
+	if (windowed)
+	{
+		UINT8 *p = &fileacks[numfileacks*5];
+
+		// Acknowledge everything, so the server stops sending it again
+		WRITEUINT8(p, filenum);
+		WRITEUINT32(p, LONG(netbuffer->u.filetxpak.position) & ~(0x80000000|FILETX_COMPRESSED|FILETX_SKIPPED));
+		numfileacks++;
+	}
+
 	if (filenum >= fileneedednum)
 	{
 		DEBFILE(va("fileframent not needed %d>%d\n", filenum, fileneedednum));
 		//I_Error("Received an unneeded file fragment (file id received: %d, file id needed: %d)\n", filenum, fileneedednum);
+		if (windowed)
+			goto sendacks;
 		return;
 	}
 
+	// A late copy of a finished file
+	if (windowed && file->status != FS_REQUESTED && file->status != FS_DOWNLOADING)
+		goto sendacks;
+
 	if (file->status == FS_REQUESTED)
 	{
 		if (file->file)
 			I_Error("Got_Filetxpak: already open file\n");
-		file->file = fopen(filename, "wb");
+		file->file = CL_OpenDownload(filenum);
 		if (!file->file)
 			I_Error("Can't create file %s: %s", filename, strerror(errno));
 		CONS_Printf("\r%s...\n",filename);
 		file->currentsize = 0;
 		file->status = FS_DOWNLOADING;
+		CL_FreeFragmentMap(filenum);
+#ifdef HAVE_ZLIB
+		CL_FreeInflater(filenum);
+#endif
 	}
 
 	if (file->status == FS_DOWNLOADING)
 	{
 		UINT32 pos = LONG(netbuffer->u.filetxpak.position);
 		UINT16 size = SHORT(netbuffer->u.filetxpak.size);
+		boolean compressed = (pos & FILETX_COMPRESSED) != 0;
+		boolean skipped = (pos & FILETX_SKIPPED) != 0;
+		boolean done, resumed;
+
+		pos &= ~(FILETX_COMPRESSED|FILETX_SKIPPED);
 		// Use a special trick to know when the file is complete (not always used)
 		// WARNING: file fragments can arrive out of order so don't stop yet!
 		if (pos & 0x80000000)
 		{
 			pos &= ~0x80000000;
-			file->totalsize = pos + size;
+			if (!compressed) // The file list already has the real size
+				file->totalsize = pos + size;
+		}
+		// Windowed fragments can come more than once
+		if (windowed && !CL_MarkFragment(filenum, pos))
+			goto sendacks;
+		if (skipped)
+		{
+			// The server checked that part we kept, there is nothing to write
+			UINT8 *data = netbuffer->u.filetxpak.data;
+			UINT32 length = size >= 4 ? READUINT32(data) : 0;
+
+			if (pos > file->totalsize || length > file->totalsize - pos)
+				length = 0;
+			CL_DownloadReceived(filenum, pos, length, false);
+			done = (file->currentsize == file->totalsize);
+		}
+		else
+#ifdef HAVE_ZLIB
+		if (compressed)
+		{
+			// Finished once the end of the stream gets inflated
+			done = CL_InflateFragment(filenum, pos, netbuffer->u.filetxpak.data, size);
+		}
+		else
+#endif
+		{
+			if (compressed)
+				I_Error("Can't decompress %s\n", filename);
+
+			// We can receive packet in the wrong order, anyway all os support gaped file
+			fseek(file->file, pos, SEEK_SET);
+			if (fwrite(netbuffer->u.filetxpak.data,size,1,file->file) != 1)
+				I_Error("Can't write to %s: %s\n",filename, M_FileError(file->file));
+			CL_DownloadReceived(filenum, pos, size, true);
+			done = (file->currentsize == file->totalsize);
 		}
-		// We can receive packet in the wrong order, anyway all os support gaped file
-		fseek(file->file, pos, SEEK_SET);
-		if (fwrite(netbuffer->u.filetxpak.data,size,1,file->file) != 1)
-			I_Error("Can't write to %s: %s\n",filename, M_FileError(file->file));
-		file->currentsize += size;
 
 		// Finished?
-		if (file->currentsize == file->totalsize)
+		if (done)
 		{
 			fclose(file->file);
 			file->file = NULL;
 			file->status = FS_FOUND;
+			CL_FreeFragmentMap(filenum);
+			resumed = CL_FinishDownload(filenum);
+#ifdef HAVE_ZLIB
+			if (compressed)
+			{
+				CL_FreeInflater(filenum);
+				// Check that it came out right, rather than only when loading it fails
+				if (file->currentsize != file->totalsize)
+					file->status = FS_MD5SUMBAD;
+				else
+					file->status = checkfilemd5(filename, file->md5sum);
+			}
+			else
+#endif
+			// Parts were kept from before, check they fit together
+			if (resumed)
+				file->status = checkfilemd5(filename, file->md5sum);
 			CONS_Printf(M_GetText("Downloading %s...(done)\n"),
 				filename);
 #ifndef NONET
@@ -903,16 +2394,23 @@ void Got_Filetxpak(void)
 		}
 		I_Error("Received a file not requested (file id: %d, file status: %s)\n", filenum, s);
 	}
+
+#ifdef CLIENT_LOADINGSCREEN
+	lastfilenum = filenum;
+#endif
+
+sendacks:
 	// Send ack back quickly
-	if (++filetime == 3)
+	if (windowed)
+	{
+		if (numfileacks == FILEACKBATCH)
+			CL_SendFileAcks();
+	}
+	else if (++filetime == 3)
 	{
 		Net_SendAcks(servernode);
 		filetime = 0;
 	}
-
-#ifdef CLIENT_LOADINGSCREEN
-	lastfilenum = filenum;
-#endif
 }
 
 /** \brief Checks if a node is downloading a file
@@ -935,7 +2433,54 @@ boolean SV_SendingFile(INT32 node)
 void SV_AbortSendFiles(INT32 node)
 {
 	while (transfer[node].txlist)
-		SV_EndFileSend(node);
+		SV_EndFileSend(node, transfer[node].txlist);
+	SV_ResetTransfer(node);
+	transfer[node].caps = 0;
+	transfer[node].verified = 0;
+}
+
+/** Sets how a node wants files sent to it
+  *
+  * \param node The destination
+  * \param caps FILECAP_ flags
+  *
+  */
+void SV_SetFileCaps(INT32 node, UINT8 caps)
+{
+	transfer[node].caps = caps;
+}
+
+/** Gets statistics about the files being sent to a node
+  *
+  * \param node The destination
+  * \param stats Filled in if the node is being sent files
+  * \return True if the node is being sent files
+  *
+  */
+boolean SV_GetFileSendStats(INT32 node, filesendstats_t *stats)
+{
+	filetran_t *t = &transfer[node];
+	filetx_t *f;
+	tic_t elapsed;
+
+	if (!t->txlist)
+		return false;
+
+	stats->numfiles = 0;
+	for (f = t->txlist; f; f = f->next)
+		stats->numfiles++;
+
+	stats->windowed = SV_WindowedTransfer(node);
+	stats->sentbytes = t->sentbytes;
+	stats->ackedbytes = t->ackedbytes;
+	stats->resent = t->resent;
+	stats->window = stats->windowed ? t->cwnd : 0;
+	stats->inflight = t->inflight;
+	stats->rtt = (t->srtt * 1000 / TICRATE) >> 3;
+
+	elapsed = I_GetTime() - t->starttime;
+	stats->rate = elapsed ? (UINT32)((UINT64)t->ackedbytes * TICRATE / elapsed) : 0;
+	return true;
 }
 
 void CloseNetFile(void)
@@ -947,12 +2492,21 @@ void CloseNetFile(void)
 
 	// Receiving a file?
 	for (i = 0; i < MAX_WADFILES; i++)
+	{
 		if (fileneeded[i].status == FS_DOWNLOADING && fileneeded[i].file)
 		{
 			fclose(fileneeded[i].file);
-			// File is not complete delete it
-			remove(fileneeded[i].filename);
+			// File is not complete delete it, unless it can be resumed
+			if (!chunkmaps[i].fill)
+				remove(fileneeded[i].filename);
 		}
+		CL_FreeChunkMap(i);
+		CL_FreeFragmentMap(i);
+#ifdef HAVE_ZLIB
+		CL_FreeInflater(i);
+#endif
+	}
+	numfileacks = 0;
 
 	// Remove PT_FILEFRAGMENT from acknowledge list
 	Net_AbortPacketType(PT_FILEFRAGMENT);
@@ -995,23 +2549,345 @@ size_t nameonlylength(const char *s)
 #define O_BINARY 0
 #endif
 
+// MD5s of files are remembered in md5cache.dat, in srb2home, along with the
+// size, modification time and inode the file had when it was hashed. A file
+// only gets hashed again once one of those changes. New entries are appended
+// to the file; the latest entry for a path wins when it is loaded back.
+#define MD5CACHEFILE "md5cache.dat"
+#define MD5CACHEHEADER "SRB2 MD5 cache 1"
+#define MD5CACHEBUCKETS 1024
+#define MD5CACHEFRESH 2 // seconds; files modified more recently aren't trusted
+
+typedef struct md5cacheentry_s
+{
+	char *path;
+	UINT8 md5sum[16];
+	unsigned long size, inode;
+	long mtime;
+	struct md5cacheentry_s *next;
+} md5cacheentry_t;
+
+static md5cacheentry_t *md5cache[MD5CACHEBUCKETS];
+static boolean md5cacheloaded;
+static boolean md5rehash; // -rehash: hash everything again, and update the cache
+static UINT32 md5cacheentries, md5cachehits, md5cachemisses, md5cachestale;
+
+static UINT32 D_MD5CacheBucket(const char *path)
+{
+	UINT32 hash = 2166136261u;
+
+	while (*path)
+		hash = (hash ^ (UINT8)*path++) * 16777619u;
+	return hash & (MD5CACHEBUCKETS - 1);
+}
+
+static md5cacheentry_t *D_FindMD5CacheEntry(const char *path)
+{
+	md5cacheentry_t *entry;
+
+	for (entry = md5cache[D_MD5CacheBucket(path)]; entry; entry = entry->next)
+		if (!strcmp(entry->path, path))
+			return entry;
+	return NULL;
+}
+
+// Adds or replaces the entry for a path.
+static md5cacheentry_t *D_SetMD5CacheEntry(const char *path, const UINT8 *md5sum,
+	unsigned long size, long mtime, unsigned long inode)
+{
+	md5cacheentry_t *entry = D_FindMD5CacheEntry(path);
+
+	if (!entry)
+	{
+		const UINT32 bucket = D_MD5CacheBucket(path);
+
+		entry = Z_Malloc(sizeof *entry, PU_STATIC, NULL);
+		entry->path = Z_StrDup(path);
+		entry->next = md5cache[bucket];
+		md5cache[bucket] = entry;
+		md5cacheentries++;
+	}
+
+	M_Memcpy(entry->md5sum, md5sum, 16);
+	entry->size = size;
+	entry->mtime = mtime;
+	entry->inode = inode;
+	return entry;
+}
+
+static void D_ClearMD5Cache(void)
+{
+	md5cacheentry_t *entry, *next;
+	size_t i;
+
+	for (i = 0; i < MD5CACHEBUCKETS; i++)
+	{
+		for (entry = md5cache[i]; entry; entry = next)
+		{
+			next = entry->next;
+			Z_Free(entry->path);
+			Z_Free(entry);
+		}
+		md5cache[i] = NULL;
+	}
+	md5cacheentries = 0;
+}
+
+static void D_WriteMD5CacheEntry(FILE *f, const md5cacheentry_t *entry)
+{
+	INT32 i;
+
+	for (i = 0; i < 16; i++)
+		fprintf(f, "%02x", entry->md5sum[i]);
+	fprintf(f, " %lu %ld %lu %s\n", entry->size, entry->mtime, entry->inode, entry->path);
+}
+
+// Writes the cache out from scratch, dropping superseded entries.
+static void D_SaveMD5Cache(void)
+{
+	const md5cacheentry_t *entry;
+	char path[MAX_WADPATH+32];
+	FILE *f;
+	size_t i;
+
+	snprintf(path, sizeof path, "%s" PATHSEP MD5CACHEFILE, srb2home);
+	if ((f = fopen(path, "w")) == NULL)
+		return;
+
+	fprintf(f, MD5CACHEHEADER "\n");
+	for (i = 0; i < MD5CACHEBUCKETS; i++)
+		for (entry = md5cache[i]; entry; entry = entry->next)
+			D_WriteMD5CacheEntry(f, entry);
+	fclose(f);
+}
+
+static void D_LoadMD5Cache(void)
+{
+	char path[MAX_WADPATH+32], line[MAX_WADPATH+128];
+	char hex[33];
+	UINT8 md5sum[16];
+	unsigned long size, inode;
+	long mtime;
+	UINT32 numentries = 0;
+	INT32 i, n;
+	size_t len;
+	unsigned int byte;
+	FILE *f;
+
+	md5cacheloaded = true;
+	md5rehash = M_CheckParm("-rehash");
+
+	snprintf(path, sizeof path, "%s" PATHSEP MD5CACHEFILE, srb2home);
+	if ((f = fopen(path, "r")) == NULL)
+		return;
+
+	// A cache from some other version is simply started over.
+	if (!fgets(line, sizeof line, f) || strncmp(line, MD5CACHEHEADER "\n", sizeof MD5CACHEHEADER))
+	{
+		fclose(f);
+		D_SaveMD5Cache();
+		return;
+	}
+
+	while (fgets(line, sizeof line, f))
+	{
+		// Lines cut short, such as by a crash while appending, are skipped.
+		len = strlen(line);
+		if (!len || line[len-1] != '\n')
+			continue;
+		line[len-1] = '\0';
+
+		if (sscanf(line, "%32s %lu %ld %lu %n", hex, &size, &mtime, &inode, &n) < 4 || strlen(hex) != 32 || !line[n])
+			continue;
+		for (i = 0; i < 16; i++)
+		{
+			if (sscanf(&hex[i*2], "%2x", &byte) != 1)
+				break;
+			md5sum[i] = (UINT8)byte;
+		}
+		if (i < 16)
+			continue;
+
+		D_SetMD5CacheEntry(&line[n], md5sum, size, mtime, inode);
+		numentries++;
+	}
+	fclose(f);
+
+	// Don't let replaced entries pile up forever.
+	if (numentries > md5cacheentries*2 + 64)
+		D_SaveMD5Cache();
+}
+
+#if !defined (NOMD5) && !defined (_arch_dreamcast)
+// The same file can be reached by many names; the cache keys on the
+// absolute one. Returns a malloc()ed path, or NULL to use the name as is.
+static char *D_MD5CachePath(const char *filename)
+{
+#if defined (_WIN32)
+	return _fullpath(NULL, filename, 0);
+#elif defined (__unix__) || defined (UNIXCOMMON) || defined (__APPLE__)
+	return realpath(filename, NULL);
+#else
+	(void)filename;
+	return NULL;
+#endif
+}
+
+/** Looks a file up in the MD5 cache, without hashing it.
+  *
+  * \param filename File to get the MD5 of.
+  * \param md5sum Where to put it.
+  * \return true if the file was there and hasn't changed since.
+  */
+boolean D_CachedFileMD5(const char *filename, UINT8 *md5sum)
+{
+	char *resolved = D_MD5CachePath(filename);
+	const char *fullpath = resolved ? resolved : filename;
+	md5cacheentry_t *entry = NULL;
+	struct stat st;
+
+	if (!md5cacheloaded)
+		D_LoadMD5Cache();
+
+	if (stat(fullpath, &st) == 0)
+		entry = D_FindMD5CacheEntry(fullpath);
+	free(resolved);
+
+	if (!entry)
+	{
+		md5cachemisses++;
+		return false;
+	}
+
+	if (md5rehash || entry->size != (unsigned long)st.st_size
+		|| entry->mtime != (long)st.st_mtime || entry->inode != (unsigned long)st.st_ino)
+	{
+		md5cachestale++;
+		return false;
+	}
+
+	M_Memcpy(md5sum, entry->md5sum, 16);
+	md5cachehits++;
+	return true;
+}
+
+/** Stores the MD5 of a file that was just hashed in the MD5 cache.
+  *
+  * \param filename File the MD5 is of.
+  * \param md5sum Its MD5.
+  */
+void D_RememberFileMD5(const char *filename, const UINT8 *md5sum)
+{
+	char *resolved = D_MD5CachePath(filename);
+	const char *fullpath = resolved ? resolved : filename;
+	md5cacheentry_t *entry;
+	char path[MAX_WADPATH+32];
+	struct stat st;
+	FILE *f;
+
+	if (!md5cacheloaded)
+		D_LoadMD5Cache();
+
+	// A file modified just now could still change within the same second
+	// without its mtime showing it, so only remember settled files.
+	if (stat(fullpath, &st) != 0 || (long)st.st_mtime >= (long)time(NULL) - MD5CACHEFRESH)
+	{
+		free(resolved);
+		return;
+	}
+
+	entry = D_SetMD5CacheEntry(fullpath, md5sum, (unsigned long)st.st_size, (long)st.st_mtime, (unsigned long)st.st_ino);
+	free(resolved);
+
+	snprintf(path, sizeof path, "%s" PATHSEP MD5CACHEFILE, srb2home);
+	if ((f = fopen(path, "a")) != NULL)
+	{
+		if (!ftell(f))
+			fprintf(f, MD5CACHEHEADER "\n");
+		D_WriteMD5CacheEntry(f, entry);
+		fclose(f);
+	}
+}
+#endif
+
+/** Hashes a file without looking in the MD5 cache, and remembers its MD5
+  * there.
+  *
+  * \param filename File to get the MD5 of.
+  * \param md5sum Where to put it.
+  * \return false if the file couldn't be read.
+  */
+boolean D_HashFileMD5(const char *filename, UINT8 *md5sum)
+{
+#if defined (NOMD5) || defined (_arch_dreamcast)
+	(void)filename;
+	memset(md5sum, 0x00, 16);
+	return true;
+#else
+	FILE *fhandle;
+
+	if ((fhandle = fopen(filename, "rb")) == NULL)
+		return false;
+	if (md5_stream(fhandle, md5sum) == 1)
+	{
+		fclose(fhandle);
+		return false;
+	}
+	fclose(fhandle);
+
+	D_RememberFileMD5(filename, md5sum);
+	return true;
+#endif
+}
+
+/** Gets the MD5 of a file, from the MD5 cache if the file hasn't changed
+  * since it was last hashed.
+  *
+  * \param filename File to get the MD5 of.
+  * \param md5sum Where to put it.
+  * \return false if the file couldn't be read.
+  */
+boolean D_FileMD5(const char *filename, UINT8 *md5sum)
+{
+#if !defined (NOMD5) && !defined (_arch_dreamcast)
+	if (D_CachedFileMD5(filename, md5sum))
+		return true;
+#endif
+	return D_HashFileMD5(filename, md5sum);
+}
+
+void Command_MD5Cache_f(void)
+{
+	if (COM_Argc() > 1 && !stricmp(COM_Argv(1), "clear"))
+	{
+		D_ClearMD5Cache();
+		md5cacheloaded = true;
+		D_SaveMD5Cache();
+		CONS_Printf(M_GetText("MD5 cache cleared.\n"));
+		return;
+	}
+
+	if (!md5cacheloaded)
+		D_LoadMD5Cache();
+
+	CONS_Printf(M_GetText("MD5 cache: %u files%s\n"), md5cacheentries, md5rehash ? M_GetText(" (ignored, -rehash)") : "");
+	CONS_Printf(M_GetText("Hits: %u, misses: %u, changed files: %u\n"), md5cachehits, md5cachemisses, md5cachestale);
+	CONS_Printf(M_GetText("Use \"md5cache clear\" to forget every file.\n"));
+}
+
 filestatus_t checkfilemd5(char *filename, const UINT8 *wantedmd5sum)
 {
 #if defined (NOMD5) || defined (_arch_dreamcast)
 	(void)wantedmd5sum;
 	(void)filename;
 #else
-	FILE *fhandle;
 	UINT8 md5sum[16];
 
 	if (!wantedmd5sum)
 		return FS_FOUND;
 
-	fhandle = fopen(filename, "rb");
-	if (fhandle)
+	if (D_FileMD5(filename, md5sum))
 	{
-		md5_stream(fhandle,md5sum);
-		fclose(fhandle);
 		if (!memcmp(wantedmd5sum, md5sum, 16))
 			return FS_FOUND;
 		return FS_MD5SUMBAD;
@@ -20,7 +20,8 @@ typedef enum
 	SF_FILE,
 	SF_Z_RAM,
 	SF_RAM,
-	SF_NOFREERAM
+	SF_NOFREERAM,
+	SF_SHAREDRAM // Allocated with SV_AllocSharedRam, released when the transfer ends
 } freemethod_t;
 
 typedef enum
@@ -47,6 +48,42 @@ typedef struct
 	filestatus_t status; // The value returned by recsearch
 } fileneeded_t;
 
+// Set in filetx_pak.fileid for fragments of a windowed transfer,
+// which aren't sent reliably and must be acknowledged with PT_FILEACK
+#define FILETX_WINDOWED 0x80
+
+// Set in filetx_pak.position for fragments of a file's deflated copy
+#define FILETX_COMPRESSED 0x40000000
+
+// Set in filetx_pak.position, instead of sending the data, for a range of the
+// file the receiver said it already has; the fragment holds the range's length
+#define FILETX_SKIPPED 0x20000000
+
+// Sent after the file list in PT_REQUESTFILE
+#define FILECAP_WINDOWED   0x01 // Client acknowledges windowed fragments
+#define FILECAP_COMPRESSED 0x02 // Client inflates FILETX_COMPRESSED fragments
+#define FILECAP_RANGES     0x04 // Valid ranges of partial downloads follow
+
+// At most this many ranges are listed for each file, each as its start,
+// length and MD5. They are made of whole chunks, and their MD5 is the MD5
+// of their chunks' MD5s, one after the other.
+#define FILEMAXRANGES 8
+#define FILERANGESIZE (4 + 4 + 16)
+#define FILECHUNKSHIFT 16
+#define FILECHUNKSIZE (1<<FILECHUNKSHIFT)
+
+// Statistics about the files being sent to a node
+typedef struct
+{
+	INT32 numfiles; // Files left to send
+	boolean windowed;
+	UINT32 sentbytes, ackedbytes;
+	UINT32 resent; // Fragments sent again
+	INT32 window, inflight; // In fragments
+	INT32 rtt; // In milliseconds
+	UINT32 rate; // Bytes per second
+} filesendstats_t;
+
 extern INT32 fileneedednum;
 extern fileneeded_t fileneeded[MAX_WADFILES];
 extern char downloaddir[512];
@@ -73,10 +110,17 @@ INT32 CL_CheckFiles(void);
 boolean CL_LoadServerFiles(void);
 void SV_SendRam(INT32 node, void *data, size_t size, freemethod_t freemethod,
 	UINT8 fileid);
+void *SV_AllocSharedRam(size_t size);
+void SV_ReleaseSharedRam(void *data);
 
 void SV_FileSendTicker(void);
 void Got_Filetxpak(void);
+void Got_FileAckPak(INT32 node);
+void CL_SendFileAcks(void);
 boolean SV_SendingFile(INT32 node);
+void SV_SetFileCaps(INT32 node, UINT8 caps);
+void SV_PrepareCompressedFiles(void);
+boolean SV_GetFileSendStats(INT32 node, filesendstats_t *stats);
 
 boolean CL_CheckDownloadable(void);
 boolean CL_SendRequestFile(void);
@@ -91,6 +135,13 @@ boolean fileexist(char *filename, time_t ptime);
 filestatus_t findfile(char *filename, const UINT8 *wantedmd5sum,
 	boolean completepath);
 filestatus_t checkfilemd5(char *filename, const UINT8 *wantedmd5sum);
+boolean D_FileMD5(const char *filename, UINT8 *md5sum);
+boolean D_HashFileMD5(const char *filename, UINT8 *md5sum);
+#if !defined (NOMD5) && !defined (_arch_dreamcast)
+boolean D_CachedFileMD5(const char *filename, UINT8 *md5sum);
+void D_RememberFileMD5(const char *filename, const UINT8 *md5sum);
+#endif
+void Command_MD5Cache_f(void);
 
 void nameonly(char *s);
 size_t nameonlylength(const char *s);
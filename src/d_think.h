@@ -49,6 +49,10 @@ typedef struct thinker_s
 	// killough 11/98: count of how many other objects reference
 	// this one using pointers. Used for garbage collection.
 	INT32 references;
+
+	// Neighbours in the mobj or precipitation list, NULL for other thinkers
+	struct thinker_s *classprev;
+	struct thinker_s *classnext;
 } thinker_t;
 
 #endif
@@ -99,6 +99,16 @@ extern void (*I_NetSend)(void);
 */
 extern boolean (*I_NetCanSend)(void);
 
+/**	\brief send whatever I_NetSend queued up while netqueueing was set
+*/
+extern void (*I_NetFlush)(void);
+
+/**	\brief	wait until a packet arrives, for at most timeout microseconds
+
+	\return	true if there is a packet waiting
+*/
+extern boolean (*I_NetWait)(UINT32 timeout);
+
 /**	\brief	close a connection
 
 	\param	nodenum	node to be closed
@@ -46,6 +46,11 @@ UINT32 I_GetFreeMem(UINT32 *total);
 */
 tic_t I_GetTime(void);
 
+/**	\brief	Returns current time in microseconds, on the same clock as
+	I_GetTime where the port can, so the start of a tic can be waited for.
+*/
+UINT64 I_GetTimeMicros(void);
+
 /**	\brief	The I_Sleep function
 
 	\return	void
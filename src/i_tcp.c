@@ -12,6 +12,10 @@
 ///        This is not really OS-dependent because all OSes have the same socket API.
 ///        Just use ifdef for OS-dependent parts.
 
+#if defined (__linux__) && !defined (_GNU_SOURCE)
+#define _GNU_SOURCE // recvmmsg, ppoll
+#endif
+
 #include <stdlib.h>
 #include <string.h>
 #include <stdio.h>
@@ -176,6 +180,29 @@ static UINT8 UPNP_support = TRUE;
 
 #define MAXBANS 100
 
+// Packets are read in batches with recvmmsg where there is one, and
+// handed out one at a time from a ring.
+#if defined (__linux__) && !defined (NONET)
+#define HAVE_RECVMMSG
+#define RECVBATCH 32
+#endif
+
+// While netqueueing is set, packets to nodes are queued up and sent
+// together, with sendmmsg where there is one.
+#if defined (__linux__) && !defined (NONET)
+#define HAVE_SENDMMSG
+#endif
+#define SENDBATCH 64
+
+// Dedicated servers and the network thread can block on the sockets until a
+// packet arrives or the next tic starts, with ppoll where the timeout can be
+// under a millisecond.
+#if ((defined (__unix__) && !defined (MSDOS)) || defined (__APPLE__) || defined (__HAIKU__)) && !defined (NONET)
+#define HAVE_POLL
+#include <poll.h>
+#include <time.h>
+#endif
+
 #include "i_system.h"
 #include "i_net.h"
 #include "d_net.h"
@@ -240,6 +267,48 @@ static size_t broadcastaddresses = 0;
 static boolean nodeconnected[MAXNETNODES+1];
 static mysockaddr_t banned[MAXBANS];
 static UINT8 bannedmask[MAXBANS];
+
+// Nodes are found from their address through a hash of clientaddress.
+// Addresses without a port match any port, so they are kept apart.
+#define NODEHASHSIZE 256 // a power of two, well above MAXNETNODES
+static INT16 nodehash[NODEHASHSIZE]; // first node in each chain, or -1
+static INT16 nodehashnext[MAXNETNODES+1];
+static boolean nodehashed[MAXNETNODES+1];
+static boolean nodewildcard[MAXNETNODES+1]; // hashed, but with no port
+static size_t nodewildcards;
+
+// Bans are looked up through a binary trie of the banned prefixes, one
+// root for each address family.
+#define BANTRIESIZE (2 + MAXBANS*128)
+typedef struct
+{
+	INT16 child[2]; // 0 if none; node 0 is a root, so never a child
+	boolean banned; // a ban covers everything under here
+} bantrie_t;
+static bantrie_t bantrie[BANTRIESIZE];
+static INT32 bantrienodes;
+
+#ifdef HAVE_RECVMMSG
+static struct mmsghdr recvmsgs[RECVBATCH];
+static struct iovec recviovs[RECVBATCH];
+static mysockaddr_t recvaddrs[RECVBATCH];
+static UINT8 recvbufs[RECVBATCH][MAXPACKETLENGTH];
+static size_t recvhead, recvcount; // packets left in the ring
+static SOCKET_TYPE recvsocket; // the socket they came from
+static boolean recvmmsgbroken; // not supported by the kernel
+#endif
+
+static UINT8 sendbufs[SENDBATCH][MAXPACKETLENGTH];
+static size_t sendlens[SENDBATCH];
+static mysockaddr_t sendaddrs[SENDBATCH];
+static SOCKET_TYPE sendsockets[SENDBATCH];
+static INT32 sendnodes[SENDBATCH]; // for error messages
+static size_t sendqueued;
+#ifdef HAVE_SENDMMSG
+static struct mmsghdr sendmsgs[SENDBATCH];
+static struct iovec sendiovs[SENDBATCH];
+static boolean sendmmsgbroken; // not supported by the kernel
+#endif
 #endif
 
 static size_t numbans = 0;
@@ -502,13 +571,214 @@ static boolean SOCK_cmpaddr(mysockaddr_t *a, mysockaddr_t *b, UINT8 mask)
 			&& (b->ip4.sin_port == 0 || (a->ip4.sin_port == b->ip4.sin_port));
 #ifdef HAVE_IPV6
 	else if (b->any.sa_family == AF_INET6)
-		return memcmp(&a->ip6.sin6_addr, &b->ip6.sin6_addr, sizeof(b->ip6.sin6_addr))
+		return a->any.sa_family == AF_INET6
+			&& !memcmp(&a->ip6.sin6_addr, &b->ip6.sin6_addr, sizeof(b->ip6.sin6_addr))
 			&& (b->ip6.sin6_port == 0 || (a->ip6.sin6_port == b->ip6.sin6_port));
 #endif
 	else
 		return false;
 }
 
+// Gets the address bytes and port of an address, for hashing and bans.
+static const UINT8 *SOCK_AddrBytes(const mysockaddr_t *sk, size_t *len, UINT16 *port)
+{
+	if (sk->any.sa_family == AF_INET)
+	{
+		*len = sizeof (sk->ip4.sin_addr);
+		*port = sk->ip4.sin_port;
+		return (const UINT8 *)&sk->ip4.sin_addr;
+	}
+#ifdef HAVE_IPV6
+	if (sk->any.sa_family == AF_INET6)
+	{
+		*len = sizeof (sk->ip6.sin6_addr);
+		*port = sk->ip6.sin6_port;
+		return (const UINT8 *)&sk->ip6.sin6_addr;
+	}
+#endif
+	*len = 0;
+	*port = 0;
+	return NULL;
+}
+
+static UINT32 SOCK_HashAddr(const mysockaddr_t *sk)
+{
+	UINT32 hash = 2166136261u;
+	const UINT8 *bytes;
+	size_t len;
+	UINT16 port;
+
+	bytes = SOCK_AddrBytes(sk, &len, &port);
+	while (len--)
+		hash = (hash ^ *bytes++) * 16777619u;
+	hash = (hash ^ (port & 0xFF)) * 16777619u;
+	hash = (hash ^ (port >> 8)) * 16777619u;
+	return hash & (NODEHASHSIZE - 1);
+}
+
+static void SOCK_UnhashNode(INT32 node)
+{
+	INT16 *link;
+
+	if (!nodehashed[node])
+		return;
+
+	if (nodewildcard[node])
+	{
+		nodewildcard[node] = false;
+		nodewildcards--;
+	}
+	else
+	{
+		for (link = &nodehash[SOCK_HashAddr(&clientaddress[node])]; *link != -1; link = &nodehashnext[*link])
+		{
+			if (*link == node)
+			{
+				*link = nodehashnext[node];
+				break;
+			}
+		}
+	}
+	nodehashed[node] = false;
+}
+
+static void SOCK_HashNode(INT32 node)
+{
+	const UINT8 *bytes;
+	size_t len;
+	UINT16 port;
+	UINT32 hash;
+
+	bytes = SOCK_AddrBytes(&clientaddress[node], &len, &port);
+	if (!bytes)
+		return; // no address, never matches anything
+
+	if (!port)
+	{
+		nodewildcard[node] = true;
+		nodewildcards++;
+	}
+	else
+	{
+		hash = SOCK_HashAddr(&clientaddress[node]);
+		nodehashnext[node] = nodehash[hash];
+		nodehash[hash] = (INT16)node;
+	}
+	nodehashed[node] = true;
+}
+
+// Changes the address of a node, keeping the hash in step.
+static void SOCK_SetNodeAddress(INT32 node, const void *addr, size_t len)
+{
+	SOCK_UnhashNode(node);
+	memset(&clientaddress[node], 0, sizeof (clientaddress[node]));
+	if (addr)
+		M_Memcpy(&clientaddress[node], addr, min(len, sizeof (clientaddress[node])));
+	SOCK_HashNode(node);
+}
+
+static void SOCK_ClearNodeAddresses(void)
+{
+	INT32 i;
+
+	memset(clientaddress, 0, sizeof (clientaddress));
+	for (i = 0; i < NODEHASHSIZE; i++)
+		nodehash[i] = -1;
+	memset(nodehashed, 0, sizeof (nodehashed));
+	memset(nodewildcard, 0, sizeof (nodewildcard));
+	nodewildcards = 0;
+}
+
+// Finds the node a packet came from, the lowest numbered one if the
+// address somehow belongs to several. Returns -1 if none.
+static INT32 SOCK_FindNode(mysockaddr_t *from)
+{
+	INT32 node, found = MAXNETNODES+1;
+
+	if (from->any.sa_family != AF_INET
+#ifdef HAVE_IPV6
+		&& from->any.sa_family != AF_INET6
+#endif
+		)
+		return -1;
+
+	for (node = nodehash[SOCK_HashAddr(from)]; node != -1; node = nodehashnext[node])
+		if (node > 0 && node < found && SOCK_cmpaddr(from, &clientaddress[node], 0))
+			found = node;
+
+	if (nodewildcards)
+	{
+		for (node = 1; node < found; node++)
+			if (nodewildcard[node] && SOCK_cmpaddr(from, &clientaddress[node], 0))
+				found = node;
+	}
+
+	return (found <= MAXNETNODES) ? found : -1;
+}
+
+// Rebuilds the ban trie from banned and bannedmask.
+static void SOCK_BuildBanTrie(void)
+{
+	const UINT8 *bytes;
+	size_t ban, len, bits, bit;
+	UINT16 port;
+	INT32 at, next;
+	UINT8 b;
+
+	memset(bantrie, 0, sizeof (bantrie[0]) * 2);
+	bantrienodes = 2;
+
+	for (ban = 0; ban < numbans; ban++)
+	{
+		bytes = SOCK_AddrBytes(&banned[ban], &len, &port);
+		if (!bytes)
+			continue;
+
+		// no mask means the whole address
+		bits = bannedmask[ban];
+		if (!bits || bits > len*8)
+			bits = len*8;
+
+		at = (banned[ban].any.sa_family == AF_INET) ? 0 : 1;
+		for (bit = 0; bit < bits && !bantrie[at].banned; bit++)
+		{
+			b = (bytes[bit/8] >> (7 - bit%8)) & 1;
+			next = bantrie[at].child[b];
+			if (!next)
+			{
+				next = bantrienodes++;
+				memset(&bantrie[next], 0, sizeof (bantrie[next]));
+				bantrie[at].child[b] = (INT16)next;
+			}
+			at = next;
+		}
+		bantrie[at].banned = true;
+	}
+}
+
+static boolean SOCK_IsBanned(mysockaddr_t *from)
+{
+	const UINT8 *bytes;
+	size_t len, bit;
+	UINT16 port;
+	INT32 at;
+
+	bytes = SOCK_AddrBytes(from, &len, &port);
+	if (!bytes)
+		return false;
+
+	at = (from->any.sa_family == AF_INET) ? 0 : 1;
+	for (bit = 0; !bantrie[at].banned; bit++)
+	{
+		if (bit == len*8)
+			return false;
+		at = bantrie[at].child[(bytes[bit/8] >> (7 - bit%8)) & 1];
+		if (!at)
+			return false;
+	}
+	return true;
+}
+
 // This is a hack. For some reason, nodes aren't being freed properly.
 // This goes through and cleans up what nodes were supposed to be freed.
 /** \warning This function causes the file downloading to stop if someone joins.
@@ -596,15 +866,147 @@ void Command_Numnodes(void)
 #endif
 
 #ifndef NONET
-// Returns true if a packet was received from a new node, false in all other cases
-static boolean SOCK_Get(void)
+// Works out which node a packet that just arrived in doomcom came from,
+// giving the sender a new node if it has none.
+// Returns true if a packet was received from a new node, false otherwise,
+// including when the packet had to be dropped.
+static boolean SOCK_AcceptPacket(mysockaddr_t *fromaddress, socklen_t fromlen, SOCKET_TYPE socket, ssize_t c)
+{
+	INT32 j;
+
+	// find remote node number
+	j = SOCK_FindNode(fromaddress); //include LAN
+	if (j != -1)
+	{
+		doomcom->remotenode = (INT16)j; // good packet from a game player
+		doomcom->datalength = (INT16)c;
+		nodesocket[j] = socket;
+		return false;
+	}
+	// not found
+
+	// find a free slot
+	j = getfreenode();
+	if (j > 0)
+	{
+		SOCK_SetNodeAddress(j, fromaddress, fromlen);
+		nodesocket[j] = socket;
+		DEBFILE(va("New node detected: node:%d address:%s\n", j,
+				SOCK_GetNodeAddress(j)));
+		doomcom->remotenode = (INT16)j; // good packet from a game player
+		doomcom->datalength = (INT16)c;
+
+		// check if it's a banned dude so we can send a refusal later
+		SOCK_bannednode[j] = SOCK_IsBanned(fromaddress);
+		if (SOCK_bannednode[j])
+			DEBFILE("This dude has been banned\n");
+		return true;
+	}
+	else
+		DEBFILE("New node detected: No more free slots\n");
+
+	doomcom->remotenode = -1;
+	return false;
+}
+
+#ifdef HAVE_RECVMMSG
+// Reads as many packets as are waiting, up to RECVBATCH, from the first
+// socket that has any. Returns false if none had any, or recvmmsg can't
+// be used.
+static boolean SOCK_FillRing(void)
 {
 	size_t i, n;
-	int j;
+	int c;
+
+	for (i = 0; i < RECVBATCH; i++)
+	{
+		recviovs[i].iov_base = recvbufs[i];
+		recviovs[i].iov_len = MAXPACKETLENGTH;
+		memset(&recvmsgs[i].msg_hdr, 0, sizeof (recvmsgs[i].msg_hdr));
+		recvmsgs[i].msg_hdr.msg_name = &recvaddrs[i];
+		recvmsgs[i].msg_hdr.msg_namelen = sizeof (recvaddrs[i]);
+		recvmsgs[i].msg_hdr.msg_iov = &recviovs[i];
+		recvmsgs[i].msg_hdr.msg_iovlen = 1;
+	}
+
+	for (n = 0; n < mysocketses; n++)
+	{
+		c = recvmmsg(mysockets[n], recvmsgs, RECVBATCH, MSG_DONTWAIT, NULL);
+		if (c > 0)
+		{
+			recvhead = 0;
+			recvcount = (size_t)c;
+			recvsocket = mysockets[n];
+			return true;
+		}
+		if (c == ERRSOCKET && errno == ENOSYS)
+		{
+			recvmmsgbroken = true;
+			return false;
+		}
+	}
+	return false;
+}
+#endif
+
+#ifdef HAVE_POLL
+static boolean SOCK_Wait(UINT32 timeout)
+{
+	struct pollfd fds[MAXNETNODES+1];
+	size_t n;
+#ifdef __linux__
+	struct timespec ts;
+#endif
+
+	// Packets already in the ring are the caller's to look for first,
+	// with whatever it locks SOCK_Get with held
+	for (n = 0; n < mysocketses; n++)
+	{
+		fds[n].fd = mysockets[n];
+		fds[n].events = POLLIN;
+		fds[n].revents = 0;
+	}
+
+#ifdef __linux__
+	ts.tv_sec = timeout / 1000000;
+	ts.tv_nsec = (long)(timeout % 1000000) * 1000;
+	return ppoll(fds, mysocketses, &ts, NULL) > 0;
+#else
+	// rounded up, so the wait doesn't end before the tic
+	return poll(fds, mysocketses, (int)((timeout + 999) / 1000)) > 0;
+#endif
+}
+#endif
+
+static boolean SOCK_Get(void)
+{
+	size_t n;
 	ssize_t c;
 	mysockaddr_t fromaddress;
 	socklen_t fromlen;
 
+#ifdef HAVE_RECVMMSG
+	if (!recvmmsgbroken)
+	{
+		while (recvcount || SOCK_FillRing())
+		{
+			n = recvhead++;
+			recvcount--;
+			M_Memcpy(&doomcom->data, recvbufs[n], recvmsgs[n].msg_len);
+			if (SOCK_AcceptPacket(&recvaddrs[n], recvmsgs[n].msg_hdr.msg_namelen, recvsocket, recvmsgs[n].msg_len))
+				return true;
+			if (doomcom->remotenode != -1)
+				return false;
+		}
+
+		if (!recvmmsgbroken)
+		{
+			doomcom->remotenode = -1; // no packet
+			return false;
+		}
+	}
+#endif
+
 	for (n = 0; n < mysocketses; n++)
 	{
 		fromlen = (socklen_t)sizeof(fromaddress);
@@ -612,46 +1014,10 @@ static boolean SOCK_Get(void)
 			(void *)&fromaddress, &fromlen);
 		if (c != ERRSOCKET)
 		{
-			// find remote node number
-			for (j = 1; j <= MAXNETNODES; j++) //include LAN
-			{
-				if (SOCK_cmpaddr(&fromaddress, &clientaddress[j], 0))
-				{
-					doomcom->remotenode = (INT16)j; // good packet from a game player
-					doomcom->datalength = (INT16)c;
-					nodesocket[j] = mysockets[n];
-					return false;
-				}
-			}
-			// not found
-
-			// find a free slot
-			j = getfreenode();
-			if (j > 0)
-			{
-				M_Memcpy(&clientaddress[j], &fromaddress, fromlen);
-				nodesocket[j] = mysockets[n];
-				DEBFILE(va("New node detected: node:%d address:%s\n", j,
-						SOCK_GetNodeAddress(j)));
-				doomcom->remotenode = (INT16)j; // good packet from a game player
-				doomcom->datalength = (INT16)c;
-
-				// check if it's a banned dude so we can send a refusal later
-				for (i = 0; i < numbans; i++)
-				{
-					if (SOCK_cmpaddr(&fromaddress, &banned[i], bannedmask[i]))
-					{
-						SOCK_bannednode[j] = true;
-						DEBFILE("This dude has been banned\n");
-						break;
-					}
-				}
-				if (i == numbans)
-					SOCK_bannednode[j] = false;
+			if (SOCK_AcceptPacket(&fromaddress, fromlen, mysockets[n], c))
 				return true;
-			}
-			else
-				DEBFILE("New node detected: No more free slots\n");
+			if (doomcom->remotenode != -1)
+				return false;
 		}
 	}
 
@@ -710,28 +1076,117 @@ static boolean SOCK_CanGet(void)
 		return true;
 	return false;
 }
+
+#ifndef HAVE_POLL
+// Like the poll one, for the network thread where there is no poll
+static boolean SOCK_Wait(UINT32 timeout)
+{
+	struct timeval timeval_for_select;
+	fd_set tset;
+
+	if(!FD_CPY(&masterset, &tset, mysockets, mysocketses))
+		return false;
+	timeval_for_select.tv_sec = timeout / 1000000;
+	timeval_for_select.tv_usec = timeout % 1000000;
+	return select(255, &tset, NULL, NULL, &timeval_for_select) >= 1;
+}
+#endif
 #endif
 #endif
 
 #ifndef NONET
-static inline ssize_t SOCK_SendToAddr(SOCKET_TYPE socket, mysockaddr_t *sockaddr)
+static socklen_t SOCK_AddrLen(const mysockaddr_t *sockaddr)
 {
-	socklen_t d4 = (socklen_t)sizeof(struct sockaddr_in);
+	switch (sockaddr->any.sa_family)
+	{
+		case AF_INET:  return (socklen_t)sizeof(struct sockaddr_in);
 #ifdef HAVE_IPV6
-	socklen_t d6 = (socklen_t)sizeof(struct sockaddr_in6);
+		case AF_INET6: return (socklen_t)sizeof(struct sockaddr_in6);
 #endif
-	socklen_t d, da = (socklen_t)sizeof(mysockaddr_t);
+		default:       return (socklen_t)sizeof(mysockaddr_t);
+	}
+}
 
-	switch (sockaddr->any.sa_family)
+static inline ssize_t SOCK_SendToAddr(SOCKET_TYPE socket, mysockaddr_t *sockaddr)
+{
+	sendpackets++;
+	sendcalls++;
+	return sendto(socket, (char *)&doomcom->data, doomcom->datalength, 0, &sockaddr->any, SOCK_AddrLen(sockaddr));
+}
+
+static void SOCK_SendError(INT32 node)
+{
+	int e = errno; // save error code so it can't be modified later
+	if (e != ECONNREFUSED && e != EWOULDBLOCK)
+		I_Error("SOCK_Send, error sending to node %d (%s) #%u: %s", node,
+			SOCK_GetNodeAddress(node), e, strerror(e));
+}
+
+// Sends one queued packet on its own.
+static void SOCK_SendQueued(size_t i)
+{
+	sendpackets++;
+	sendcalls++;
+	if (sendto(sendsockets[i], (char *)sendbufs[i], sendlens[i], 0, &sendaddrs[i].any, SOCK_AddrLen(&sendaddrs[i])) == ERRSOCKET)
+		SOCK_SendError(sendnodes[i]);
+}
+
+// Sends every queued packet, a socket's worth at a time.
+static void SOCK_Flush(void)
+{
+	size_t i = 0;
+#ifdef HAVE_SENDMMSG
+	size_t j, k;
+	int c;
+#endif
+
+	while (i < sendqueued)
 	{
-		case AF_INET:  d = d4; break;
-#ifdef HAVE_IPV6
-		case AF_INET6: d = d6; break;
+#ifdef HAVE_SENDMMSG
+		if (!sendmmsgbroken)
+		{
+			for (j = i; j < sendqueued && sendsockets[j] == sendsockets[i]; j++)
+			{
+				sendiovs[j].iov_base = sendbufs[j];
+				sendiovs[j].iov_len = sendlens[j];
+				memset(&sendmsgs[j].msg_hdr, 0, sizeof (sendmsgs[j].msg_hdr));
+				sendmsgs[j].msg_hdr.msg_name = &sendaddrs[j];
+				sendmsgs[j].msg_hdr.msg_namelen = SOCK_AddrLen(&sendaddrs[j]);
+				sendmsgs[j].msg_hdr.msg_iov = &sendiovs[j];
+				sendmsgs[j].msg_hdr.msg_iovlen = 1;
+			}
+
+			while (i < j)
+			{
+				k = j - i;
+				c = sendmmsg(sendsockets[i], &sendmsgs[i], (unsigned int)k, 0);
+				if (c == ERRSOCKET && errno == ENOSYS)
+				{
+					sendmmsgbroken = true;
+					break;
+				}
+				sendcalls++;
+
+				// The packet it stopped at failed; report it and skip it.
+				if (c > 0)
+				{
+					sendpackets += c;
+					i += c;
+				}
+				else
+				{
+					sendpackets++;
+					SOCK_SendError(sendnodes[i]);
+					i++;
+				}
+			}
+			continue;
+		}
 #endif
-		default:       d = da; break;
+		SOCK_SendQueued(i++);
 	}
 
-	return sendto(socket, (char *)&doomcom->data, doomcom->datalength, 0, &sockaddr->any, d);
+	sendqueued = 0;
 }
 
 static void SOCK_Send(void)
@@ -763,18 +1218,26 @@ static void SOCK_Send(void)
 		}
 		return;
 	}
+	else if (netqueueing)
+	{
+		if (sendqueued == SENDBATCH)
+			SOCK_Flush();
+
+		i = sendqueued++;
+		M_Memcpy(sendbufs[i], &doomcom->data, doomcom->datalength);
+		sendlens[i] = doomcom->datalength;
+		M_Memcpy(&sendaddrs[i], &clientaddress[doomcom->remotenode], sizeof (sendaddrs[i]));
+		sendsockets[i] = nodesocket[doomcom->remotenode];
+		sendnodes[i] = doomcom->remotenode;
+		return;
+	}
 	else
 	{
 		c = SOCK_SendToAddr(nodesocket[doomcom->remotenode], &clientaddress[doomcom->remotenode]);
 	}
 
 	if (c == ERRSOCKET)
-	{
-		int e = errno; // save error code so it can't be modified later
-		if (e != ECONNREFUSED && e != EWOULDBLOCK)
-			I_Error("SOCK_Send, error sending to node %d (%s) #%u: %s", doomcom->remotenode,
-				SOCK_GetNodeAddress(doomcom->remotenode), e, strerror(e));
-	}
+		SOCK_SendError(doomcom->remotenode);
 }
 #endif
 
@@ -791,7 +1254,7 @@ static void SOCK_FreeNodenum(INT32 numnode)
 	nodesocket[numnode] = ERRSOCKET;
 
 	// put invalid address
-	memset(&clientaddress[numnode], 0, sizeof (clientaddress[numnode]));
+	SOCK_SetNodeAddress(numnode, NULL, 0);
 }
 #endif
 
@@ -1264,6 +1727,8 @@ boolean I_InitTcpDriver(void)
 static void SOCK_CloseSocket(void)
 {
 	size_t i;
+
+	SOCK_Flush();
 	for (i=0; i < MAXNETNODES+1; i++)
 	{
 		if (mysockets[i] != (SOCKET_TYPE)ERRSOCKET
@@ -1346,7 +1811,7 @@ static SINT8 SOCK_NetMakeNodewPort(const char *address, const char *port)
 		// find ip of the server
 		if (sendto(mysockets[0], NULL, 0, 0, runp->ai_addr, runp->ai_addrlen) == 0)
 		{
-			memcpy(&clientaddress[newnode], runp->ai_addr, runp->ai_addrlen);
+			SOCK_SetNodeAddress(newnode, runp->ai_addr, runp->ai_addrlen);
 			break;
 		}
 		runp = runp->ai_next;
@@ -1361,22 +1826,29 @@ static boolean SOCK_OpenSocket(void)
 #ifndef NONET
 	size_t i;
 
-	memset(clientaddress, 0, sizeof (clientaddress));
+	SOCK_ClearNodeAddresses();
 
 	nodeconnected[0] = true; // always connected to self
 	for (i = 1; i < MAXNETNODES; i++)
 		nodeconnected[i] = false;
 	nodeconnected[BROADCASTADDR] = true;
 	I_NetSend = SOCK_Send;
+	I_NetFlush = SOCK_Flush;
 	I_NetGet = SOCK_Get;
 	I_NetCloseSocket = SOCK_CloseSocket;
 	I_NetFreeNodenum = SOCK_FreeNodenum;
 	I_NetMakeNodewPort = SOCK_NetMakeNodewPort;
+#ifdef HAVE_POLL
+	I_NetWait = SOCK_Wait;
+#endif
 
 #ifdef SELECTTEST
 	// seem like not work with libsocket : (
 	I_NetCanSend = SOCK_CanSend;
 	I_NetCanGet = SOCK_CanGet;
+#ifndef HAVE_POLL
+	I_NetWait = SOCK_Wait;
+#endif
 #endif
 
 	// build the socket but close it first
@@ -1411,6 +1883,7 @@ static boolean SOCK_Ban(INT32 node)
 	}
 #endif
 	numbans++;
+	SOCK_BuildBanTrie();
 	return true;
 #endif
 }
@@ -1464,6 +1937,7 @@ static boolean SOCK_SetBanAddress(const char *address, const char *mask)
 	}
 
 	I_freeaddrinfo(ai);
+	SOCK_BuildBanTrie();
 
 	return true;
 #endif
@@ -1472,6 +1946,9 @@ static boolean SOCK_SetBanAddress(const char *address, const char *mask)
 static void SOCK_ClearBans(void)
 {
 	numbans = 0;
+#ifndef NONET
+	SOCK_BuildBanTrie();
+#endif
 }
 
 boolean I_InitTcpNetwork(void)
@@ -5228,6 +5228,164 @@ static void K_KartDrift(player_t *player, boolean onground)
 	else
 		player->kartstuff[k_brakedrift] = 0;
 }
+// How far a player is from the checkpoints either side of them, for
+// K_KartUpdatePosition. It only depends on where the player is, so it's
+// kept until they move instead of walking the waypoints for every pair of
+// players.
+typedef struct
+{
+	boolean valid;
+	tic_t leveltime;
+	fixed_t x, y, z;
+	INT32 starpostnum;
+	UINT8 laps;
+	fixed_t prevcheck, nextcheck;
+	fixed_t selfprevcheck, selfnextcheck; // what comparing with themselves leaves
+} raceprogress_t;
+
+static raceprogress_t raceprogress[MAXPLAYERS];
+
+static kartwaypoint_t *waypointindex; // PU_LEVEL
+static size_t numwaypointindex;
+
+// lap < 0 matches every lap
+static int K_CompareWaypoint(const kartwaypoint_t *wp, INT32 starpost, INT32 lap)
+{
+	if (wp->starpost != starpost)
+		return (wp->starpost < starpost) ? -1 : 1;
+	if (lap < 0 || wp->lap == lap)
+		return 0;
+	return (wp->lap < lap) ? -1 : 1;
+}
+
+static int K_CompareWaypoints(const void *a, const void *b)
+{
+	const kartwaypoint_t *wb = b;
+	return K_CompareWaypoint(a, wb->starpost, wb->lap);
+}
+
+/** Indexes the waypoints in waypointcap by starpost and lap, once the
+  * level's things have been spawned or loaded.
+  */
+void K_IndexWaypoints(void)
+{
+	mobj_t *mo;
+	size_t i = 0;
+
+	memset(raceprogress, 0, sizeof (raceprogress));
+
+	if (waypointindex)
+		Z_Free(waypointindex);
+	waypointindex = NULL;
+	numwaypointindex = 0;
+
+	for (mo = waypointcap; mo != NULL; mo = mo->tracer)
+		numwaypointindex++;
+	if (!numwaypointindex)
+		return;
+
+	Z_Malloc(numwaypointindex * sizeof (*waypointindex), PU_LEVEL, &waypointindex);
+	for (mo = waypointcap; mo != NULL; mo = mo->tracer, i++)
+	{
+		waypointindex[i].starpost = mo->health;
+		waypointindex[i].lap = mo->movecount;
+		waypointindex[i].mo = mo;
+	}
+
+	qsort(waypointindex, numwaypointindex, sizeof (*waypointindex), K_CompareWaypoints);
+}
+
+/** Finds the waypoints of a checkpoint for a lap.
+  *
+  * \param starpost The starpost number the checkpoint goes with.
+  * \param lap Lap restriction, as the waypoints' movecount: 0 for the ones
+  *            used on every lap, -1 for all of them.
+  * \param count Set to how many were found.
+  * \return The first of them, or NULL.
+  */
+kartwaypoint_t *K_GetWaypoints(INT32 starpost, INT32 lap, size_t *count)
+{
+	size_t low = 0, high = numwaypointindex, mid, first;
+
+	*count = 0;
+	if (!waypointindex) // freed with the level
+		return NULL;
+
+	while (low < high)
+	{
+		mid = (low + high) / 2;
+		if (K_CompareWaypoint(&waypointindex[mid], starpost, lap) < 0)
+			low = mid + 1;
+		else
+			high = mid;
+	}
+
+	first = low;
+	while (low < numwaypointindex && !K_CompareWaypoint(&waypointindex[low], starpost, lap))
+		low++;
+
+	*count = low - first;
+	return *count ? &waypointindex[first] : NULL;
+}
+
+static raceprogress_t *K_GetRaceProgress(player_t *player)
+{
+	raceprogress_t *progress = &raceprogress[player - players];
+	fixed_t prevsum = 0, nextsum = 0, prevcount = 0, nextcount = 0;
+	const INT32 laps[2] = {0, player->laps+1};
+	kartwaypoint_t *wp;
+	size_t i, j, count;
+
+	if (progress->valid && progress->leveltime == leveltime
+		&& progress->x == player->mo->x && progress->y == player->mo->y && progress->z == player->mo->z
+		&& progress->starpostnum == player->starpostnum && progress->laps == player->laps)
+		return progress;
+
+	// Waypoints for every lap, then for this one
+	for (i = 0; i < 2; i++)
+	{
+		wp = K_GetWaypoints(player->starpostnum, laps[i], &count);
+		for (j = 0; j < count; j++, wp++)
+		{
+			prevsum += P_AproxDistance(P_AproxDistance(	wp->mo->x - player->mo->x,
+														wp->mo->y - player->mo->y),
+														wp->mo->z - player->mo->z) / FRACUNIT;
+			prevcount++;
+		}
+
+		wp = K_GetWaypoints(player->starpostnum + 1, laps[i], &count);
+		for (j = 0; j < count; j++, wp++)
+		{
+			nextsum += P_AproxDistance(P_AproxDistance(	wp->mo->x - player->mo->x,
+														wp->mo->y - player->mo->y),
+														wp->mo->z - player->mo->z) / FRACUNIT;
+			nextcount++;
+		}
+	}
+
+	progress->valid = true;
+	progress->leveltime = leveltime;
+	progress->x = player->mo->x;
+	progress->y = player->mo->y;
+	progress->z = player->mo->z;
+	progress->starpostnum = player->starpostnum;
+	progress->laps = player->laps;
+
+	progress->prevcheck = (prevcount > 1) ? prevsum / prevcount : prevsum;
+	progress->nextcheck = (nextcount > 1) ? nextsum / nextcount : nextsum;
+
+	// Against themselves, every waypoint used to be counted twice and
+	// the sum divided twice.
+	progress->selfprevcheck = prevsum + prevsum;
+	if (prevcount > 1)
+		progress->selfprevcheck = progress->selfprevcheck / prevcount / prevcount;
+	progress->selfnextcheck = nextsum + nextsum;
+	if (nextcount > 1)
+		progress->selfnextcheck = progress->selfnextcheck / nextcount / nextcount;
+
+	return progress;
+}
+
 //
 // K_KartUpdatePosition
 //
@@ -5235,9 +5393,8 @@ void K_KartUpdatePosition(player_t *player)
 {
 	fixed_t position = 1;
 	fixed_t oldposition = player->kartstuff[k_position];
-	fixed_t i, ppcd, pncd, ipcd, incd;
-	fixed_t pmo, imo;
-	mobj_t *mo;
+	fixed_t i;
+	raceprogress_t *progress, *iprogress;
 
 	if (player->spectator || !player->mo)
 		return;
@@ -5255,47 +5412,21 @@ void K_KartUpdatePosition(player_t *player)
 			else if (((players[i].starpostnum) + (numstarposts+1)*players[i].laps) ==
 				((player->starpostnum) + (numstarposts+1)*player->laps))
 			{
-				ppcd = pncd = ipcd = incd = 0;
-
-				player->kartstuff[k_prevcheck] = players[i].kartstuff[k_prevcheck] = 0;
-				player->kartstuff[k_nextcheck] = players[i].kartstuff[k_nextcheck] = 0;
+				progress = K_GetRaceProgress(player);
 
-				// This checks every thing on the map, and looks for MT_BOSS3WAYPOINT (the thing we're using for checkpoint wp's, for now)
-				for (mo = waypointcap; mo != NULL; mo = mo->tracer)
+				if (&players[i] == player)
 				{
-					pmo = P_AproxDistance(P_AproxDistance(	mo->x - player->mo->x,
-															mo->y - player->mo->y),
-															mo->z - player->mo->z) / FRACUNIT;
-					imo = P_AproxDistance(P_AproxDistance(	mo->x - players[i].mo->x,
-															mo->y - players[i].mo->y),
-															mo->z - players[i].mo->z) / FRACUNIT;
-
-					if (mo->health == player->starpostnum && (!mo->movecount || mo->movecount == player->laps+1))
-					{
-						player->kartstuff[k_prevcheck] += pmo;
-						ppcd++;
-					}
-					if (mo->health == (player->starpostnum + 1) && (!mo->movecount || mo->movecount == player->laps+1))
-					{
-						player->kartstuff[k_nextcheck] += pmo;
-						pncd++;
-					}
-					if (mo->health == players[i].starpostnum && (!mo->movecount || mo->movecount == players[i].laps+1))
-					{
-						players[i].kartstuff[k_prevcheck] += imo;
-						ipcd++;
-					}
-					if (mo->health == (players[i].starpostnum + 1) && (!mo->movecount || mo->movecount == players[i].laps+1))
-					{
-						players[i].kartstuff[k_nextcheck] += imo;
-						incd++;
-					}
+					player->kartstuff[k_prevcheck] = progress->selfprevcheck;
+					player->kartstuff[k_nextcheck] = progress->selfnextcheck;
+				}
+				else
+				{
+					iprogress = K_GetRaceProgress(&players[i]);
+					player->kartstuff[k_prevcheck] = progress->prevcheck;
+					player->kartstuff[k_nextcheck] = progress->nextcheck;
+					players[i].kartstuff[k_prevcheck] = iprogress->prevcheck;
+					players[i].kartstuff[k_nextcheck] = iprogress->nextcheck;
 				}
-
-				if (ppcd > 1) player->kartstuff[k_prevcheck] /= ppcd;
-				if (pncd > 1) player->kartstuff[k_nextcheck] /= pncd;
-				if (ipcd > 1) players[i].kartstuff[k_prevcheck] /= ipcd;
-				if (incd > 1) players[i].kartstuff[k_nextcheck] /= incd;
 
 				if ((players[i].kartstuff[k_nextcheck] > 0 || player->kartstuff[k_nextcheck] > 0) && !player->exiting)
 				{
@@ -53,6 +53,18 @@ player_t *K_FindJawzTarget(mobj_t *actor, player_t *source);
 boolean K_CheckPlayersRespawnColliding(INT32 playernum, fixed_t x, fixed_t y);
 INT16 K_GetKartTurnValue(player_t *player, INT16 turnvalue);
 INT32 K_GetKartDriftSparkValue(player_t *player);
+
+// Checkpoint waypoints (MT_BOSS3WAYPOINT), sorted by starpost, then lap.
+// Where they are is read from mo, as Lua can move them.
+typedef struct
+{
+	INT32 starpost; // mo->health
+	INT32 lap; // mo->movecount: the lap it's for, as laps+1, or 0 for all of them
+	mobj_t *mo;
+} kartwaypoint_t;
+
+void K_IndexWaypoints(void);
+kartwaypoint_t *K_GetWaypoints(INT32 starpost, INT32 lap, size_t *count);
 void K_KartUpdatePosition(player_t *player);
 void K_DropItems(player_t *player);
 void K_DropRocketSneaker(player_t *player);
@@ -2903,6 +2903,38 @@ static int lib_kGetKartFlashing(lua_State *L)
 	return 1;
 }
 
+// K_GetWaypoints(starpost[, laps]): the checkpoint waypoints for a starpost,
+// only those used on that lap if laps (as in player.laps) is given
+static int lib_kGetWaypoints(lua_State *L)
+{
+	INT32 starpost = (INT32)luaL_checkinteger(L, 1);
+	INT32 laps[2] = {-1, -1};
+	kartwaypoint_t *wp;
+	size_t i, j, count;
+	int n = 0;
+	//HUDSAFE
+
+	if (!lua_isnoneornil(L, 2))
+	{
+		laps[0] = 0;
+		laps[1] = (INT32)luaL_checkinteger(L, 2) + 1;
+	}
+
+	lua_newtable(L);
+	for (i = 0; i < 2; i++)
+	{
+		if (i && laps[i] == laps[0])
+			break;
+		wp = K_GetWaypoints(starpost, laps[i], &count);
+		for (j = 0; j < count; j++, wp++)
+		{
+			LUA_PushUserdata(L, wp->mo, META_MOBJ);
+			lua_rawseti(L, -2, ++n);
+		}
+	}
+	return 1;
+}
+
 static int lib_kGetItemPatch(lua_State *L)
 {
 	UINT8 item = (UINT8)luaL_optinteger(L, 1, KITEM_NONE);
@@ -3184,6 +3216,7 @@ static luaL_Reg lib[] = {
 	{"K_GetKartSpeed",lib_kGetKartSpeed},
 	{"K_GetKartAccel",lib_kGetKartAccel},
 	{"K_GetKartFlashing",lib_kGetKartFlashing},
+	{"K_GetWaypoints",lib_kGetWaypoints},
 	{"K_GetItemPatch",lib_kGetItemPatch},
 	{"K_SetRaceCountdown",lib_kSetRaceCountdown},
 	{"K_SetExitCountdown",lib_kSetExitCountdown},
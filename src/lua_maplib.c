@@ -1360,6 +1360,7 @@ static int slope_set(lua_State *L)
 		P_CalculateSlopeNormal(slope);
 		break;
 	}
+	slope->dirty = true; // a dynamic slope gets its own values back next tic
 	return 0;
 }
 
@@ -1493,7 +1493,7 @@ void LUA_Archive(void)
 
 	if (gamestate == GS_LEVEL)
 	{
-		for (th = thinkercap.next; th != &thinkercap; th = th->next)
+		for (th = mobjcap.classnext; th != &mobjcap; th = th->classnext)
 			if (th->function.acp1 == (actionf_p1)P_MobjThinker)
 			{
 				// archive function will determine when to skip mobjs,
@@ -1514,7 +1514,7 @@ void LUA_UnArchive(void)
 {
 	UINT32 mobjnum;
 	INT32 i;
-	thinker_t *th;
+	mobj_t *mobj;
 
 	if (gL)
 		lua_newtable(gL); // tables to be read
@@ -1526,13 +1526,15 @@ void LUA_UnArchive(void)
 		UnArchiveExtVars(&players[i]);
 	}
 
-	do {
+	for (;;)
+	{
 		mobjnum = READUINT32(save_p); // read a mobjnum
-		for (th = thinkercap.next; th != &thinkercap; th = th->next)
-			if (th->function.acp1 == (actionf_p1)P_MobjThinker
-			&& ((mobj_t *)th)->mobjnum == mobjnum) // find matching mobj
-				UnArchiveExtVars(th); // apply variables
-	} while(mobjnum != UINT32_MAX); // repeat until end of mobjs marker.
+		if (mobjnum == UINT32_MAX)
+			break; // end of mobjs marker
+		mobj = P_FindNewPosition(mobjnum); // find matching mobj
+		if (mobj)
+			UnArchiveExtVars(mobj); // apply variables
+	}
 
 	LUAh_NetArchiveHook(NetUnArchive); // call the NetArchive hook in unarchive mode
 	UnArchiveTables();
@@ -51,14 +51,20 @@ static int iterationState_gc(lua_State *L)
 		lua_pushlightuserdata(L, (th)); \
 }
 
+// Mobjs are walked on their own list instead of every thinker
+#define iter_cap(it) ((it)->filter == (actionf_p1)P_MobjThinker ? &mobjcap : &thinkercap)
+#define iter_next(it, th) ((it)->filter == (actionf_p1)P_MobjThinker ? (th)->classnext : (th)->next)
+
 static int lib_iterateThinkers(lua_State *L)
 {
-	thinker_t *th = NULL, *next = NULL;
+	thinker_t *th = NULL, *next = NULL, *cap;
 	struct iterationState *it = luaL_checkudata(L, 1, META_ITERATIONSTATE);
 	lua_settop(L, 2);
 
+	cap = iter_cap(it);
+
 	if (lua_isnil(L, 2))
-		th = &thinkercap;
+		th = cap;
 	else if (lua_isuserdata(L, 2))
 	{
 		if (lua_islightuserdata(L, 2))
@@ -84,17 +90,17 @@ static int lib_iterateThinkers(lua_State *L)
 	it->next = LUA_REFNIL;
 
 	if (th && !next)
-		next = th->next;
+		next = iter_next(it, th);
 	if (!next)
 		return luaL_error(L, "next thinker invalidated during iteration");
 
-	for (; next != &thinkercap; next = next->next)
+	for (; next != cap; next = iter_next(it, next))
 		if (!it->filter || next->function.acp1 == it->filter)
 		{
 			push_thinker(next);
-			if (next->next != &thinkercap)
+			if (iter_next(it, next) != cap)
 			{
-				push_thinker(next->next);
+				push_thinker(iter_next(it, next));
 				it->next = luaL_ref(L, LUA_REGISTRYINDEX);
 			}
 			return 1;
@@ -117,6 +123,8 @@ static int lib_startIterate(lua_State *L)
 }
 
 #undef push_thinker
+#undef iter_cap
+#undef iter_next
 
 int LUA_ThinkerLib(lua_State *L)
 {
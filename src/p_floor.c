@@ -1975,7 +1975,7 @@ void T_ThwompSector(levelspecthink_t *thwomp)
 		if (!rover || (rover->flags & FF_EXISTS))
 		{
 			// scan the thinkers to find players!
-			for (th = thinkercap.next; th != &thinkercap; th = th->next)
+			for (th = mobjcap.classnext; th != &mobjcap; th = th->classnext)
 			{
 				if (th->function.acp1 != (actionf_p1)P_MobjThinker)
 					continue;
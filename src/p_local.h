@@ -66,6 +66,9 @@
 
 // both the head and tail of the thinker list
 extern thinker_t thinkercap;
+// heads of the mobj and precipitation lists, walked with classnext
+extern thinker_t mobjcap;
+extern thinker_t precipcap;
 
 void P_InitThinkers(void);
 void P_AddThinker(thinker_t *thinker);
@@ -31,6 +31,7 @@
 #include "p_polyobj.h"
 #include "lua_script.h"
 #include "p_slopes.h"
+#include "k_kart.h" // K_IndexWaypoints
 
 savedata_t savedata;
 UINT8 *save_p;
@@ -43,6 +44,7 @@ UINT8 *save_p;
 #define ARCHIVEBLOCK_POBJS    0x7F928546
 #define ARCHIVEBLOCK_THINKERS 0x7F37037C
 #define ARCHIVEBLOCK_SPECIALS 0x7F228378
+#define ARCHIVEBLOCK_BASELINE 0x7F8A5E11
 
 // Note: This cannot be bigger
 // than an UINT16
@@ -988,9 +990,14 @@ typedef enum
 	tc_polyswingdoor,
 	tc_polyflag,
 	tc_polydisplace,
-	tc_end
+	tc_end,
+	// Only in snapshots saved with savebaselines
+	tc_baseline, // a run of level baseline thinkers that haven't changed
+	tc_baselinedigest // checksum of what those runs refer to
 } specials_e;
 
+static boolean savingbaseline; // leave out what only means something to this process
+
 static inline UINT32 SaveMobjnum(const mobj_t *mobj)
 {
 	if (mobj) return mobj->mobjnum;
@@ -1155,7 +1162,7 @@ static void SaveMobjThinker(const thinker_t *th, const UINT8 type)
 		WRITEUINT16(save_p, diff2);
 
 	// save pointer, at load time we will search this pointer to reinitilize pointers
-	WRITEUINT32(save_p, (size_t)mobj);
+	WRITEUINT32(save_p, savingbaseline ? 0 : (size_t)mobj);
 
 	WRITEFIXED(save_p, mobj->z); // Force this so 3dfloor problems don't arise.
 	WRITEFIXED(save_p, mobj->floorz);
@@ -1163,11 +1170,7 @@ static void SaveMobjThinker(const thinker_t *th, const UINT8 type)
 
 	if (diff & MD_SPAWNPOINT)
 	{
-		size_t z;
-
-		for (z = 0; z < nummapthings; z++)
-			if (&mapthings[z] == mobj->spawnpoint)
-				WRITEUINT16(save_p, z);
+		WRITEUINT16(save_p, mobj->spawnpoint - mapthings);
 		if (mobj->type == MT_HOOPCENTER)
 			return;
 	}
@@ -1262,7 +1265,7 @@ static void SaveMobjThinker(const thinker_t *th, const UINT8 type)
 	if (diff2 & MD2_COLORIZED)
 		WRITEUINT8(save_p, mobj->colorized);
 
-	WRITEUINT32(save_p, mobj->mobjnum);
+	WRITEUINT32(save_p, savingbaseline ? 0 : mobj->mobjnum);
 }
 
 //
@@ -1664,6 +1667,270 @@ static inline void SaveWhatThinker(const thinker_t *th, const UINT8 type)
 }
 */
 
+//
+// Level baseline
+//
+// Right after a level's things and specials are spawned, the thinkers that
+// don't point to other mobjs are saved into a baseline, in thinker order.
+// A client loading a join snapshot spawns the same level from the same seed,
+// so the snapshot can just name the baseline thinkers that haven't changed
+// since instead of saving them in full. The client keeps its own copies of
+// those, and checks with a digest that they really match the server's.
+//
+
+#define BASELINEMAXSIZE 512 // more than any one baseline thinker saves as
+
+typedef struct
+{
+	thinker_t *thinker;
+	actionf_p1 function; // to notice it being removed before the snapshot is loaded
+	size_t offset, length; // in baselinedata
+	boolean claimed; // taken by the snapshot being loaded
+} baselinethinker_t;
+
+static baselinethinker_t *baselinethinkers;
+static baselinethinker_t **baselinesorted; // by thinker address
+static UINT32 numbaselinethinkers;
+static UINT8 *baselinedata;
+static UINT8 baselinescratch[BASELINEMAXSIZE*2];
+
+static UINT32 baselineseed; // random seed the level's things were spawned from
+boolean savebaselines;
+static boolean loadbaselines; // the snapshot being loaded has a baseline block
+boolean baselinemismatch;
+
+static UINT32 P_BaselineDigest(UINT32 digest, const UINT8 *p, size_t length)
+{
+	// FNV-1a
+	while (length--)
+		digest = (digest ^ *p++) * 16777619u;
+	return digest;
+}
+
+static boolean P_IsBaselineThinker(const thinker_t *th)
+{
+	if (th->function.acp1 == (actionf_p1)P_MobjThinker)
+	{
+		const mobj_t *mobj = (const mobj_t *)th;
+
+		// Anything pointing to other mobjs has to be relinked on load
+		if (mobj->type == MT_HOOP || mobj->type == MT_HOOPCOLLIDE || mobj->type == MT_HOOPCENTER)
+			return false;
+		// The head of the waypoint list has to be put back as waypointcap
+		// (a lone waypoint has no tracer)
+		if (mobj == waypointcap)
+			return false;
+		return !(mobj->player || mobj->target || mobj->tracer || mobj->hnext || mobj->hprev);
+	}
+
+	return (th->function.acp1 == (actionf_p1)T_Scroll
+		|| th->function.acp1 == (actionf_p1)T_Friction
+		|| th->function.acp1 == (actionf_p1)T_Pusher);
+}
+
+// Saves a thinker the way P_NetArchiveThinkers would, minus addresses and
+// mobjnums, into a buffer. Returns its length.
+static size_t P_SaveBaselineState(const thinker_t *th, UINT8 *buf)
+{
+	UINT8 *oldsave_p = save_p;
+	size_t length;
+
+	save_p = buf;
+	savingbaseline = true;
+
+	if (th->function.acp1 == (actionf_p1)P_MobjThinker)
+		SaveMobjThinker(th, tc_mobj);
+	else if (th->function.acp1 == (actionf_p1)T_Scroll)
+		SaveScrollThinker(th, tc_scroll);
+	else if (th->function.acp1 == (actionf_p1)T_Friction)
+		SaveFrictionThinker(th, tc_friction);
+	else if (th->function.acp1 == (actionf_p1)T_Pusher)
+		SavePusherThinker(th, tc_pusher);
+
+	savingbaseline = false;
+	length = save_p - buf;
+	save_p = oldsave_p;
+
+	if (length > BASELINEMAXSIZE)
+		I_Error("P_SaveBaselineState: thinker too large (%s bytes)", sizeu1(length));
+	return length;
+}
+
+static int P_CompareBaselines(const void *a, const void *b)
+{
+	const thinker_t *ta = (*(baselinethinker_t *const *)a)->thinker;
+	const thinker_t *tb = (*(baselinethinker_t *const *)b)->thinker;
+	return (ta > tb) - (ta < tb);
+}
+
+/** Sets the random seed the level's things are spawned from. Called by
+  * P_SetupLevel right before it spawns them.
+  *
+  * \param fromnetsave The level is being loaded from a snapshot
+  */
+void P_SeedLevelBaseline(boolean fromnetsave)
+{
+	if (!fromnetsave)
+		baselineseed = P_GetRandSeed();
+	else if (loadbaselines)
+		P_SetRandSeed(baselineseed);
+}
+
+/** Saves the level baseline. Called by P_SetupLevel once the level's things
+  * and specials are spawned.
+  */
+void P_MarkLevelBaseline(void)
+{
+	thinker_t *th;
+	size_t used = 0, size = 0;
+	UINT32 i = 0;
+
+	// These are PU_LEVEL, so the last level's went with it
+	numbaselinethinkers = 0;
+	for (th = thinkercap.next; th != &thinkercap; th = th->next)
+		if (P_IsBaselineThinker(th))
+			numbaselinethinkers++;
+
+	if (!numbaselinethinkers)
+		return;
+
+	baselinethinkers = Z_Malloc(numbaselinethinkers * sizeof (*baselinethinkers), PU_LEVEL, &baselinethinkers);
+	baselinesorted = Z_Malloc(numbaselinethinkers * sizeof (*baselinesorted), PU_LEVEL, &baselinesorted);
+
+	for (th = thinkercap.next; th != &thinkercap; th = th->next)
+	{
+		baselinethinker_t *base;
+		size_t length;
+
+		if (!P_IsBaselineThinker(th))
+			continue;
+
+		length = P_SaveBaselineState(th, baselinescratch);
+		if (used + length > size)
+		{
+			size = max(size * 2, used + length + 64*1024);
+			baselinedata = Z_Realloc(baselinedata, size, PU_LEVEL, &baselinedata);
+		}
+		M_Memcpy(baselinedata + used, baselinescratch, length);
+
+		base = &baselinethinkers[i];
+		base->thinker = th;
+		base->function = th->function.acp1;
+		base->offset = used;
+		base->length = length;
+		base->claimed = false;
+		baselinesorted[i] = base;
+
+		used += length;
+		i++;
+	}
+
+	qsort(baselinesorted, numbaselinethinkers, sizeof (*baselinesorted), P_CompareBaselines);
+
+	CONS_Debug(DBG_SETUP, "Level baseline: %u thinkers, %s bytes\n", numbaselinethinkers, sizeu1(used));
+}
+
+static baselinethinker_t *P_FindBaseline(const thinker_t *th)
+{
+	size_t lo = 0, hi = numbaselinethinkers;
+
+	if (!baselinesorted)
+		return NULL;
+
+	while (lo < hi)
+	{
+		const size_t mid = lo + (hi - lo)/2;
+		if (baselinesorted[mid]->thinker == th)
+			return baselinesorted[mid];
+		if (baselinesorted[mid]->thinker < th)
+			lo = mid + 1;
+		else
+			hi = mid;
+	}
+	return NULL;
+}
+
+// Runs of unchanged baseline thinkers waiting to be written
+static UINT32 baselinerunstart, baselinerunlength;
+static UINT32 baselinedigest, numsavedbaselines;
+
+static void P_FlushBaselineRun(void)
+{
+	if (!baselinerunlength)
+		return;
+
+	WRITEUINT8(save_p, tc_baseline);
+	WRITEUINT32(save_p, baselinerunstart);
+	WRITEUINT16(save_p, baselinerunlength);
+	baselinerunlength = 0;
+}
+
+/** Writes a thinker as a reference to the level baseline, if it hasn't
+  * changed since.
+  *
+  * \param th The thinker to save
+  * \return True if it was written
+  */
+static boolean P_SaveBaselineRef(const thinker_t *th)
+{
+	const baselinethinker_t *base = P_FindBaseline(th);
+	UINT32 ordinal;
+
+	if (!base || base->function != th->function.acp1)
+		return false;
+
+	if (P_SaveBaselineState(th, baselinescratch) != base->length
+		|| memcmp(baselinescratch, baselinedata + base->offset, base->length))
+		return false;
+
+	ordinal = (UINT32)(base - baselinethinkers);
+	if (baselinerunlength && (ordinal != baselinerunstart + baselinerunlength || baselinerunlength == UINT16_MAX))
+		P_FlushBaselineRun();
+	if (!baselinerunlength)
+		baselinerunstart = ordinal;
+	baselinerunlength++;
+
+	baselinedigest = P_BaselineDigest(baselinedigest, baselinescratch, base->length);
+	numsavedbaselines++;
+	return true;
+}
+
+static UINT32 lastmobjnum; // of the last mobj loaded; baseline mobjs come next
+
+/** Reads a tc_baseline run, putting this process's own copies of those
+  * thinkers back in the thinker list.
+  */
+static void P_LoadBaselineRun(void)
+{
+	UINT32 ordinal = READUINT32(save_p);
+	UINT16 length = READUINT16(save_p);
+
+	for (; length; length--, ordinal++)
+	{
+		baselinethinker_t *base;
+		thinker_t *th;
+
+		if (ordinal >= numbaselinethinkers || baselinethinkers[ordinal].claimed
+			|| baselinethinkers[ordinal].thinker->function.acp1 != baselinethinkers[ordinal].function)
+		{
+			// Can't be rebuilt; read on, the load fails once it's done
+			baselinemismatch = true;
+			continue;
+		}
+
+		base = &baselinethinkers[ordinal];
+		th = base->thinker;
+		base->claimed = true;
+
+		baselinedigest = P_BaselineDigest(baselinedigest, baselinescratch, P_SaveBaselineState(th, baselinescratch));
+
+		P_AddThinker(th);
+		if (th->function.acp1 == (actionf_p1)P_MobjThinker)
+			((mobj_t *)th)->mobjnum = ++lastmobjnum;
+		numsavedbaselines++;
+	}
+}
+
 //
 // P_NetArchiveThinkers
 //
@@ -1675,6 +1942,9 @@ static void P_NetArchiveThinkers(void)
 
 	WRITEUINT32(save_p, ARCHIVEBLOCK_THINKERS);
 
+	baselinerunlength = numsavedbaselines = 0;
+	baselinedigest = 2166136261u;
+
 	// save off the current thinkers
 	for (th = thinkercap.next; th != &thinkercap; th = th->next)
 	{
@@ -1682,6 +1952,15 @@ static void P_NetArchiveThinkers(void)
 		 || th->function.acp1 == (actionf_p1)P_NullPrecipThinker))
 			numsaved++;
 
+		if (savebaselines)
+		{
+			if (P_SaveBaselineRef(th))
+				continue;
+			if (th->function.acp1 != (actionf_p1)P_RemoveThinkerDelayed
+			 && th->function.acp1 != (actionf_p1)P_NullPrecipThinker)
+				P_FlushBaselineRun(); // something else comes next in the thinker list
+		}
+
 		if (th->function.acp1 == (actionf_p1)P_MobjThinker)
 		{
 			SaveMobjThinker(th, tc_mobj);
@@ -1871,11 +2150,54 @@ static void P_NetArchiveThinkers(void)
 #endif
 	}
 
-	CONS_Debug(DBG_NETPLAY, "%u thinkers saved\n", numsaved);
+	P_FlushBaselineRun();
+	if (savebaselines)
+	{
+		WRITEUINT8(save_p, tc_baselinedigest);
+		WRITEUINT32(save_p, baselinedigest);
+	}
+
+	CONS_Debug(DBG_NETPLAY, "%u thinkers saved, %u from the level baseline\n", numsaved, numsavedbaselines);
 
 	WRITEUINT8(save_p, tc_end);
 }
 
+// Loaded mobjs by mobjnum, so relinking doesn't search the thinker list
+// for every pointer. Only there while a snapshot is being loaded.
+static mobj_t **mobjnumtable = NULL;
+static UINT32 mobjnumtablesize = 0;
+
+//
+// P_IndexMobjnums
+//
+// Fills mobjnumtable from the loaded mobjs. Saved mobjnums run from 1 to
+// the number of mobjs; anything past that (hoops keep stale numbers) is
+// left to the thinker list search. The first mobj in thinker order wins,
+// same as that search.
+//
+static void P_IndexMobjnums(void)
+{
+	thinker_t *th;
+	mobj_t *mobj;
+
+	mobjnumtablesize = 1;
+	for (th = mobjcap.classnext; th != &mobjcap; th = th->classnext)
+		if (th->function.acp1 == (actionf_p1)P_MobjThinker)
+			mobjnumtablesize++;
+
+	mobjnumtable = Z_Calloc(mobjnumtablesize * sizeof (*mobjnumtable), PU_LEVEL, &mobjnumtable);
+
+	for (th = mobjcap.classnext; th != &mobjcap; th = th->classnext)
+	{
+		if (th->function.acp1 != (actionf_p1)P_MobjThinker)
+			continue;
+
+		mobj = (mobj_t *)th;
+		if (mobj->mobjnum < mobjnumtablesize && !mobjnumtable[mobj->mobjnum])
+			mobjnumtable[mobj->mobjnum] = mobj;
+	}
+}
+
 // Now save the pointers, tracer and target, but at load time we must
 // relink to this; the savegame contains the old position in the pointer
 // field copyed in the info field temporarily, but finally we just search
@@ -1885,7 +2207,20 @@ mobj_t *P_FindNewPosition(UINT32 oldposition)
 	thinker_t *th;
 	mobj_t *mobj;
 
-	for (th = thinkercap.next; th != &thinkercap; th = th->next)
+	if (mobjnumtable && oldposition < mobjnumtablesize)
+	{
+		mobj = mobjnumtable[oldposition];
+		if (!mobj)
+		{
+			CONS_Debug(DBG_GAMELOGIC, "mobj not found\n");
+			return NULL;
+		}
+		if (mobj->thinker.function.acp1 == (actionf_p1)P_MobjThinker)
+			return mobj;
+		// Removed since (by a Lua hook?), see if another mobj has the number
+	}
+
+	for (th = mobjcap.classnext; th != &mobjcap; th = th->classnext)
 	{
 		if (th->function.acp1 != (actionf_p1)P_MobjThinker)
 			continue;
@@ -2147,7 +2482,7 @@ static void LoadMobjThinker(actionf_p1 thinker)
 	// set sprev, snext, bprev, bnext, subsector
 	P_SetThingPosition(mobj);
 
-	mobj->mobjnum = READUINT32(save_p);
+	mobj->mobjnum = lastmobjnum = READUINT32(save_p);
 
 	if (mobj->player)
 	{
@@ -2649,13 +2984,16 @@ static void P_NetUnArchiveThinkers(void)
 	if (READUINT32(save_p) != ARCHIVEBLOCK_THINKERS)
 		I_Error("Bad $$$.sav at archive block Thinkers");
 
-	// remove all the current thinkers
+	// remove all the current thinkers,
+	// except the level baseline ones the snapshot may bring back
 	currentthinker = thinkercap.next;
 	for (currentthinker = thinkercap.next; currentthinker != &thinkercap; currentthinker = next)
 	{
 		next = currentthinker->next;
 
-		if (currentthinker->function.acp1 == (actionf_p1)P_MobjThinker)
+		if (loadbaselines && P_FindBaseline(currentthinker))
+			continue;
+		else if (currentthinker->function.acp1 == (actionf_p1)P_MobjThinker)
 			P_RemoveSavegameMobj((mobj_t *)currentthinker); // item isn't saved, don't remove it
 		else
 			Z_Free(currentthinker);
@@ -2671,6 +3009,9 @@ static void P_NetUnArchiveThinkers(void)
 		sectors[i].floordata = sectors[i].ceilingdata = sectors[i].lightingdata = NULL;
 	}
 
+	lastmobjnum = numsavedbaselines = 0;
+	baselinedigest = 2166136261u;
+
 	// read in saved thinkers
 	for (;;)
 	{
@@ -2827,12 +3168,43 @@ static void P_NetUnArchiveThinkers(void)
 				LoadPusherThinker((actionf_p1)T_Pusher);
 				break;
 
+			case tc_baseline:
+				if (!loadbaselines)
+					I_Error("P_NetUnArchiveThinkers: Level baseline thinkers in a savegame without one");
+				numloaded--; // counted in the run
+				P_LoadBaselineRun();
+				break;
+
+			case tc_baselinedigest:
+				numloaded--;
+				if (READUINT32(save_p) != baselinedigest)
+					baselinemismatch = true;
+				break;
+
 			default:
 				I_Error("P_UnarchiveSpecials: Unknown tclass %d in savegame", tclass);
 		}
 	}
 
-	CONS_Debug(DBG_NETPLAY, "%u thinkers loaded\n", numloaded);
+	// the baseline thinkers the snapshot didn't bring back are gone
+	if (loadbaselines)
+	{
+		for (i = 0; i < numbaselinethinkers; i++)
+		{
+			baselinethinker_t *base = &baselinethinkers[i];
+
+			if (base->claimed)
+				continue;
+			if (base->thinker->function.acp1 == (actionf_p1)P_MobjThinker)
+				P_RemoveSavegameMobj((mobj_t *)base->thinker);
+			else
+				Z_Free(base->thinker);
+		}
+	}
+
+	CONS_Debug(DBG_NETPLAY, "%u thinkers loaded, %u from the level baseline\n", numloaded + numsavedbaselines, numsavedbaselines);
+
+	P_IndexMobjnums();
 
 	if (restoreNum)
 	{
@@ -2952,8 +3324,8 @@ static inline void P_FinishMobjs(void)
 	mobj_t *mobj;
 
 	// put info field there real value
-	for (currentthinker = thinkercap.next; currentthinker != &thinkercap;
-		currentthinker = currentthinker->next)
+	for (currentthinker = mobjcap.classnext; currentthinker != &mobjcap;
+		currentthinker = currentthinker->classnext)
 	{
 		if (currentthinker->function.acp1 == (actionf_p1)P_MobjThinker)
 		{
@@ -2970,8 +3342,8 @@ static void P_RelinkPointers(void)
 	UINT32 temp;
 
 	// use info field (value = oldposition) to relink mobjs
-	for (currentthinker = thinkercap.next; currentthinker != &thinkercap;
-		currentthinker = currentthinker->next)
+	for (currentthinker = mobjcap.classnext; currentthinker != &mobjcap;
+		currentthinker = currentthinker->classnext)
 	{
 		if (currentthinker->function.acp1 == (actionf_p1)P_MobjThinker)
 		{
@@ -3280,7 +3652,7 @@ static void P_NetArchiveMisc(void)
 
 static inline boolean P_NetUnArchiveMisc(void)
 {
-	UINT32 pig;
+	UINT32 pig, seed;
 	INT32 i;
 
 	if (READUINT32(save_p) != ARCHIVEBLOCK_MISC)
@@ -3306,7 +3678,8 @@ static inline boolean P_NetUnArchiveMisc(void)
 		// playerstate is set in unarchiveplayers
 	}
 
-	P_SetRandSeed(READUINT32(save_p));
+	seed = READUINT32(save_p);
+	P_SetRandSeed(seed);
 
 	tokenlist = READUINT32(save_p);
 
@@ -3315,6 +3688,9 @@ static inline boolean P_NetUnArchiveMisc(void)
 	if (!P_SetupLevel(true))
 		return false;
 
+	// P_SetupLevel may have spawned the level from the baseline seed
+	P_SetRandSeed(seed);
+
 	// get the time
 	leveltime = READUINT32(save_p);
 	totalrings = READUINT32(save_p);
@@ -3402,12 +3778,19 @@ void P_SaveNetGame(void)
 	INT32 i = 1; // don't start from 0, it'd be confused with a blank pointer otherwise
 
 	CV_SaveNetVars(&save_p, false);
+	if (savebaselines && gamestate == GS_LEVEL)
+	{
+		WRITEUINT32(save_p, ARCHIVEBLOCK_BASELINE);
+		WRITEUINT32(save_p, baselineseed);
+	}
+	else
+		savebaselines = false;
 	P_NetArchiveMisc();
 
 	// Assign the mobjnumber for pointer tracking
 	if (gamestate == GS_LEVEL)
 	{
-		for (th = thinkercap.next; th != &thinkercap; th = th->next)
+		for (th = mobjcap.classnext; th != &mobjcap; th = th->classnext)
 		{
 			if (th->function.acp1 == (actionf_p1)P_MobjThinker)
 			{
@@ -3459,6 +3842,14 @@ boolean P_LoadGame(INT16 mapoverride)
 boolean P_LoadNetGame(void)
 {
 	CV_LoadNetVars(&save_p);
+
+	baselinemismatch = false;
+	loadbaselines = (READUINT32(save_p) == ARCHIVEBLOCK_BASELINE);
+	if (loadbaselines)
+		baselineseed = READUINT32(save_p);
+	else
+		save_p -= sizeof (UINT32);
+
 	if (!P_NetUnArchiveMisc())
 		return false;
 	P_NetUnArchivePlayers();
@@ -3470,11 +3861,15 @@ boolean P_LoadNetGame(void)
 		P_NetUnArchiveSpecials();
 		P_RelinkPointers();
 		P_FinishMobjs();
+		K_IndexWaypoints();
 	}
 #ifdef HAVE_BLUA
 	LUA_UnArchive();
 #endif
 
+	// Everything's relinked, new mobjs won't be in the table
+	Z_Free(mobjnumtable);
+
 	// This is stupid and hacky, but maybe it'll work!
 	P_SetRandSeed(P_GetInitSeed());
 
@@ -3484,5 +3879,11 @@ boolean P_LoadNetGame(void)
 	// precipitation when loading a netgame save. Instead, precip has to be spawned here.
 	// This is done in P_NetUnArchiveSpecials now.
 
+	if (baselinemismatch)
+	{
+		CONS_Alert(CONS_ERROR, M_GetText("The snapshot's level baseline doesn't match this one\n"));
+		return false;
+	}
+
 	return READUINT8(save_p) == 0x1d;
 }
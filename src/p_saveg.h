@@ -28,6 +28,11 @@ boolean P_LoadNetGame(void);
 
 mobj_t *P_FindNewPosition(UINT32 oldposition);
 
+void P_SeedLevelBaseline(boolean fromnetsave);
+void P_MarkLevelBaseline(void);
+extern boolean savebaselines; // P_SaveNetGame: refer to unchanged level baseline thinkers
+extern boolean baselinemismatch; // P_LoadNetGame: couldn't rebuild the baseline thinkers
+
 typedef struct
 {
 	UINT8 skincolor;
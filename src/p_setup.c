@@ -827,7 +827,7 @@ void P_ReloadRings(void)
 	mapthing_t *mt = mapthings;
 
 	// scan the thinkers to find rings/wings/hoops to unset
-	for (th = thinkercap.next; th != &thinkercap; th = th->next)
+	for (th = mobjcap.classnext; th != &mobjcap; th = th->classnext)
 	{
 		if (th->function.acp1 != (actionf_p1)P_MobjThinker)
 			continue;
@@ -1017,6 +1017,8 @@ static void P_LoadThings(void)
 		P_SpawnMapThing(mt);
 	}
 
+	K_IndexWaypoints();
+
 	// random emeralds for hunt
 	if (numhuntemeralds)
 	{
@@ -2437,7 +2439,7 @@ void P_LoadThingsOnly(void)
 	mobj_t *mo;
 	thinker_t *think;
 
-	for (think = thinkercap.next; think != &thinkercap; think = think->next)
+	for (think = mobjcap.classnext; think != &mobjcap; think = think->classnext)
 	{
 		if (think->function.acp1 != (actionf_p1)P_MobjThinker)
 			continue; // not a mobj thinker
@@ -3106,6 +3108,7 @@ boolean P_SetupLevel(boolean skipprecip)
 
 	P_ResetDynamicSlopes();
 
+	P_SeedLevelBaseline(fromnetsave);
 	P_LoadThings();
 
 	P_SpawnSecretItems(loademblems);
@@ -3116,6 +3119,7 @@ boolean P_SetupLevel(boolean skipprecip)
 
 	// set up world state
 	P_SpawnSpecials(fromnetsave);
+	P_MarkLevelBaseline();
 
 	if (loadprecip) //  ugly hack for P_NetUnArchiveMisc (and P_LoadNetGame)
 		P_SpawnPrecipitation();
@@ -27,6 +27,15 @@
 static pslope_t *slopelist = NULL;
 static UINT16 slopecount = 0;
 
+// Dynamic slope recalculations, for slopestats
+static UINT32 slopecalcs = 0; // last tic
+static struct
+{
+	UINT64 total;
+	UINT32 tics;
+	UINT32 worst;
+} slopestats;
+
 // Calculate line normal
 void P_CalculateSlopeNormal(pslope_t *slope) {
 	slope->normal.z = FINECOSINE(slope->zangle>>ANGLETOFINESHIFT);
@@ -93,50 +102,57 @@ static void P_ReconfigureVertexSlope(pslope_t *slope)
 	}
 }
 
-// Recalculate dynamic slopes
+// Recalculate the dynamic slopes whose reference heights have moved
 void P_RunDynamicSlopes(void) {
 	pslope_t *slope;
 
+	slopecalcs = 0;
+
 	for (slope = slopelist; slope; slope = slope->next) {
 		fixed_t zdelta;
+		fixed_t heights[2]; // own side, other side
 
 		if (slope->flags & SL_NODYNAMIC)
 			continue;
 
 		switch(slope->refpos) {
 		case 1: // front floor
-			zdelta = slope->sourceline->backsector->floorheight - slope->sourceline->frontsector->floorheight;
-			slope->o.z = slope->sourceline->frontsector->floorheight;
+			heights[0] = slope->sourceline->frontsector->floorheight;
+			heights[1] = slope->sourceline->backsector->floorheight;
 			break;
 		case 2: // front ceiling
-			zdelta = slope->sourceline->backsector->ceilingheight - slope->sourceline->frontsector->ceilingheight;
-			slope->o.z = slope->sourceline->frontsector->ceilingheight;
+			heights[0] = slope->sourceline->frontsector->ceilingheight;
+			heights[1] = slope->sourceline->backsector->ceilingheight;
 			break;
 		case 3: // back floor
-			zdelta = slope->sourceline->frontsector->floorheight - slope->sourceline->backsector->floorheight;
-			slope->o.z = slope->sourceline->backsector->floorheight;
+			heights[0] = slope->sourceline->backsector->floorheight;
+			heights[1] = slope->sourceline->frontsector->floorheight;
 			break;
 		case 4: // back ceiling
-			zdelta = slope->sourceline->frontsector->ceilingheight - slope->sourceline->backsector->ceilingheight;
-			slope->o.z = slope->sourceline->backsector->ceilingheight;
+			heights[0] = slope->sourceline->backsector->ceilingheight;
+			heights[1] = slope->sourceline->frontsector->ceilingheight;
 			break;
 		case 5: // vertices
 			{
 				mapthing_t *mt;
 				size_t i;
-				INT32 l;
-				line_t *line;
+				boolean moved = slope->dirty;
 
 				for (i = 0; i < 3; i++) {
 					mt = slope->vertices[i];
-					l = P_FindSpecialLineFromTag(799, mt->angle, -1);
-					if (l != -1) {
-						line = &lines[l];
-						mt->z = line->frontsector->floorheight >> FRACBITS;
+					if (slope->vertexsectors[i])
+						mt->z = slope->vertexsectors[i]->floorheight >> FRACBITS;
+					if (mt->z != slope->refheights[i]) {
+						slope->refheights[i] = mt->z;
+						moved = true;
 					}
 				}
 
-				P_ReconfigureVertexSlope(slope);
+				if (moved) {
+					P_ReconfigureVertexSlope(slope);
+					slope->dirty = false;
+					slopecalcs++;
+				}
 			}
 			continue; // TODO
 
@@ -144,12 +160,86 @@ void P_RunDynamicSlopes(void) {
 			I_Error("P_RunDynamicSlopes: slope has invalid type!");
 		}
 
+		if (!slope->dirty && heights[0] == slope->refheights[0] && heights[1] == slope->refheights[1])
+			continue; // Neither side has moved
+
+		slope->refheights[0] = heights[0];
+		slope->refheights[1] = heights[1];
+		slope->dirty = false;
+		slopecalcs++;
+
+		zdelta = heights[1] - heights[0];
+		slope->o.z = heights[0];
+
 		if (slope->zdelta != FixedDiv(zdelta, slope->extent)) {
 			slope->zdelta = FixedDiv(zdelta, slope->extent);
 			slope->zangle = R_PointToAngle2(0, 0, slope->extent, -zdelta);
 			P_CalculateSlopeNormal(slope);
 		}
 	}
+
+	slopestats.tics++;
+	slopestats.total += slopecalcs;
+	if (slopecalcs > slopestats.worst)
+		slopestats.worst = slopecalcs;
+}
+
+//
+// P_FindSlopeControlSectors
+//
+// Looks up the control sectors (linedef type 799) moving the vertices of
+// dynamic vertex slopes, so P_RunDynamicSlopes doesn't search for them
+// every tic. Needs the tag lists, so is called from P_SpawnSpecials.
+//
+void P_FindSlopeControlSectors(void)
+{
+	pslope_t *slope;
+	size_t i;
+	INT32 l;
+
+	for (slope = slopelist; slope; slope = slope->next)
+	{
+		if (slope->refpos != 5 || (slope->flags & SL_NODYNAMIC))
+			continue;
+
+		for (i = 0; i < 3; i++)
+		{
+			l = P_FindSpecialLineFromTag(799, slope->vertices[i]->angle, -1);
+			slope->vertexsectors[i] = (l != -1) ? lines[l].frontsector : NULL;
+		}
+
+		slope->dirty = true;
+	}
+}
+
+//
+// Command_SlopeStats_f
+//
+// Shows how many dynamic slopes have had to be recalculated.
+//
+void Command_SlopeStats_f(void)
+{
+	pslope_t *slope;
+	UINT32 dynamic = 0;
+
+	if (COM_Argc() > 1 && !stricmp(COM_Argv(1), "reset"))
+	{
+		memset(&slopestats, 0, sizeof (slopestats));
+		CONS_Printf(M_GetText("Slope measurements reset.\n"));
+		return;
+	}
+
+	for (slope = slopelist; slope; slope = slope->next)
+		if (!(slope->flags & SL_NODYNAMIC))
+			dynamic++;
+
+	CONS_Printf(M_GetText("%u of %u slopes are dynamic\n"), dynamic, slopecount);
+	CONS_Printf(M_GetText("Recalculated %u last tic, worst %u in a tic\n"), slopecalcs, slopestats.worst);
+	if (slopestats.tics)
+		CONS_Printf(M_GetText("%s recalculations over %u tics, %u.%02u per tic\n"),
+			sizeu1((size_t)slopestats.total), slopestats.tics,
+			(UINT32)(slopestats.total / slopestats.tics),
+			(UINT32)(slopestats.total * 100 / slopestats.tics % 100));
 }
 
 //
@@ -173,6 +263,7 @@ static pslope_t *P_MakeSlope(const vector3_t *o, const vector2_t *d,
 	ret->zdelta = zdelta;
 
 	ret->flags = flags;
+	ret->dirty = true;
 
 	// Add to the slope list
 	ret->next = slopelist;
@@ -563,6 +654,7 @@ static pslope_t *P_NewVertexSlope(INT16 tag1, INT16 tag2, INT16 tag3, UINT8 flag
 
 	P_ReconfigureVertexSlope(ret);
 	ret->refpos = 5;
+	ret->dirty = true;
 
 	// Add to the slope list
 	ret->next = slopelist;
@@ -16,6 +16,8 @@
 void P_CalculateSlopeNormal(pslope_t *slope);
 void P_ResetDynamicSlopes(void);
 void P_RunDynamicSlopes(void);
+void P_FindSlopeControlSectors(void);
+void Command_SlopeStats_f(void);
 // P_SpawnSlope_Line
 // Creates one or more slopes based on the given line type and front/back
 // sectors.
@@ -40,6 +40,11 @@ tic_t leveltime;
 // Both the head and tail of the thinker list.
 thinker_t thinkercap;
 
+// Heads of the mobj and precipitation lists, linked through classnext.
+// Thinkers stay in thinkercap too, which alone decides running order.
+thinker_t mobjcap;
+thinker_t precipcap;
+
 void Command_Numthinkers_f(void)
 {
 	INT32 num;
@@ -117,6 +122,7 @@ void Command_Numthinkers_f(void)
 
 void Command_CountMobjs_f(void)
 {
+	static INT32 counts[NUMMOBJTYPES];
 	thinker_t *th;
 	mobjtype_t i;
 	INT32 count;
@@ -141,7 +147,7 @@ void Command_CountMobjs_f(void)
 
 			count = 0;
 
-			for (th = thinkercap.next; th != &thinkercap; th = th->next)
+			for (th = mobjcap.classnext; th != &mobjcap; th = th->classnext)
 			{
 				if (th->function.acp1 != (actionf_p1)P_MobjThinker)
 					continue;
@@ -157,21 +163,21 @@ void Command_CountMobjs_f(void)
 
 	CONS_Printf(M_GetText("Count of active objects in level:\n"));
 
-	for (i = 0; i < NUMMOBJTYPES; i++)
-	{
-		count = 0;
+	// One pass over the mobjs rather than one per type
+	memset(counts, 0, sizeof (counts));
 
-		for (th = thinkercap.next; th != &thinkercap; th = th->next)
-		{
-			if (th->function.acp1 != (actionf_p1)P_MobjThinker)
-				continue;
+	for (th = mobjcap.classnext; th != &mobjcap; th = th->classnext)
+	{
+		if (th->function.acp1 != (actionf_p1)P_MobjThinker)
+			continue;
 
-			if (((mobj_t *)th)->type == i)
-				count++;
-		}
+		counts[((mobj_t *)th)->type]++;
+	}
 
-		if (count > 0) // Don't bother displaying if there are none of this type!
-			CONS_Printf(" * %d: %d\n", i, count);
+	for (i = 0; i < NUMMOBJTYPES; i++)
+	{
+		if (counts[i] > 0) // Don't bother displaying if there are none of this type!
+			CONS_Printf(" * %d: %d\n", i, counts[i]);
 	}
 }
 
@@ -181,6 +187,8 @@ void Command_CountMobjs_f(void)
 void P_InitThinkers(void)
 {
 	thinkercap.prev = thinkercap.next = &thinkercap;
+	mobjcap.classprev = mobjcap.classnext = &mobjcap;
+	precipcap.classprev = precipcap.classnext = &precipcap;
 	waypointcap = NULL;
 }
 
@@ -190,11 +198,31 @@ void P_InitThinkers(void)
 //
 void P_AddThinker(thinker_t *thinker)
 {
+	thinker_t *cap = NULL;
+
 	thinkercap.prev->next = thinker;
 	thinker->next = &thinkercap;
 	thinker->prev = thinkercap.prev;
 	thinkercap.prev = thinker;
 
+	// Mobjs and precipitation also go on their own list
+	if (thinker->function.acp1 == (actionf_p1)P_MobjThinker)
+		cap = &mobjcap;
+	else if (thinker->function.acp1 == (actionf_p1)P_NullPrecipThinker
+		|| thinker->function.acp1 == (actionf_p1)P_RainThinker
+		|| thinker->function.acp1 == (actionf_p1)P_SnowThinker)
+		cap = &precipcap;
+
+	if (cap)
+	{
+		cap->classprev->classnext = thinker;
+		thinker->classnext = cap;
+		thinker->classprev = cap->classprev;
+		cap->classprev = thinker;
+	}
+	else
+		thinker->classprev = thinker->classnext = NULL;
+
 	thinker->references = 0;    // killough 11/98: init reference counter to 0
 }
 
@@ -230,6 +258,8 @@ void P_RemoveThinkerDelayed(void *pthinker)
 			 * thinker->prev->next = thinker->next */
 			(next->prev = currentthinker = thinker->prev)->next = next;
 		}
+		if (thinker->classnext)
+			(thinker->classnext->classprev = thinker->classprev)->classnext = thinker->classnext;
 		Z_Free(thinker);
 	}
 }
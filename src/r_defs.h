@@ -260,6 +260,11 @@ typedef struct pslope_s
 	UINT8 flags; // Slope options
 	mapthing_t **vertices; // List should be three long for slopes made by vertex things, or one long for slopes using one vertex thing to anchor
 
+	// Dynamic slopes are only recalculated when what they're built from changes
+	boolean dirty; // Recalculate next tic regardless
+	fixed_t refheights[3]; // Plane heights (vertex z for vertex slopes) of the last recalculation
+	struct sector_s *vertexsectors[3]; // Linedef type 799 control sector of each vertex, if any
+
 	struct pslope_s *next; // Make a linked list of dynamic slopes, for easy reference later
 } pslope_t;
 
@@ -268,6 +268,11 @@ static void I_ReportSignal(int num, int coredumped)
 	case SIGSEGV:
 		sigmsg = "SIGSEGV - segment violation";
 		break;
+#ifdef SIGBUS
+	case SIGBUS:
+		sigmsg = "SIGBUS - bus error - was a loaded addon changed on disk?";
+		break;
+#endif
 //	case SIGTERM:
 //		sigmsg = "SIGTERM - Software termination signal from kill";
 //		break;
@@ -705,6 +710,9 @@ static void I_RegisterSignals (void)
 #ifndef NEWSIGNALHANDLER
 	signal(SIGILL , signal_handler);
 	signal(SIGSEGV , signal_handler);
+#ifdef SIGBUS
+	signal(SIGBUS , signal_handler);
+#endif
 	signal(SIGABRT , signal_handler);
 	signal(SIGFPE , signal_handler);
 #endif
@@ -2978,6 +2986,15 @@ tic_t I_GetTime(void)
 	return newtics;
 }
 
+//
+// I_GetTimeMicros
+// only as precise as I_GetTime here, to stay on the same clock
+//
+UINT64 I_GetTimeMicros(void)
+{
+	return (UINT64)I_GetTime() * 1000000 / NEWTICRATE;
+}
+
 static void I_ShutdownTimer(void)
 {
 	pfntimeGetTime = NULL;
@@ -2991,25 +3008,33 @@ static void I_ShutdownTimer(void)
 	}
 }
 #else
+// Set by I_StartupTimer, before any other thread can ask for the time
+static Uint64 basetime = 0, frequency = 0;
+
 //
-// I_GetTime
-// returns time in 1/TICRATE second tics
+// I_GetTimeMicros
+// returns time in microseconds, from the performance counter
 //
-tic_t I_GetTime (void)
+UINT64 I_GetTimeMicros(void)
 {
-	static Uint64 basetime = 0;
-		   Uint64 ticks = SDL_GetTicks();
-
-	if (!basetime)
-		basetime = ticks;
+	Uint64 ticks;
 
-	ticks -= basetime;
+	if (!frequency) // I_StartupTimer hasn't run yet
+		return 0;
 
-	ticks = (ticks*TICRATE);
+	ticks = SDL_GetPerformanceCounter() - basetime;
 
-	ticks = (ticks/1000);
+	return (ticks / frequency) * 1000000 + (ticks % frequency) * 1000000 / frequency;
+}
 
-	return (tic_t)ticks;
+//
+// I_GetTime
+// returns time in 1/TICRATE second tics, counted on the same clock as
+// I_GetTimeMicros so each tic starts exactly when expected
+//
+tic_t I_GetTime (void)
+{
+	return (tic_t)(I_GetTimeMicros() * TICRATE / 1000000);
 }
 #endif
 
@@ -3034,6 +3059,10 @@ void I_StartupTimer(void)
 		pfntimeGetTime = (p_timeGetTime)(LPVOID)GetProcAddress(winmm, "timeGetTime");
 	}
 	I_AddExitFunc(I_ShutdownTimer);
+	(void)I_GetTime(); // sets the base time, before any other thread can
+#else
+	basetime = SDL_GetPerformanceCounter();
+	frequency = SDL_GetPerformanceFrequency();
 #endif
 }
 
@@ -4005,6 +4034,7 @@ const CPUInfoFlags *I_CPUInfo(void)
 	SDL_CPUInfo.SSE         = SDL_HasSSE();
 	SDL_CPUInfo.SSE2        = SDL_HasSSE2();
 	SDL_CPUInfo.AltiVec     = SDL_HasAltiVec();
+	SDL_CPUInfo.CPUs        = min(SDL_GetCPUCount(), 127);
 	return &SDL_CPUInfo;
 #else
 	return NULL; /// \todo CPUID asm
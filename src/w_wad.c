@@ -26,6 +26,11 @@
 #define _FILE_OFFSET_BITS 0
 #endif
 
+// W_InflateLump feeds zlib read-only mapped data
+#ifndef ZLIB_CONST
+#define ZLIB_CONST
+#endif
+
 #include "zlib.h"
 #endif
 
@@ -33,6 +38,18 @@
 #include <unistd.h>
 #endif
 
+// Files are read through memory mappings where the system has them, and
+// large uncompressed lumps are cached straight out of a mapping of their
+// own, so that processes using the same files share the pages.
+#if (defined (__unix__) || defined (UNIXCOMMON) || defined (__APPLE__)) && !defined (NOMMAP)
+#define HAVE_MMAP
+#include <sys/mman.h>
+#include <unistd.h>
+#ifndef MAP_ANON
+#define MAP_ANON MAP_ANONYMOUS
+#endif
+#endif
+
 #define ZWAD
 
 #ifdef ZWAD
@@ -67,6 +84,10 @@
 #include "p_setup.h" // P_ScanThings
 #endif
 #include "m_misc.h" // M_MapNumber
+#include "m_argv.h" // -nommap, -loadthreads
+#ifdef HAVE_THREADS
+#include "i_threads.h"
+#endif
 
 #ifdef HWRENDER
 #include "r_data.h"
@@ -91,17 +112,44 @@ typedef struct
 	size_t len;
 } lumpchecklist_t;
 
-// Must be a power of two
-#define LUMPNUMCACHESIZE 64
+// What W_InitMultipleFiles finds out about a file before loading it
+typedef struct
+{
+	char filename[MAX_WADPATH]; // where it was found
+	UINT8 md5sum[16];
+	boolean found, hashed;
+	boolean important; // addon that marks the game modified, see W_VerifyNMUSlumps
+	tic_t hashtics, loadtics;
+} wadprefetch_t;
 
-typedef struct lumpnum_cache_s
+// Every file gets a hash of its lump names (wadfile_t lumphash/lumpnext),
+// chained in lump order. On top of that, lumpnameindex maps every name to
+// the lump W_CheckNumForName should find: the first one in the last file
+// that has it.
+#define LUMPHASHEND 0xFFFF // end of a lumphash chain
+
+typedef struct
 {
-	char lumpname[8];
-	lumpnum_t lumpnum;
-} lumpnum_cache_t;
+	char name[8];
+	lumpnum_t lumpnum; // LUMPERROR if the slot is free
+} lumpnameentry_t;
 
-static lumpnum_cache_t lumpnumcache[LUMPNUMCACHESIZE];
-static UINT16 lumpnumcacheindex = 0;
+static lumpnameentry_t *lumpnameindex;
+static size_t lumpnameindexsize; // a power of two
+static size_t lumpnameindexcount;
+
+// PK3s also get their full lump names sorted (wadfile_t pathorder), and a
+// sorted table of their folders, so that folder ranges and full names can
+// be found by binary search.
+#define MAXFOLDERDEPTH 16 // deeper folders aren't in the table
+
+typedef struct lumpfolder_s
+{
+	const char *path; // points into the name2 of one of its lumps
+	size_t len; // up to and including the last '/'
+	UINT16 first, last; // lowest and highest lump in it, at any depth
+	UINT16 count;
+} lumpfolder_t;
 
 //===========================================================================
 //                                                                    GLOBALS
@@ -109,6 +157,104 @@ static UINT16 lumpnumcacheindex = 0;
 UINT16 numwadfiles = 0; // number of active wadfiles
 wadfile_t *wadfiles[MAX_WADFILES]; // 0 to numwadfiles-1 are valid
 
+#ifdef HAVE_MMAP
+#define MAPLUMPMINSIZE (64<<10) // smaller lumps are simply copied when cached
+
+static size_t pagesize; // set on the first file, along with nommap
+static boolean nommap; // -nommap
+#endif
+
+// Maps a whole file for reading, unless disabled with -nommap.
+// The mapping is private, but pages not read yet still come from the file:
+// if it is truncated while loaded, reading past the new end raises SIGBUS,
+// which the system code reports like any other crash. Use -nommap to edit
+// addons while the game has them loaded.
+static void W_MapFile(wadfile_t *wadfile)
+{
+	wadfile->mapping = NULL;
+#ifdef HAVE_MMAP
+	if (!pagesize)
+	{
+		pagesize = (size_t)sysconf(_SC_PAGESIZE);
+		nommap = M_CheckParm("-nommap");
+	}
+
+	if (!wadfile->filesize || nommap)
+		return;
+
+	wadfile->mapping = mmap(NULL, wadfile->filesize, PROT_READ, MAP_PRIVATE, fileno(wadfile->handle), 0);
+	if (wadfile->mapping == MAP_FAILED)
+	{
+		CONS_Debug(DBG_SETUP, "Can't map %s, reading it instead\n", wadfile->filename);
+		wadfile->mapping = NULL;
+	}
+#endif
+}
+
+static void W_UnmapFile(wadfile_t *wadfile)
+{
+#ifdef HAVE_MMAP
+	if (wadfile->mapping)
+		munmap(wadfile->mapping, wadfile->filesize);
+#endif
+	wadfile->mapping = NULL;
+}
+
+// Reads raw file data, from the mapping if there is one.
+static size_t W_ReadFileData(wadfile_t *wadfile, size_t position, void *dest, size_t size)
+{
+	if (!wadfile->mapping)
+	{
+		fseek(wadfile->handle, (long)position, SEEK_SET);
+		return fread(dest, 1, size, wadfile->handle);
+	}
+
+	if (position >= wadfile->filesize)
+		return 0;
+	if (size > wadfile->filesize - position)
+		size = wadfile->filesize - position;
+	M_Memcpy(dest, wadfile->mapping + position, size);
+	return size;
+}
+
+#ifdef HAVE_MMAP
+static void W_UnmapLump(void *real, size_t realsize)
+{
+	munmap(real, realsize);
+}
+
+// Caches an uncompressed lump by mapping it on its own, copy-on-write, and
+// handing the mapping to the zone, which unmaps it once it is freed or
+// purged. Only the page the zone header is written to stops being shared.
+// Returns NULL if the lump can't be mapped.
+static void *W_MapLump(wadfile_t *wadfile, UINT16 lump, INT32 tag, void *user)
+{
+	const lumpinfo_t *l = &wadfile->lumpinfo[lump];
+	const size_t start = l->position & ~(pagesize - 1);
+	const size_t lead = l->position - start;
+	const size_t room = (lead < ZADOPTROOM) ? pagesize : 0; // for the header
+	const size_t len = room + lead + l->size;
+	UINT8 *base;
+
+	if (l->position + l->size > wadfile->filesize)
+		return NULL;
+
+	// Reserve the room first, then put the file over the rest of it.
+	base = mmap(NULL, len, PROT_READ|PROT_WRITE, MAP_PRIVATE|MAP_ANON, -1, 0);
+	if (base == MAP_FAILED)
+		return NULL;
+	if (mmap(base + room, len - room, PROT_READ|PROT_WRITE, MAP_PRIVATE|MAP_FIXED, fileno(wadfile->handle), (off_t)start) == MAP_FAILED)
+	{
+		munmap(base, len);
+		return NULL;
+	}
+
+	return Z_Adopt(base, len, base + room + lead, l->size, tag, user, W_UnmapLump);
+}
+#endif
+
+static void W_FlushDecompLumps(void);
+
 // W_Shutdown
 // Closes all of the WAD files before quitting
 // If not done on a Mac then open wad files
@@ -116,15 +262,23 @@ wadfile_t *wadfiles[MAX_WADFILES]; // 0 to numwadfiles-1 are valid
 // being ejected
 void W_Shutdown(void)
 {
+	W_FlushDecompLumps();
 	while (numwadfiles--)
 	{
+		W_UnmapFile(wadfiles[numwadfiles]);
 		fclose(wadfiles[numwadfiles]->handle);
 		Z_Free(wadfiles[numwadfiles]->filename);
 		while (wadfiles[numwadfiles]->numlumps--)
 			Z_Free(wadfiles[numwadfiles]->lumpinfo[wadfiles[numwadfiles]->numlumps].name2);
 		Z_Free(wadfiles[numwadfiles]->lumpinfo);
+		Z_Free(wadfiles[numwadfiles]->lumphash);
+		Z_Free(wadfiles[numwadfiles]->pathorder);
+		Z_Free(wadfiles[numwadfiles]->folders);
 		Z_Free(wadfiles[numwadfiles]);
 	}
+	Z_Free(lumpnameindex);
+	lumpnameindex = NULL;
+	lumpnameindexsize = lumpnameindexcount = 0;
 }
 
 //===========================================================================
@@ -292,30 +446,260 @@ static inline INT32 W_MakeFileMD5(const char *filename, void *resblock)
 	(void)filename;
 	memset(resblock, 0x00, 16);
 #else
-	FILE *fhandle;
+	tic_t t;
+
+#ifndef _arch_dreamcast
+	if (D_CachedFileMD5(filename, resblock))
+		return 0; // nothing was calculated
+#endif
 
-	if ((fhandle = fopen(filename, "rb")) != NULL)
+	t = I_GetTime();
+	CONS_Debug(DBG_SETUP, "Making MD5 for %s\n",filename);
+	if (D_HashFileMD5(filename, resblock))
 	{
-		tic_t t = I_GetTime();
-		CONS_Debug(DBG_SETUP, "Making MD5 for %s\n",filename);
-		if (md5_stream(fhandle, resblock) == 1)
-		{
-			fclose(fhandle);
-			return 1;
-		}
 		CONS_Debug(DBG_SETUP, "MD5 calc for %s took %f seconds\n",
 			filename, (float)(I_GetTime() - t)/NEWTICRATE);
-		fclose(fhandle);
 		return 0;
 	}
 #endif
 	return 1;
 }
 
-// Invalidates the cache of lump numbers. Call this whenever a wad is added.
-static void W_InvalidateLumpnumCache(void)
+// Case insensitive hash of a lump name, up to eight characters.
+static UINT32 W_HashLumpName(const char *name)
 {
-	memset(lumpnumcache, 0, sizeof (lumpnumcache));
+	UINT32 hash = 2166136261u;
+	size_t i;
+
+	for (i = 0; i < 8 && name[i]; i++)
+		hash = (hash ^ (UINT8)toupper(name[i])) * 16777619u;
+
+	return hash;
+}
+
+// Sets up the lump name hash chains of a freshly loaded file.
+static void W_MakeLumpNameHash(wadfile_t *wadfile)
+{
+	UINT32 buckets = 1, bucket;
+	UINT16 i;
+
+	while (buckets < wadfile->numlumps)
+		buckets <<= 1;
+
+	wadfile->lumphash = Z_Malloc((buckets + wadfile->numlumps) * sizeof (*wadfile->lumphash), PU_STATIC, NULL);
+	wadfile->lumpnext = wadfile->lumphash + buckets;
+	wadfile->lumphashmask = buckets - 1;
+	memset(wadfile->lumphash, 0xFF, buckets * sizeof (*wadfile->lumphash));
+
+	// Go backwards, so that each chain ends up in lump order.
+	for (i = wadfile->numlumps; i-- > 0;)
+	{
+		bucket = W_HashLumpName(wadfile->lumpinfo[i].name) & wadfile->lumphashmask;
+		wadfile->lumpnext[i] = wadfile->lumphash[bucket];
+		wadfile->lumphash[bucket] = i;
+	}
+}
+
+// Finds the slot for a (zero padded) lump name in lumpnameindex.
+static lumpnameentry_t *W_LumpNameSlot(const char *name)
+{
+	size_t i = W_HashLumpName(name) & (lumpnameindexsize - 1);
+
+	while (lumpnameindex[i].lumpnum != LUMPERROR && memcmp(lumpnameindex[i].name, name, 8))
+		i = (i + 1) & (lumpnameindexsize - 1);
+
+	return &lumpnameindex[i];
+}
+
+static void W_ResizeLumpNameIndex(size_t size)
+{
+	lumpnameentry_t *old = lumpnameindex;
+	size_t i, oldsize = lumpnameindexsize;
+
+	lumpnameindex = Z_Malloc(size * sizeof (*lumpnameindex), PU_STATIC, NULL);
+	lumpnameindexsize = size;
+	for (i = 0; i < size; i++)
+		lumpnameindex[i].lumpnum = LUMPERROR;
+
+	for (i = 0; i < oldsize; i++)
+		if (old[i].lumpnum != LUMPERROR)
+			*W_LumpNameSlot(old[i].name) = old[i];
+
+	Z_Free(old);
+}
+
+// Adds a file's lumps to lumpnameindex. Files must be added in order.
+static void W_IndexLumpNames(UINT16 wadnum)
+{
+	const wadfile_t *wadfile = wadfiles[wadnum];
+	lumpnameentry_t *slot;
+	UINT16 i;
+
+	for (i = 0; i < wadfile->numlumps; i++)
+	{
+		if ((lumpnameindexcount + 1) * 2 > lumpnameindexsize)
+			W_ResizeLumpNameIndex(max(lumpnameindexsize * 2, 1024));
+
+		slot = W_LumpNameSlot(wadfile->lumpinfo[i].name);
+		if (slot->lumpnum == LUMPERROR)
+		{
+			memcpy(slot->name, wadfile->lumpinfo[i].name, 8);
+			lumpnameindexcount++;
+		}
+		else if (WADFILENUM(slot->lumpnum) == wadnum)
+			continue; // an earlier lump in this file has the name already
+
+		slot->lumpnum = (wadnum<<16) + i;
+	}
+}
+
+// Compares up to n characters of two paths, case insensitively.
+static int W_ComparePaths(const char *a, const char *b, size_t n)
+{
+	int cmp;
+
+	for (; n; n--, a++, b++)
+	{
+		cmp = tolower((UINT8)*a) - tolower((UINT8)*b);
+		if (cmp || !*a)
+			return cmp;
+	}
+	return 0;
+}
+
+static const lumpinfo_t *sortlumpinfo; // for W_ComparePathOrder
+
+static int W_ComparePathOrder(const void *a, const void *b)
+{
+	const UINT16 x = *(const UINT16 *)a, y = *(const UINT16 *)b;
+	const int cmp = W_ComparePaths(sortlumpinfo[x].name2, sortlumpinfo[y].name2, (size_t)-1);
+
+	return cmp ? cmp : x - y;
+}
+
+static int W_CompareFolders(const void *a, const void *b)
+{
+	const lumpfolder_t *x = a, *y = b;
+	const int cmp = W_ComparePaths(x->path, y->path, min(x->len, y->len));
+
+	if (cmp)
+		return cmp;
+	return (x->len > y->len) - (x->len < y->len);
+}
+
+// Sorts a PK3's lump names and gathers its folders.
+static void W_MakePathIndex(wadfile_t *wadfile)
+{
+	const UINT16 numlumps = wadfile->numlumps;
+	UINT16 open[MAXFOLDERDEPTH]; // folders of the previous lump, by depth
+	size_t numopen = 0, depth, len, maxfolders = 64;
+	const char *name, *slash;
+	lumpfolder_t *folder;
+	UINT16 i, lump;
+
+	wadfile->pathorder = Z_Malloc(max(numlumps, 1) * sizeof (*wadfile->pathorder), PU_STATIC, NULL);
+	for (i = 0; i < numlumps; i++)
+		wadfile->pathorder[i] = i;
+	sortlumpinfo = wadfile->lumpinfo;
+	qsort(wadfile->pathorder, numlumps, sizeof (*wadfile->pathorder), W_ComparePathOrder);
+
+	// In sorted order, everything in a folder comes in one run, so each
+	// folder only has to be compared against the previous lump's.
+	wadfile->folders = Z_Malloc(maxfolders * sizeof (*wadfile->folders), PU_STATIC, NULL);
+	wadfile->numfolders = 0;
+	for (i = 0; i < numlumps; i++)
+	{
+		lump = wadfile->pathorder[i];
+		name = wadfile->lumpinfo[lump].name2;
+
+		for (depth = 0, slash = strchr(name, '/'); slash && depth < MAXFOLDERDEPTH; depth++, slash = strchr(slash + 1, '/'))
+		{
+			len = slash - name + 1;
+			folder = depth < numopen ? &wadfile->folders[open[depth]] : NULL;
+
+			if (!folder || folder->len != len || W_ComparePaths(folder->path, name, len))
+			{
+				if (wadfile->numfolders == maxfolders)
+				{
+					maxfolders *= 2;
+					wadfile->folders = Z_Realloc(wadfile->folders, maxfolders * sizeof (*wadfile->folders), PU_STATIC, NULL);
+				}
+				open[depth] = wadfile->numfolders++;
+				numopen = depth + 1;
+
+				folder = &wadfile->folders[open[depth]];
+				folder->path = name;
+				folder->len = len;
+				folder->first = folder->last = lump;
+				folder->count = 0;
+			}
+
+			folder->first = min(folder->first, lump);
+			folder->last = max(folder->last, lump);
+			folder->count++;
+		}
+		numopen = depth;
+	}
+
+	qsort(wadfile->folders, wadfile->numfolders, sizeof (*wadfile->folders), W_CompareFolders);
+}
+
+// Finds a folder (name ending in '/') in a PK3's folder table.
+// Returns NULL if it isn't there, and sets *indexed to whether that means
+// there is no such folder, or the table can't tell.
+static const lumpfolder_t *W_FindFolder(const wadfile_t *wadfile, const char *name, size_t len, boolean *indexed)
+{
+	lumpfolder_t key;
+	size_t depth = 0, i;
+
+	for (i = 0; i < len; i++)
+		if (name[i] == '/')
+			depth++;
+
+	*indexed = (wadfile->folders && len && name[len - 1] == '/' && depth <= MAXFOLDERDEPTH);
+	if (!*indexed)
+		return NULL;
+
+	key.path = name;
+	key.len = len;
+	return bsearch(&key, wadfile->folders, wadfile->numfolders, sizeof (*wadfile->folders), W_CompareFolders);
+}
+
+// Finds the lowest lump, from startlump on, whose full name starts with
+// the given one. Returns false if there is none.
+static boolean W_FindPathPrefix(const wadfile_t *wadfile, const char *name, size_t len, UINT16 startlump, UINT16 *lump)
+{
+	size_t lo = 0, hi = wadfile->numlumps, mid;
+	boolean found = false;
+
+	// Everything with the prefix sorts at or right after the prefix itself.
+	while (lo < hi)
+	{
+		mid = (lo + hi) / 2;
+		if (W_ComparePaths(wadfile->lumpinfo[wadfile->pathorder[mid]].name2, name, (size_t)-1) < 0)
+			lo = mid + 1;
+		else
+			hi = mid;
+	}
+
+	for (; lo < wadfile->numlumps && !W_ComparePaths(wadfile->lumpinfo[wadfile->pathorder[lo]].name2, name, len); lo++)
+	{
+		if (wadfile->pathorder[lo] >= startlump && (!found || wadfile->pathorder[lo] < *lump))
+		{
+			*lump = wadfile->pathorder[lo];
+			found = true;
+		}
+	}
+
+	return found;
+}
+
+// Looks up a zero padded lump name in lumpnameindex.
+static lumpnum_t W_LookupLumpName(const char *name)
+{
+	if (!lumpnameindex)
+		return LUMPERROR;
+	return W_LumpNameSlot(name)->lumpnum;
 }
 
 /** Detect a file type.
@@ -647,7 +1031,9 @@ static lumpinfo_t* ResGetLumpsZip (FILE* handle, UINT16* nlmp)
 //
 // Can now load dehacked files (.soc)
 //
-UINT16 W_InitFile(const char *filename)
+// md5sum, if not NULL, is the file's MD5, worked out beforehand.
+//
+static UINT16 W_LoadFile(const char *filename, const UINT8 *md5sum)
 {
 	FILE *handle;
 	lumpinfo_t *lumpinfo = NULL;
@@ -655,7 +1041,9 @@ UINT16 W_InitFile(const char *filename)
 	restype_t type;
 	UINT16 numlumps = 0;
 	size_t i;
-	UINT8 md5sum[16];
+#ifndef NOMD5
+	UINT8 filemd5[16];
+#endif
 	boolean important;
 
 	if (!(refreshdirmenu & REFRESHDIR_ADDFILE))
@@ -694,7 +1082,11 @@ UINT16 W_InitFile(const char *filename)
 	// Let's not add a wad file if the MD5 matches
 	// an MD5 of an already added WAD file!
 	//
-	W_MakeFileMD5(filename, md5sum);
+	if (!md5sum)
+	{
+		W_MakeFileMD5(filename, filemd5);
+		md5sum = filemd5;
+	}
 
 	for (i = 0; i < numwadfiles; i++)
 	{
@@ -742,13 +1134,25 @@ UINT16 W_InitFile(const char *filename)
 	wadfile->handle = handle;
 	wadfile->numlumps = (UINT16)numlumps;
 	wadfile->lumpinfo = lumpinfo;
+	W_MakeLumpNameHash(wadfile);
+	wadfile->pathorder = NULL;
+	wadfile->folders = NULL;
+	wadfile->numfolders = 0;
+	if (type == RET_PK3)
+		W_MakePathIndex(wadfile);
 	wadfile->important = important;
 	fseek(handle, 0, SEEK_END);
 	wadfile->filesize = (unsigned)ftell(handle);
 	wadfile->type = type;
+	W_MapFile(wadfile);
 
 	// already generated, just copy it over
-	M_Memcpy(&wadfile->md5sum, &md5sum, 16);
+#ifndef NOMD5
+	M_Memcpy(wadfile->md5sum, md5sum, 16);
+#else
+	(void)md5sum;
+	memset(wadfile->md5sum, 0x00, 16);
+#endif
 
 	//
 	// set up caching
@@ -766,6 +1170,7 @@ UINT16 W_InitFile(const char *filename)
 	CONS_Printf(M_GetText("Added file %s (%u lumps)\n"), filename, numlumps);
 	wadfiles[numwadfiles] = wadfile;
 	numwadfiles++; // must come BEFORE W_LoadDehackedLumps, so any addfile called by COM_BufInsertText called by Lua doesn't overwrite what we just loaded
+	W_IndexLumpNames(numwadfiles - 1);
 
 #ifdef HWRENDER
 	if (rendermode == render_opengl)
@@ -798,10 +1203,14 @@ UINT16 W_InitFile(const char *filename)
 		G_LoadGameData();
 	DEH_UpdateMaxFreeslots();
 
-	W_InvalidateLumpnumCache();
 	return wadfile->numlumps;
 }
 
+UINT16 W_InitFile(const char *filename)
+{
+	return W_LoadFile(filename, NULL);
+}
+
 #ifdef DELFILE
 void W_UnloadWadFile(UINT16 num)
 {
@@ -827,13 +1236,156 @@ void W_UnloadWadFile(UINT16 num)
 			Z_ChangeTag(lumpcache[i], PU_PURGELEVEL);
 	}
 	Z_Free(lumpcache);
+	W_FlushDecompLumps();
+	W_UnmapFile(delwad);
 	fclose(delwad->handle);
 	Z_Free(delwad->filename);
+	Z_Free(delwad->lumphash);
+	Z_Free(delwad->pathorder);
+	Z_Free(delwad->folders);
 	Z_Free(delwad);
+
+	// Names the file overrode may resolve to earlier files again.
+	Z_Free(lumpnameindex);
+	lumpnameindex = NULL;
+	lumpnameindexsize = lumpnameindexcount = 0;
+	for (i = 0; i < numwadfiles; i++)
+		W_IndexLumpNames((UINT16)i);
 	CONS_Printf(M_GetText("Done unloading WAD.\n"));
 }
 #endif
 
+#ifndef NOMD5
+// Works out the MD5s of the files W_InitMultipleFiles is about to load,
+// on worker threads where there are any. Only the hashing itself happens
+// there; everything else stays on the main thread, and in order.
+static wadprefetch_t **prefetchqueue;
+static size_t prefetchnext, prefetchcount;
+#ifdef HAVE_THREADS
+static size_t prefetchworkers; // still running, main thread included
+static I_mutex prefetchmutex;
+static I_cond prefetchcond;
+#endif
+
+static void W_PrefetchWorker(void *userdata)
+{
+	wadprefetch_t *file;
+	FILE *handle;
+	tic_t t;
+
+	(void)userdata;
+
+	for (;;)
+	{
+		file = NULL;
+#ifdef HAVE_THREADS
+		I_lock_mutex(&prefetchmutex);
+#endif
+		if (prefetchnext < prefetchcount)
+			file = prefetchqueue[prefetchnext++];
+#ifdef HAVE_THREADS
+		else if (!--prefetchworkers)
+			I_wake_all_cond(&prefetchcond);
+		I_unlock_mutex(prefetchmutex);
+#endif
+		if (!file)
+			return;
+
+		t = I_GetTime();
+		if ((handle = fopen(file->filename, "rb")) != NULL)
+		{
+			file->hashed = (md5_stream(handle, file->md5sum) == 0);
+			fclose(handle);
+		}
+		file->hashtics = I_GetTime() - t;
+	}
+}
+
+// Number of threads to hash with, the main one included.
+static size_t W_PrefetchThreads(size_t jobs)
+{
+#ifdef HAVE_THREADS
+	const CPUInfoFlags *cpu = I_CPUInfo();
+	INT32 threads = (cpu && cpu->CPUs > 0) ? cpu->CPUs : 4;
+
+	if (M_CheckParm("-loadthreads") && M_IsNextParm())
+		threads = atoi(M_GetNextParm());
+
+	return max(1, min((size_t)max(threads, 1), jobs));
+#else
+	(void)jobs;
+	return 1;
+#endif
+}
+
+/** Finds the files W_InitMultipleFiles is going to load, and gets their
+  * MD5s, from the MD5 cache or by hashing them across threads.
+  *
+  * \param filenames Files to load.
+  * \param files Where to put what was found out about each.
+  * \param numfiles How many there are.
+  * \param addons Whether they are addons, which are checked for
+  *               importance too.
+  * \return Time spent, in tics.
+  */
+static tic_t W_PrefetchFiles(char **filenames, wadprefetch_t *files, size_t numfiles, boolean addons)
+{
+	const char *filename;
+	tic_t t = I_GetTime();
+	size_t i, threads;
+	FILE *handle;
+
+	prefetchqueue = Z_Malloc(max(numfiles, 1) * sizeof (*prefetchqueue), PU_STATIC, NULL);
+	prefetchnext = prefetchcount = 0;
+
+	for (i = 0; i < numfiles; i++)
+	{
+		filename = filenames[i];
+		if ((handle = W_OpenWadFile(&filename, false)) == NULL)
+			continue;
+		fclose(handle);
+
+		strlcpy(files[i].filename, filename, sizeof files[i].filename);
+		files[i].found = true;
+		if (addons)
+			files[i].important = !W_VerifyNMUSlumps(files[i].filename);
+
+		if (D_CachedFileMD5(files[i].filename, files[i].md5sum))
+			files[i].hashed = true;
+		else
+			prefetchqueue[prefetchcount++] = &files[i];
+	}
+
+	threads = W_PrefetchThreads(prefetchcount);
+	if (prefetchcount)
+	{
+		CONS_Debug(DBG_SETUP, "Hashing %s files with %s threads\n", sizeu1(prefetchcount), sizeu2(threads));
+
+#ifdef HAVE_THREADS
+		prefetchworkers = threads;
+		for (i = 1; i < threads; i++)
+			I_spawn_thread("hash-files", W_PrefetchWorker, NULL);
+#endif
+		W_PrefetchWorker(NULL);
+#ifdef HAVE_THREADS
+		I_lock_mutex(&prefetchmutex);
+		while (prefetchworkers)
+			I_hold_cond(&prefetchcond, prefetchmutex);
+		I_unlock_mutex(prefetchmutex);
+#endif
+
+		for (i = 0; i < prefetchcount; i++)
+			if (prefetchqueue[i]->hashed)
+				D_RememberFileMD5(prefetchqueue[i]->filename, prefetchqueue[i]->md5sum);
+	}
+
+	Z_Free(prefetchqueue);
+	prefetchqueue = NULL;
+	prefetchnext = prefetchcount = 0;
+	return I_GetTime() - t;
+}
+#endif
+
 /** Tries to load a series of files.
   * All files are wads unless they have an extension of ".soc" or ".lua".
   *
@@ -847,17 +1399,48 @@ void W_UnloadWadFile(UINT16 num)
   */
 INT32 W_InitMultipleFiles(char **filenames, boolean addons)
 {
+	wadprefetch_t *files, *file;
+	size_t numfiles, i;
+	tic_t t, hashtics = 0, loadtics;
 	INT32 rc = 1;
 
-	// will be realloced as lumps are added
-	for (; *filenames; filenames++)
+	for (numfiles = 0; filenames[numfiles]; numfiles++)
+		;
+	files = Z_Calloc(max(numfiles, 1) * sizeof (*files), PU_STATIC, NULL);
+
+	// Hash everything up front, in parallel, then load in order.
+#ifndef NOMD5
+	hashtics = W_PrefetchFiles(filenames, files, numfiles, addons);
+#endif
+
+	t = I_GetTime();
+	for (i = 0; i < numfiles; i++)
 	{
-		if (addons && !W_VerifyNMUSlumps(*filenames))
+		tic_t filetics = I_GetTime();
+
+		file = &files[i];
+
+		// Before loading, so that the file's SOC sees the game as modified
+		if (addons && (file->found ? file->important : !W_VerifyNMUSlumps(filenames[i])))
 			G_SetGameModified(true, false);
 
 		//CONS_Debug(DBG_SETUP, "Loading %s\n", *filenames);
-		rc &= (W_InitFile(*filenames) != INT16_MAX) ? 1 : 0;
+		if (file->found && file->hashed)
+			rc &= (W_LoadFile(file->filename, file->md5sum) != INT16_MAX) ? 1 : 0;
+		else
+			rc &= (W_InitFile(filenames[i]) != INT16_MAX) ? 1 : 0;
+
+		file->loadtics = I_GetTime() - filetics;
+		CONS_Debug(DBG_SETUP, "%s: hashed in %f, loaded in %f seconds\n", filenames[i],
+			(float)file->hashtics/NEWTICRATE, (float)file->loadtics/NEWTICRATE);
 	}
+	loadtics = I_GetTime() - t;
+
+	if (numfiles > 1)
+		CONS_Printf("Loaded %s files in %f seconds (hashing %f, loading %f)\n", sizeu1(numfiles),
+			(float)(hashtics + loadtics)/NEWTICRATE, (float)hashtics/NEWTICRATE, (float)loadtics/NEWTICRATE);
+
+	Z_Free(files);
 
 	if (!numwadfiles)
 		I_Error("W_InitMultipleFiles: no files found");
@@ -916,16 +1499,16 @@ UINT16 W_CheckNumForNamePwad(const char *name, UINT16 wad, UINT16 startlump)
 		return INT16_MAX;
 
 	//
-	// scan forward
+	// follow the name's hash chain, which is in lump order
 	// start at 'startlump', useful parameter when there are multiple
 	//                       resources with the same name
 	//
 	if (startlump < wadfiles[wad]->numlumps)
 	{
-		lumpinfo_t *lump_p = wadfiles[wad]->lumpinfo + startlump;
-		for (i = startlump; i < wadfiles[wad]->numlumps; i++, lump_p++)
+		const wadfile_t *wadfile = wadfiles[wad];
+		for (i = wadfile->lumphash[W_HashLumpName(uname) & wadfile->lumphashmask]; i != LUMPHASHEND; i = wadfile->lumpnext[i])
 		{
-			if (memcmp(lump_p->name,uname,8) == 0)
+			if (i >= startlump && memcmp(wadfile->lumpinfo[i].name,uname,8) == 0)
 				return i;
 		}
 	}
@@ -937,11 +1520,25 @@ UINT16 W_CheckNumForNamePwad(const char *name, UINT16 wad, UINT16 startlump)
 // Look for the first lump from a folder.
 UINT16 W_CheckNumForFolderStartPK3(const char *name, UINT16 wad, UINT16 startlump)
 {
+	const wadfile_t *wadfile = wadfiles[wad];
+	const size_t len = strlen(name);
+	const lumpfolder_t *folder;
+	boolean indexed;
+	UINT16 lump;
 	INT32 i;
-	lumpinfo_t *lump_p = wadfiles[wad]->lumpinfo + startlump;
-	for (i = startlump; i < wadfiles[wad]->numlumps; i++, lump_p++)
+	lumpinfo_t *lump_p;
+
+	folder = W_FindFolder(wadfile, name, len, &indexed);
+	if (indexed && (!folder || startlump <= folder->first))
+		return folder ? folder->first : max(startlump, wadfile->numlumps);
+
+	if (wadfile->pathorder && startlump < wadfile->numlumps)
+		return W_FindPathPrefix(wadfile, name, len, startlump, &lump) ? lump : wadfile->numlumps;
+
+	lump_p = wadfile->lumpinfo + startlump;
+	for (i = startlump; i < wadfile->numlumps; i++, lump_p++)
 	{
-		if (strnicmp(name, lump_p->name2, strlen(name)) == 0)
+		if (strnicmp(name, lump_p->name2, len) == 0)
 			break;
 	}
 	return i;
@@ -952,11 +1549,26 @@ UINT16 W_CheckNumForFolderStartPK3(const char *name, UINT16 wad, UINT16 startlum
 // Returns the position of the lumpinfo entry.
 UINT16 W_CheckNumForFolderEndPK3(const char *name, UINT16 wad, UINT16 startlump)
 {
+	const wadfile_t *wadfile = wadfiles[wad];
+	const size_t len = strlen(name);
+	const lumpfolder_t *folder;
+	boolean indexed;
 	INT32 i;
-	lumpinfo_t *lump_p = wadfiles[wad]->lumpinfo + startlump;
-	for (i = startlump; i < wadfiles[wad]->numlumps; i++, lump_p++)
+	lumpinfo_t *lump_p;
+
+	// If the folder's lumps are all in one run, its end is known already.
+	folder = W_FindFolder(wadfile, name, len, &indexed);
+	if (indexed && (!folder || folder->last - folder->first + 1 == folder->count))
 	{
-		if (strnicmp(name, lump_p->name2, strlen(name)))
+		if (folder && startlump >= folder->first && startlump <= folder->last)
+			return folder->last + 1;
+		return startlump;
+	}
+
+	lump_p = wadfile->lumpinfo + startlump;
+	for (i = startlump; i < wadfile->numlumps; i++, lump_p++)
+	{
+		if (strnicmp(name, lump_p->name2, len))
 			break;
 	}
 	return i;
@@ -966,11 +1578,19 @@ UINT16 W_CheckNumForFolderEndPK3(const char *name, UINT16 wad, UINT16 startlump)
 // Returns lump position in PK3's lumpinfo, or INT16_MAX if not found.
 UINT16 W_CheckNumForFullNamePK3(const char *name, UINT16 wad, UINT16 startlump)
 {
+	const wadfile_t *wadfile = wadfiles[wad];
+	const size_t len = strlen(name);
+	UINT16 lump;
 	INT32 i;
-	lumpinfo_t *lump_p = wadfiles[wad]->lumpinfo + startlump;
-	for (i = startlump; i < wadfiles[wad]->numlumps; i++, lump_p++)
+	lumpinfo_t *lump_p;
+
+	if (wadfile->pathorder)
+		return W_FindPathPrefix(wadfile, name, len, startlump, &lump) ? lump : INT16_MAX;
+
+	lump_p = wadfile->lumpinfo + startlump;
+	for (i = startlump; i < wadfile->numlumps; i++, lump_p++)
 	{
-		if (!strnicmp(name, lump_p->name2, strlen(name)))
+		if (!strnicmp(name, lump_p->name2, len))
 		{
 			return i;
 		}
@@ -979,71 +1599,134 @@ UINT16 W_CheckNumForFullNamePK3(const char *name, UINT16 wad, UINT16 startlump)
 	return INT16_MAX;
 }
 
-//
-// W_CheckNumForName
-// Returns LUMPERROR if name not found.
-//
-lumpnum_t W_CheckNumForName(const char *name)
+// What W_CheckNumForFullNamePK3 and W_CheckNumForFolderStartPK3 did before
+// PK3 paths were indexed, for benchlookups to compare with.
+static UINT16 W_ScanPathPK3(const char *name, const wadfile_t *wadfile)
 {
-	INT32 i;
-	lumpnum_t check = INT16_MAX;
+	const size_t len = strlen(name);
+	UINT16 i;
 
-	// Check the lumpnumcache first. Loop backwards so that we check
-	// most recent entries first
-	for (i = lumpnumcacheindex + LUMPNUMCACHESIZE; i > lumpnumcacheindex; i--)
+	for (i = 0; i < wadfile->numlumps; i++)
+		if (!strnicmp(name, wadfile->lumpinfo[i].name2, len))
+			return i;
+	return INT16_MAX;
+}
+
+/** Times full name and folder lookups of every lump in the loaded PK3s,
+  * indexed and by scanning all of the lumps as before.
+  * "benchlookups <file number>" measures just that file.
+  */
+void Command_BenchLookups_f(void)
+{
+	char folder[256];
+	const wadfile_t *wadfile;
+	const char *name, *slash;
+	UINT64 start, indexed[2], scanned[2];
+	UINT32 lookups[2], wrong;
+	UINT16 wad, lump, first = 0, last = numwadfiles;
+	UINT16 found;
+
+	if (COM_Argc() > 1)
 	{
-		if (strncmp(lumpnumcache[i & (LUMPNUMCACHESIZE - 1)].lumpname, name, 8) == 0)
+		first = (UINT16)atoi(COM_Argv(1));
+		if (first >= numwadfiles)
 		{
-			lumpnumcacheindex = i & (LUMPNUMCACHESIZE - 1);
-			return lumpnumcache[lumpnumcacheindex].lumpnum;
+			CONS_Printf(M_GetText("There is no file %d.\n"), first);
+			return;
 		}
+		last = first + 1;
 	}
 
-	// scan wad files backwards so patch lump files take precedence
-	for (i = numwadfiles - 1; i >= 0; i--)
+	for (wad = first; wad < last; wad++)
 	{
-		check = W_CheckNumForNamePwad(name,(UINT16)i,0);
-		if (check != INT16_MAX)
-			break; //found it
-	}
+		wadfile = wadfiles[wad];
+		if (wadfile->type != RET_PK3)
+			continue;
 
-	if (check == INT16_MAX) return LUMPERROR;
-	else
-	{
-		// Update the cache.
-		lumpnumcacheindex = (lumpnumcacheindex + 1) & (LUMPNUMCACHESIZE - 1);
-		strncpy(lumpnumcache[lumpnumcacheindex].lumpname, name, 8);
-		lumpnumcache[lumpnumcacheindex].lumpnum = (i<<16)+check;
+		indexed[0] = indexed[1] = scanned[0] = scanned[1] = 0;
+		lookups[0] = lookups[1] = wrong = 0;
 
-		return lumpnumcache[lumpnumcacheindex].lumpnum;
+		for (lump = 0; lump < wadfile->numlumps; lump++)
+		{
+			name = wadfile->lumpinfo[lump].name2;
+
+			start = I_GetTimeMicros();
+			found = W_CheckNumForFullNamePK3(name, wad, 0);
+			indexed[0] += I_GetTimeMicros() - start;
+			start = I_GetTimeMicros();
+			if (W_ScanPathPK3(name, wadfile) != found)
+				wrong++;
+			scanned[0] += I_GetTimeMicros() - start;
+			lookups[0]++;
+
+			// The folder it's in, if it isn't at the root
+			slash = strrchr(name, '/');
+			if (!slash || (size_t)(slash - name) + 1 >= sizeof folder)
+				continue;
+			strlcpy(folder, name, (size_t)(slash - name) + 2);
+
+			start = I_GetTimeMicros();
+			found = W_CheckNumForFolderStartPK3(folder, wad, 0);
+			indexed[1] += I_GetTimeMicros() - start;
+			start = I_GetTimeMicros();
+			if (W_ScanPathPK3(folder, wadfile) != (found < wadfile->numlumps ? found : INT16_MAX))
+				wrong++;
+			scanned[1] += I_GetTimeMicros() - start;
+			lookups[1]++;
+		}
+
+		CONS_Printf("%d: %s, %u lumps\n", wad, wadfile->filename, wadfile->numlumps);
+		CONS_Printf(M_GetText("%u full names: %s us indexed, %s us scanned\n"),
+			lookups[0], sizeu1((size_t)indexed[0]), sizeu2((size_t)scanned[0]));
+		CONS_Printf(M_GetText("%u folders: %s us indexed, %s us scanned\n"),
+			lookups[1], sizeu1((size_t)indexed[1]), sizeu2((size_t)scanned[1]));
+		if (wrong)
+			CONS_Printf(M_GetText("\x85%u lookups found a different lump!\n"), wrong);
 	}
 }
 
+//
+// W_CheckNumForName
+// Returns LUMPERROR if name not found.
+//
+lumpnum_t W_CheckNumForName(const char *name)
+{
+	char uname[9];
+
+	memset(uname, 0x00, sizeof uname);
+	strncpy(uname, name, 8);
+	strupr(uname);
+
+	// lumpnameindex already knows which file takes precedence
+	return W_LookupLumpName(uname);
+}
+
 // Look for valid map data through all added files in descendant order.
 // Get a map marker for WADs, and a standalone WAD file lump inside PK3s.
 // TODO: Make it search through cache first, maybe...?
 lumpnum_t W_CheckNumForMap(const char *name)
 {
-	UINT16 lumpNum, end;
-	UINT32 i;
+	UINT16 lumpNum, start, end;
+	UINT32 i, hash = W_HashLumpName(name);
 	for (i = numwadfiles - 1; i < numwadfiles; i--)
 	{
-		if (wadfiles[i]->type == RET_WAD)
+		const wadfile_t *wadfile = wadfiles[i];
+		if (wadfile->type == RET_WAD)
 		{
-			for (lumpNum = 0; lumpNum < wadfiles[i]->numlumps; lumpNum++)
-				if (!strncmp(name, (wadfiles[i]->lumpinfo + lumpNum)->name, 8))
+			for (lumpNum = wadfile->lumphash[hash & wadfile->lumphashmask]; lumpNum != LUMPHASHEND; lumpNum = wadfile->lumpnext[lumpNum])
+				if (!strncmp(name, (wadfile->lumpinfo + lumpNum)->name, 8))
 					return (i<<16) + lumpNum;
 		}
 		else if (wadfiles[i]->type == RET_PK3)
 		{
-			lumpNum = W_CheckNumForFolderStartPK3("maps/", i, 0);
-			if (lumpNum != INT16_MAX)
-				end = W_CheckNumForFolderEndPK3("maps/", i, lumpNum);
+			start = W_CheckNumForFolderStartPK3("maps/", i, 0);
+			if (start != INT16_MAX)
+				end = W_CheckNumForFolderEndPK3("maps/", i, start);
 			else
 				continue;
 			// Now look for the specified map.
-			for (++lumpNum; lumpNum < end; lumpNum++)
-				if (!strnicmp(name, (wadfiles[i]->lumpinfo + lumpNum)->name, 8))
+			for (lumpNum = wadfile->lumphash[hash & wadfile->lumphashmask]; lumpNum < end; lumpNum = wadfile->lumpnext[lumpNum])
+				if (lumpNum > start && !strnicmp(name, (wadfile->lumpinfo + lumpNum)->name, 8))
 					return (i<<16) + lumpNum;
 		}
 	}
@@ -1101,15 +1784,14 @@ lumpnum_t W_CheckNumForNameInBlock(const char *name, const char *blockstart, con
 #include "fastcmp.h"
 UINT8 W_LumpExists(const char *name)
 {
-	INT32 i,j;
-	for (i = numwadfiles - 1; i >= 0; i--)
-	{
-		lumpinfo_t *lump_p = wadfiles[i]->lumpinfo;
-		for (j = 0; j < wadfiles[i]->numlumps; ++j, ++lump_p)
-			if (fastcmp(lump_p->name,name))
-				return true;
-	}
-	return false;
+	char pname[8];
+
+	if (strlen(name) > 8)
+		return false;
+
+	memset(pname, 0x00, sizeof pname);
+	strncpy(pname, name, 8);
+	return W_LookupLumpName(pname) != LUMPERROR;
 }
 
 size_t W_LumpLengthPwad(UINT16 wad, UINT16 lump)
@@ -1191,8 +1873,282 @@ static void ErrorIfPNG(UINT8 *d, size_t s, char *f, char *l)
 }
 #endif
 
+// Compressed lumps are decompressed through a few resident buffers, so that
+// reading the header of a lump and then the rest of it doesn't decompress it
+// twice. DEFLATE lumps are only inflated as far as has been asked for, and
+// pick up where they left off when more is wanted.
+#define NUMDECOMPLUMPS 4
+#define DECOMPCHUNK (16<<10) // raw data read at a time while inflating
+#define DECOMPKEEPMAX (1<<20) // bigger buffers are let go after every read
+
+typedef struct
+{
+	UINT16 wad, lump;
+	UINT8 *data; // the lump, decompressed up to have; NULL if unused
+	size_t have, capacity;
+	UINT32 lastuse;
+#ifdef HAVE_ZLIB
+	z_stream strm; // open while a DEFLATE lump is partly inflated
+	boolean inflating;
+	size_t rawpos; // raw bytes given to strm so far
+#endif
+} decomplump_t;
+
+static decomplump_t decomplumps[NUMDECOMPLUMPS];
+static UINT32 decompticks;
+static UINT8 *decompraw; // scratch for raw data when the file isn't mapped
+static size_t decomprawsize;
+
+// Gets raw file data, straight from the mapping if possible.
+static const UINT8 *W_GetRawData(wadfile_t *wadfile, size_t position, size_t size)
+{
+	if (wadfile->mapping && position + size <= wadfile->filesize)
+		return wadfile->mapping + position;
+
+	if (size > decomprawsize)
+	{
+		Z_Free(decompraw);
+		decomprawsize = max(size, DECOMPCHUNK);
+		decompraw = Z_Malloc(decomprawsize, PU_STATIC, NULL);
+	}
+	if (W_ReadFileData(wadfile, position, decompraw, size) < size)
+		return NULL;
+	return decompraw;
+}
+
+static void W_DropDecompLump(decomplump_t *d)
+{
+#ifdef HAVE_ZLIB
+	if (d->inflating)
+		(void)inflateEnd(&d->strm);
+	d->inflating = false;
+#endif
+	Z_Free(d->data);
+	d->data = NULL;
+	d->have = d->capacity = 0;
+}
+
+// Forgets every decompressed lump, such as when files go away.
+static void W_FlushDecompLumps(void)
+{
+	size_t i;
+
+	for (i = 0; i < NUMDECOMPLUMPS; i++)
+		W_DropDecompLump(&decomplumps[i]);
+	Z_Free(decompraw);
+	decompraw = NULL;
+	decomprawsize = 0;
+}
+
+// Makes room for at least need bytes in d, keeping what it holds.
+// DEFLATE buffers grow with what is asked for, so that reading the
+// header of a big lump doesn't allocate all of it.
+static void W_GrowDecompLump(decomplump_t *d, size_t need, size_t lumpsize)
+{
+	if (d->capacity >= need)
+		return;
+	need = max(need, min(lumpsize, max(d->capacity * 2, DECOMPCHUNK)));
+	d->data = Z_Realloc(d->data, need, PU_STATIC, NULL);
+	d->capacity = need;
+}
+
+#ifdef ZWAD
+// Decompresses a whole LZF lump into out.
+static void W_DecompressLZF(UINT16 wad, UINT16 lump, UINT8 *out)
+{
+	const lumpinfo_t *l = &wadfiles[wad]->lumpinfo[lump];
+	const UINT8 *rawData = W_GetRawData(wadfiles[wad], l->position, l->disksize);
+	size_t retval; // Helper var, lzf_decompress returns 0 when an error occurs.
+
+	if (!rawData)
+		I_Error("wad %d, lump %d: cannot read compressed data", wad, lump);
+	retval = lzf_decompress(rawData, l->disksize, out, l->size);
+#ifndef AVOID_ERRNO
+	if (retval == 0) // If this was returned, check if errno was set
+	{
+		// errno is a global var set by the lzf functions when something goes wrong.
+		if (errno == E2BIG)
+			I_Error("wad %d, lump %d: compressed data too big (bigger than %s)", wad, lump, sizeu1(l->size));
+		else if (errno == EINVAL)
+			I_Error("wad %d, lump %d: invalid compressed data", wad, lump);
+	}
+	// Otherwise, fall back on below error (if zero was actually the correct size then ???)
+#endif
+	if (retval != l->size)
+	{
+		I_Error("wad %d, lump %d: decompressed to wrong number of bytes (expected %s, got %s)", wad, lump, sizeu1(l->size), sizeu2(retval));
+	}
+}
+#endif
+
+#ifdef HAVE_ZLIB
+// Inflates a DEFLATE lump into out until it holds want bytes, reading the
+// raw data a chunk at a time. *have and *rawpos say how far strm got, and
+// are updated. Returns false on bad data.
+static boolean W_InflateLump(UINT16 wad, UINT16 lump, z_stream *strm, size_t *rawpos, UINT8 *out, size_t *have, size_t want)
+{
+	const lumpinfo_t *l = &wadfiles[wad]->lumpinfo[lump];
+	const UINT8 *raw;
+	size_t chunk;
+	int zErr = Z_OK;
+
+	strm->next_out = out + *have;
+	strm->avail_out = (uInt)(want - *have);
+
+	while (strm->avail_out)
+	{
+		if (!strm->avail_in)
+		{
+			chunk = min(l->disksize - *rawpos, DECOMPCHUNK);
+			if (!chunk)
+				break;
+			raw = W_GetRawData(wadfiles[wad], l->position + *rawpos, chunk);
+			if (!raw)
+				I_Error("wad %d, lump %d: cannot read compressed data", wad, lump);
+			strm->next_in = raw;
+			strm->avail_in = (uInt)chunk;
+			*rawpos += chunk;
+		}
+
+		zErr = inflate(strm, Z_NO_FLUSH);
+		if (zErr != Z_OK)
+			break;
+	}
+
+	// Whatever was left unused might not stay where it is.
+	*rawpos -= strm->avail_in;
+	strm->avail_in = 0;
+	*have = want - strm->avail_out;
+
+	if (zErr != Z_OK && zErr != Z_STREAM_END)
+	{
+		zerr(zErr);
+		return false;
+	}
+	return (*have == want);
+}
+#endif
+
+// Reads size bytes at offset from a compressed lump.
+// Returns the number of bytes read.
+static size_t W_ReadCompressedLump(UINT16 wad, UINT16 lump, void *dest, size_t size, size_t offset)
+{
+	const lumpinfo_t *l = &wadfiles[wad]->lumpinfo[lump];
+	const size_t want = offset + size;
+	decomplump_t *d = NULL;
+	size_t i;
+
+	for (i = 0; i < NUMDECOMPLUMPS; i++)
+	{
+		if (decomplumps[i].data && decomplumps[i].wad == wad && decomplumps[i].lump == lump)
+		{
+			d = &decomplumps[i];
+			break;
+		}
+	}
+
+	// Nobody has started on this one and it is wanted whole, so there is
+	// nothing to keep around: decompress it right where it goes.
+	if (!d && !offset && size == l->size)
+	{
+#ifdef HAVE_ZLIB
+		if (l->compression == CM_DEFLATE)
+		{
+			z_stream strm;
+			size_t rawpos = 0, have = 0;
+			boolean ok;
+
+			memset(&strm, 0, sizeof strm);
+			if (inflateInit2(&strm, -15) != Z_OK)
+				return 0;
+			ok = W_InflateLump(wad, lump, &strm, &rawpos, dest, &have, size);
+			(void)inflateEnd(&strm);
+			return ok ? size : 0;
+		}
+#endif
+#ifdef ZWAD
+		W_DecompressLZF(wad, lump, dest);
+		return size;
+#endif
+	}
+
+	if (!d)
+	{
+		// Take over the least recently used buffer.
+		d = &decomplumps[0];
+		for (i = 1; i < NUMDECOMPLUMPS; i++)
+			if (!decomplumps[i].data || (d->data && (INT32)(decomplumps[i].lastuse - d->lastuse) < 0))
+				d = &decomplumps[i];
+
+#ifdef HAVE_ZLIB
+		if (d->inflating)
+			(void)inflateEnd(&d->strm);
+		d->inflating = false;
+#endif
+#ifdef HAVE_ZLIB
+		if (l->compression == CM_DEFLATE)
+			W_GrowDecompLump(d, want, l->size);
+		else
+#endif
+			W_GrowDecompLump(d, l->size, l->size);
+		d->wad = wad;
+		d->lump = lump;
+		d->have = 0;
+
+#ifdef HAVE_ZLIB
+		if (l->compression == CM_DEFLATE)
+		{
+			memset(&d->strm, 0, sizeof d->strm);
+			if (inflateInit2(&d->strm, -15) != Z_OK)
+			{
+				W_DropDecompLump(d);
+				return 0;
+			}
+			d->inflating = true;
+			d->rawpos = 0;
+		}
+		else
+#endif
+		{
+#ifdef ZWAD
+			W_DecompressLZF(wad, lump, d->data);
+			d->have = l->size;
+#endif
+		}
+	}
+	d->lastuse = ++decompticks;
+
+#ifdef HAVE_ZLIB
+	if (d->have < want && d->inflating)
+	{
+		W_GrowDecompLump(d, want, l->size);
+		if (!W_InflateLump(wad, lump, &d->strm, &d->rawpos, d->data, &d->have, want))
+		{
+			W_DropDecompLump(d);
+			return 0;
+		}
+		if (d->have == l->size)
+		{
+			(void)inflateEnd(&d->strm);
+			d->inflating = false;
+		}
+	}
+#endif
+	if (d->have < want)
+	{
+		W_DropDecompLump(d);
+		return 0;
+	}
+
+	M_Memcpy(dest, d->data + offset, size);
+	if (d->capacity > DECOMPKEEPMAX)
+		W_DropDecompLump(d);
+	return size;
+}
+
 /** Reads bytes from the head of a lump.
-  * Note: If the lump is compressed, the whole thing has to be read anyway.
+  * Note: A DEFLATE lump is only inflated as far as the bytes asked for,
+  *       but an LZF one is always decompressed whole.
   *
   * \param wad Wad number to read from.
   * \param lump Lump number to read from.
@@ -1206,7 +2162,7 @@ size_t W_ReadLumpHeaderPwad(UINT16 wad, UINT16 lump, void *dest, size_t size, si
 {
 	size_t lumpsize;
 	lumpinfo_t *l;
-	FILE *handle;
+	wadfile_t *wadfile;
 
 	if (!TestValidLump(wad,lump))
 		return 0;
@@ -1222,9 +2178,8 @@ size_t W_ReadLumpHeaderPwad(UINT16 wad, UINT16 lump, void *dest, size_t size, si
 
 	// Let's get the raw lump data.
 	// We setup the desired file handle to read the lump data.
-	l = wadfiles[wad]->lumpinfo + lump;
-	handle = wadfiles[wad]->handle;
-	fseek(handle, (long)(l->position + offset), SEEK_SET);
+	wadfile = wadfiles[wad];
+	l = wadfile->lumpinfo + lump;
 
 	// But let's not copy it yet. We support different compression formats on lumps, so we need to take that into account.
 	switch(wadfiles[wad]->lumpinfo[lump].compression)
@@ -1232,115 +2187,26 @@ size_t W_ReadLumpHeaderPwad(UINT16 wad, UINT16 lump, void *dest, size_t size, si
 	case CM_NOCOMPRESSION:		// If it's uncompressed, we directly write the data into our destination, and return the bytes read.
 #ifdef NO_PNG_LUMPS
 		{
-			size_t bytesread = fread(dest, 1, size, handle);
+			size_t bytesread = W_ReadFileData(wadfile, l->position + offset, dest, size);
 			ErrorIfPNG(dest, bytesread, wadfiles[wad]->filename, l->name2);
 			return bytesread;
 		}
 #else
-		return fread(dest, 1, size, handle);
+		return W_ReadFileData(wadfile, l->position + offset, dest, size);
 #endif
 	case CM_LZF:		// Is it LZF compressed? Used by ZWADs.
-		{
-#ifdef ZWAD
-			char *rawData; // The lump's raw data.
-			char *decData; // Lump's decompressed real data.
-			size_t retval; // Helper var, lzf_decompress returns 0 when an error occurs.
-
-			rawData = Z_Malloc(l->disksize, PU_STATIC, NULL);
-			decData = Z_Malloc(l->size, PU_STATIC, NULL);
-
-			if (fread(rawData, 1, l->disksize, handle) < l->disksize)
-				I_Error("wad %d, lump %d: cannot read compressed data", wad, lump);
-			retval = lzf_decompress(rawData, l->disksize, decData, l->size);
-#ifndef AVOID_ERRNO
-			if (retval == 0) // If this was returned, check if errno was set
-			{
-				// errno is a global var set by the lzf functions when something goes wrong.
-				if (errno == E2BIG)
-					I_Error("wad %d, lump %d: compressed data too big (bigger than %s)", wad, lump, sizeu1(l->size));
-				else if (errno == EINVAL)
-					I_Error("wad %d, lump %d: invalid compressed data", wad, lump);
-			}
-			// Otherwise, fall back on below error (if zero was actually the correct size then ???)
-#endif
-			if (retval != l->size)
-			{
-				I_Error("wad %d, lump %d: decompressed to wrong number of bytes (expected %s, got %s)", wad, lump, sizeu1(l->size), sizeu2(retval));
-			}
-
-			if (!decData) // Did we get no data at all?
-				return 0;
-			M_Memcpy(dest, decData + offset, size);
-			Z_Free(rawData);
-			Z_Free(decData);
-#ifdef NO_PNG_LUMPS
-			ErrorIfPNG(dest, size, wadfiles[wad]->filename, l->name2);
-#endif
-			return size;
-#else
-			//I_Error("ZWAD files not supported on this platform.");
-			return 0;
+#ifndef ZWAD
+		//I_Error("ZWAD files not supported on this platform.");
+		return 0;
 #endif
-
-		}
 #ifdef HAVE_ZLIB
 	case CM_DEFLATE: // Is it compressed via DEFLATE? Very common in ZIPs/PK3s, also what most doom-related editors support.
-		{
-			UINT8 *rawData; // The lump's raw data.
-			UINT8 *decData; // Lump's decompressed real data.
-
-			int zErr; // Helper var.
-			z_stream strm;
-			unsigned long rawSize = l->disksize;
-			unsigned long decSize = l->size;
-
-			rawData = Z_Malloc(rawSize, PU_STATIC, NULL);
-			decData = Z_Malloc(decSize, PU_STATIC, NULL);
-
-			if (fread(rawData, 1, rawSize, handle) < rawSize)
-				I_Error("wad %d, lump %d: cannot read compressed data", wad, lump);
-
-			strm.zalloc = Z_NULL;
-			strm.zfree = Z_NULL;
-			strm.opaque = Z_NULL;
-
-			strm.total_in = strm.avail_in = rawSize;
-			strm.total_out = strm.avail_out = decSize;
-
-			strm.next_in = rawData;
-			strm.next_out = decData;
-
-			zErr = inflateInit2(&strm, -15);
-			if (zErr == Z_OK)
-			{
-				zErr = inflate(&strm, Z_FINISH);
-				if (zErr == Z_STREAM_END)
-				{
-					M_Memcpy(dest, decData, size);
-				}
-				else
-				{
-					size = 0;
-					zerr(zErr);
-				}
-				(void)inflateEnd(&strm);
-			}
-			else
-			{
-				CONS_Printf("whopet\n");
-				size = 0;
-				zerr(zErr);
-			}
-
-			Z_Free(rawData);
-			Z_Free(decData);
-
-#ifdef NO_PNG_LUMPS
-			ErrorIfPNG(dest, size, wadfiles[wad]->filename, l->name2);
 #endif
-			return size;
-		}
+		size = W_ReadCompressedLump(wad, lump, dest, size, offset);
+#ifdef NO_PNG_LUMPS
+		ErrorIfPNG(dest, size, wadfiles[wad]->filename, l->name2);
 #endif
+		return size;
 	default:
 		I_Error("wad %d, lump %d: unsupported compression type!", wad, lump);
 	}
@@ -1382,11 +2248,29 @@ void *W_CacheLumpNumPwad(UINT16 wad, UINT16 lump, INT32 tag)
 	lumpcache = wadfiles[wad]->lumpcache;
 	if (!lumpcache[lump])
 	{
-		void *ptr = Z_Malloc(W_LumpLengthPwad(wad, lump), tag, &lumpcache[lump]);
-		W_ReadLumpHeaderPwad(wad, lump, ptr, 0, 0);  // read the lump in full
+		void *ptr = NULL;
+#ifdef HAVE_MMAP
+		lumpinfo_t *l = &wadfiles[wad]->lumpinfo[lump];
+
+		if (wadfiles[wad]->mapping && l->compression == CM_NOCOMPRESSION && l->size >= MAPLUMPMINSIZE)
+			ptr = W_MapLump(wadfiles[wad], lump, tag, &lumpcache[lump]);
+#ifdef NO_PNG_LUMPS
+		if (ptr)
+			ErrorIfPNG(ptr, l->size, wadfiles[wad]->filename, l->name2);
+#endif
+#endif
+		if (!ptr)
+		{
+			ptr = Z_Malloc(W_LumpLengthPwad(wad, lump), tag, &lumpcache[lump]);
+			W_ReadLumpHeaderPwad(wad, lump, ptr, 0, 0);  // read the lump in full
+		}
+		zcachestats.misses++;
 	}
 	else
-		Z_ChangeTag(lumpcache[lump], tag);
+	{
+		Z_ChangeTag(lumpcache[lump], tag); // also marks it as recently used
+		zcachestats.hits++;
+	}
 
 	return lumpcache[lump];
 }
@@ -1492,12 +2376,15 @@ static inline void *W_CachePatchNumPwad(UINT16 wad, UINT16 lump, INT32 tag)
 	{
 		if (tag == PU_CACHE)
 			tag = PU_HWRCACHE;
-		Z_ChangeTag(grPatch->mipmap->grInfo.data, tag);
+		Z_ChangeTag(grPatch->mipmap->grInfo.data, tag); // also marks it as recently used
+		zcachestats.hits++;
 	}
 	else
 	{
 		patch_t *ptr = NULL;
 
+		zcachestats.misses++;
+
 		// Only load the patch if we haven't initialised the grPatch yet
 		if (grPatch->mipmap->width == 0)
 			ptr = W_CacheLumpNumPwad(grPatch->wadnum, grPatch->lumpnum, PU_STATIC);
@@ -108,7 +108,14 @@ typedef struct wadfile_s
 	aatree_t *hwrcache; // patches are cached in renderer's native format
 #endif
 	UINT16 numlumps; // this wad's number of resources
+	UINT16 *lumphash; // first lump of each lump name hash chain
+	UINT16 *lumpnext; // next lump in the same chain, in ascending order
+	UINT32 lumphashmask;
+	UINT16 *pathorder; // PK3 only: lumps sorted by full name, case insensitively
+	struct lumpfolder_s *folders; // PK3 only: every folder, sorted the same way
+	UINT16 numfolders;
 	FILE *handle;
+	UINT8 *mapping; // the whole file, if it could be mapped
 	UINT32 filesize; // for network
 	UINT8 md5sum[16];
 	boolean important;
@@ -144,6 +151,7 @@ UINT16 W_CheckNumForNamePwad(const char *name, UINT16 wad, UINT16 startlump); //
 UINT16 W_CheckNumForFullNamePK3(const char *name, UINT16 wad, UINT16 startlump);
 UINT16 W_CheckNumForFolderStartPK3(const char *name, UINT16 wad, UINT16 startlump);
 UINT16 W_CheckNumForFolderEndPK3(const char *name, UINT16 wad, UINT16 startlump);
+void Command_BenchLookups_f(void);
 
 lumpnum_t W_CheckNumForMap(const char *name);
 lumpnum_t W_CheckNumForName(const char *name);
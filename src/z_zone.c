@@ -24,6 +24,13 @@
 ///        caught with this direct-malloc version. We also suspected that SRB2's
 ///        allocator was fragmenting badly. Finally, this version is a bit
 ///        simpler (about half the lines of code).
+///
+///        By default, small blocks are now carved out of size-class slabs
+///        rather than malloc()ed one by one, with the block descriptor and the
+///        payload sharing a single slot. Level data gets its own slabs so that
+///        they can be handed back to the system in bulk at level change.
+///        The direct-malloc version can still be selected with
+///        "-zonebackend malloc".
 
 #include "doomdef.h"
 #include "doomstat.h"
@@ -31,12 +38,25 @@
 #include "i_video.h" // rendermode
 #include "z_zone.h"
 #include "m_misc.h" // M_Memcpy
+#include "m_argv.h" // -zonebackend
+#include "command.h" // cv_zonebudget
+#include "d_main.h" // srb2home
 #include "lua_script.h"
 
 #ifdef HWRENDER
 #include "hardware/hw_main.h" // For hardware memory info
 #endif
 
+#if defined (_MSC_VER)
+#include <intrin.h>
+#pragma intrinsic(_ReturnAddress)
+#define Z_CALLER() _ReturnAddress()
+#elif defined (__GNUC__)
+#define Z_CALLER() __builtin_return_address(0)
+#else
+#define Z_CALLER() NULL
+#endif
+
 #ifdef HAVE_VALGRIND
 #include "valgrind.h"
 static boolean Z_calloc = false;
@@ -50,6 +70,7 @@ static boolean Z_calloc = false;
 #endif
 
 struct memblock_s;
+struct zslab_s;
 
 typedef struct
 {
@@ -74,6 +95,12 @@ typedef struct memblock_s
 	size_t size; // including the header and blocks
 	size_t realsize; // size of real data only
 
+	struct zslab_s *slab; // slab this block was carved from, if any
+	zrelease_t release; // gives back real, for Z_Adopt blocks
+	UINT32 lastuse; // zusetick when last allocated or retagged
+
+	UINT16 profsite, profgen; // memprofile entry (0 = none) and session
+
 #ifdef ZDEBUG
 	const char *ownerfile;
 	INT32 ownerline;
@@ -131,9 +158,359 @@ static memblock_t *Ptr2Memblock(void *ptr, const char* func)
 
 }
 
-static memblock_t head;
+// Blocks are kept in one list per tag, so freeing or measuring a range of
+// tags only ever touches the blocks concerned. Any tag at or above
+// NUMZTAGS shares the last list, which has to be filtered by tag.
+#define NUMZTAGS 128
+
+static memblock_t heads[NUMZTAGS+1];
+static size_t ztagbytes[NUMZTAGS+1];
+static size_t ztagblocks[NUMZTAGS+1];
+static size_t ztagpeak[NUMZTAGS+1]; // high-water marks of ztagbytes
+static size_t zheapbytes, zheappeak;
+static size_t zmappedbytes, zmappedblocks; // Z_Adopt blocks, kept out of the above
+
+// Every list is kept most recently used first, which for the purgable
+// tags makes the tail of each list its least recently used block.
+static UINT32 zusetick;
+
+zcachestats_t zcachestats;
+
+static CV_PossibleValue_t zonebudget_cons_t[] = {{0, "MIN"}, {65535, "MAX"}, {0, NULL}};
+consvar_t cv_zonebudget = {"zonebudget", "0", CV_SAVE, zonebudget_cons_t, NULL, 0, NULL, NULL, 0, 0, NULL};
+
+static inline INT32 Z_TagList(INT32 tag)
+{
+	return (tag >= 0 && tag < NUMZTAGS) ? tag : NUMZTAGS;
+}
+
+// What a block takes from the heap. A Z_Adopt block's data is a file
+// mapping, whose pages the system can drop by itself, so only its
+// memblock_t counts towards the heap and cv_zonebudget.
+static inline size_t Z_HeapBytes(const memblock_t *block)
+{
+	return (block->release ? 0 : block->size) + sizeof *block;
+}
+
+static void Z_LinkBlock(memblock_t *block)
+{
+	const INT32 list = Z_TagList(block->tag);
+	memblock_t *head = &heads[list];
+
+	block->next = head->next;
+	block->prev = head;
+	head->next = block;
+	block->next->prev = block;
+	block->lastuse = ++zusetick;
+
+	ztagbytes[list] += Z_HeapBytes(block);
+	ztagblocks[list]++;
+	if (ztagbytes[list] > ztagpeak[list])
+		ztagpeak[list] = ztagbytes[list];
+
+	zheapbytes += Z_HeapBytes(block);
+	if (zheapbytes > zheappeak)
+		zheappeak = zheapbytes;
+
+	if (block->release)
+	{
+		zmappedbytes += block->size;
+		zmappedblocks++;
+	}
+}
+
+static void Z_UnlinkBlock(memblock_t *block)
+{
+	const INT32 list = Z_TagList(block->tag);
+
+	block->prev->next = block->next;
+	block->next->prev = block->prev;
+
+	ztagbytes[list] -= Z_HeapBytes(block);
+	ztagblocks[list]--;
+	zheapbytes -= Z_HeapBytes(block);
+
+	if (block->release)
+	{
+		zmappedbytes -= block->size;
+		zmappedblocks--;
+	}
+}
+
+// --------------------------------------------------------------------------
+// Allocation profiler
+// --------------------------------------------------------------------------
+
+// While "memprofile start" is in effect, every allocation is charged to
+// its call site (the return address of Z_Malloc and friends) and tag, in
+// an open addressing hash table. The last entry takes whatever doesn't fit.
+#define ZPROFSITES 4096 // must be a power of two
+
+typedef struct
+{
+	void *site;
+	INT32 tag;
+	size_t live, peak, total; // bytes
+	UINT32 blocks, allocs;
+} zprofsite_t;
+
+static zprofsite_t *zprofsites; // ZPROFSITES+1 entries, kept after a stop for dumping
+static boolean zprofiling;
+static UINT16 zprofgen; // bumped by every start, so blocks from earlier sessions are ignored
+
+// Set by the Z_Calloc/Z_Realloc wrappers so that Z_Malloc doesn't
+// mistake them for the call site.
+static void *zcaller;
+
+static void Z_ProfileAlloc(memblock_t *block, void *site)
+{
+	size_t i = (((size_t)site >> 2) ^ ((size_t)block->tag * 2654435761u)) & (ZPROFSITES-1);
+	size_t probes;
+	zprofsite_t *entry = &zprofsites[ZPROFSITES];
+
+	for (probes = 0; probes < 32; probes++, i = (i + 1) & (ZPROFSITES-1))
+	{
+		// Free slots are told apart by their count, not the site:
+		// without Z_CALLER every site is NULL, one slot per tag then
+		if (!zprofsites[i].allocs)
+		{
+			zprofsites[i].site = site;
+			zprofsites[i].tag = block->tag;
+		}
+		if (zprofsites[i].site == site && zprofsites[i].tag == block->tag)
+		{
+			entry = &zprofsites[i];
+			break;
+		}
+	}
+
+	entry->live += block->size + sizeof *block;
+	entry->total += block->size + sizeof *block;
+	entry->blocks++;
+	entry->allocs++;
+	if (entry->live > entry->peak)
+		entry->peak = entry->live;
+
+	block->profsite = (UINT16)(entry - zprofsites + 1);
+	block->profgen = zprofgen;
+}
+
+static void Z_ProfileFree(memblock_t *block)
+{
+	zprofsite_t *entry = &zprofsites[block->profsite - 1];
+
+	entry->live -= block->size + sizeof *block;
+	entry->blocks--;
+}
+
+// --------------------------------------------------------------------------
+// Slab backend
+// --------------------------------------------------------------------------
+
+typedef enum
+{
+	ZB_MALLOC, // one malloc() for the memblock_t, another for the data
+	ZB_SLAB, // size-class slabs, one allocation per block
+} zonebackend_t;
+
+static zonebackend_t zonebackend = ZB_SLAB;
+
+// Blocks (memblock_t + header + data) up to ZSLABMAXSIZE bytes are put in
+// slots of the smallest class that fits. Anything bigger gets a malloc() of
+// its own, but still only one.
+#define ZSLABSIZE (64<<10)
+#define ZSLABMAXSIZE 8192
+#define ZCLASSSHIFT 5 // every class size is a multiple of 32
+
+static const UINT16 zclasssizes[] =
+{
+	  64,   96,  128,  192,  256,  384,  512,  768,
+	1024, 1536, 2048, 3072, 4096, 6144, 8192,
+};
+
+#define NUMZCLASSES (sizeof zclasssizes / sizeof *zclasssizes)
+
+static UINT8 zclassof[ZSLABMAXSIZE>>ZCLASSSHIFT]; // (size-1)>>ZCLASSSHIFT -> class
+
+// Tags in PU_LEVEL .. PU_PURGELEVEL-1 come out of their own set of slabs,
+// which are released all at once when the level is freed.
+typedef enum
+{
+	ZA_GENERAL,
+	ZA_LEVEL,
+	NUMZARENAS
+} zarena_t;
+
+typedef struct zslot_s
+{
+	struct zslot_s *next;
+} zslot_t;
+
+typedef struct zslab_s
+{
+	struct zslab_s *next, *prev; // in zpartial
+	zslot_t *freeslots; // slots given back by Z_Free
+	UINT8 *unused; // next slot that was never handed out
+	UINT16 live, capacity;
+	UINT8 zclass, arena;
+} zslab_t;
+
+// Slabs with at least one free slot, per arena and size class.
+// Full slabs aren't linked anywhere; Z_Free puts them back.
+static zslab_t *zpartial[NUMZARENAS][NUMZCLASSES];
+static size_t zslabpages[NUMZARENAS];
+static size_t zslablive[NUMZARENAS];
+
+#define ZSLABHEADER ((sizeof (zslab_t) + 15) & ~(size_t)15)
+
+static void *xm(size_t size);
+
+static inline zarena_t Z_ArenaForTag(INT32 tag)
+{
+	return (tag >= PU_LEVEL && tag < PU_PURGELEVEL) ? ZA_LEVEL : ZA_GENERAL;
+}
+
+static void Z_LinkSlab(zslab_t *slab)
+{
+	zslab_t **list = &zpartial[slab->arena][slab->zclass];
+
+	slab->prev = NULL;
+	slab->next = *list;
+	if (*list)
+		(*list)->prev = slab;
+	*list = slab;
+}
+
+static void Z_UnlinkSlab(zslab_t *slab)
+{
+	if (slab->prev)
+		slab->prev->next = slab->next;
+	else
+		zpartial[slab->arena][slab->zclass] = slab->next;
+	if (slab->next)
+		slab->next->prev = slab->prev;
+	slab->next = slab->prev = NULL;
+}
+
+static zslab_t *Z_NewSlab(zarena_t arena, UINT8 zclass)
+{
+	zslab_t *slab = xm(ZSLABSIZE);
+
+	slab->freeslots = NULL;
+	slab->unused = (UINT8 *)slab + ZSLABHEADER;
+	slab->live = 0;
+	slab->capacity = (UINT16)((ZSLABSIZE - ZSLABHEADER) / zclasssizes[zclass]);
+	slab->zclass = zclass;
+	slab->arena = (UINT8)arena;
+
+	Z_LinkSlab(slab);
+	zslabpages[arena]++;
+
+	return slab;
+}
+
+static void Z_FreeSlab(zslab_t *slab)
+{
+	Z_UnlinkSlab(slab);
+	zslabpages[slab->arena]--;
+	free(slab);
+}
+
+/** Gets memory for a block from the slab backend.
+  * \param size Bytes needed, including the memblock_t.
+  * \param tag Purge tag of the block, which picks the arena.
+  * \param slabp Set to the slab the memory came from, or NULL if it
+  *        was too big for any size class and was malloc()ed directly.
+  */
+static void *Z_SlabAlloc(size_t size, INT32 tag, zslab_t **slabp)
+{
+	zarena_t arena;
+	UINT8 zclass;
+	zslab_t *slab;
+	zslot_t *slot;
+
+	if (size > ZSLABMAXSIZE)
+	{
+		*slabp = NULL;
+		return xm(size);
+	}
+
+	arena = Z_ArenaForTag(tag);
+	zclass = zclassof[(size - 1)>>ZCLASSSHIFT];
+
+	slab = zpartial[arena][zclass];
+	if (slab == NULL)
+		slab = Z_NewSlab(arena, zclass);
+
+	if (slab->freeslots)
+	{
+		slot = slab->freeslots;
+		slab->freeslots = slot->next;
+	}
+	else
+	{
+		slot = (zslot_t *)slab->unused;
+		slab->unused += zclasssizes[zclass];
+	}
+
+	if (++slab->live == slab->capacity)
+		Z_UnlinkSlab(slab);
+
+	zslablive[arena]++;
+	*slabp = slab;
+	return slot;
+}
+
+static void Z_SlabFree(memblock_t *block)
+{
+	zslab_t *slab = block->slab;
+	zslot_t *slot = block->real; // start of the slot
+
+	if (slab->live-- == slab->capacity)
+		Z_LinkSlab(slab); // was full, can take blocks again
+
+	slot->next = slab->freeslots;
+	slab->freeslots = slot;
+	zslablive[slab->arena]--;
+
+	// Level slabs are kept until the level is over. Elsewhere, give
+	// empty slabs back unless it's the only one left in its class.
+	if (slab->live == 0 && slab->arena != ZA_LEVEL
+		&& (slab->next || slab->prev))
+		Z_FreeSlab(slab);
+}
+
+/** Gives every empty slab in an arena back to the system. If nothing in
+  * the arena is live anymore, that is all of them.
+  */
+static void Z_ReleaseArena(zarena_t arena)
+{
+	zslab_t *slab, *next;
+	size_t i;
+
+	for (i = 0; i < NUMZCLASSES; i++)
+		for (slab = zpartial[arena][i]; slab; slab = next)
+		{
+			next = slab->next;
+			if (slab->live == 0)
+				Z_FreeSlab(slab);
+		}
+}
+
+static void Z_InitSlabs(void)
+{
+	size_t i, zclass = 0;
+
+	for (i = 0; i < sizeof zclassof; i++)
+	{
+		while (zclasssizes[zclass] < (i + 1)<<ZCLASSSHIFT)
+			zclass++;
+		zclassof[i] = (UINT8)zclass;
+	}
+}
 
 static void Command_Memfree_f(void);
+static void Command_Memprofile_f(void);
 #ifdef ZDEBUG
 static void Command_Memdump_f(void);
 #endif
@@ -141,16 +518,40 @@ static void Command_Memdump_f(void);
 void Z_Init(void)
 {
 	UINT32 total, memfree;
+	INT32 i;
+
+	memset(heads, 0x00, sizeof(heads));
+
+	for (i = 0; i <= NUMZTAGS; i++)
+		heads[i].next = heads[i].prev = &heads[i];
 
-	memset(&head, 0x00, sizeof(head));
+	if (M_CheckParm("-zonebackend") && M_IsNextParm())
+	{
+		const char *backend = M_GetNextParm();
+
+		if (!stricmp(backend, "malloc"))
+			zonebackend = ZB_MALLOC;
+		else if (!stricmp(backend, "slab"))
+			zonebackend = ZB_SLAB;
+		else
+			CONS_Alert(CONS_WARNING, "Unknown zone backend '%s'\n", backend);
+	}
+
+#ifdef HAVE_VALGRIND
+	// The mempool annotations assume every block is its own malloc
+	zonebackend = ZB_MALLOC;
+#endif
 
-	head.next = head.prev = &head;
+	if (zonebackend == ZB_SLAB)
+		Z_InitSlabs();
 
 	memfree = I_GetFreeMem(&total)>>20;
 	CONS_Printf("System memory: %uMB - Free: %uMB\n", total>>20, memfree);
 
 	// Note: This allocates memory. Watch out.
 	COM_AddCommand("memfree", Command_Memfree_f);
+	COM_AddCommand("memprofile", Command_Memprofile_f);
+	CV_RegisterVar(&cv_zonebudget);
 
 #ifdef ZDEBUG
 	COM_AddCommand("memdump", Command_Memdump_f);
@@ -196,16 +597,63 @@ void Z_Free(void *ptr)
 	if (block->user != NULL)
 		*block->user = NULL;
 
+	if (block->profsite && block->profgen == zprofgen)
+		Z_ProfileFree(block);
+
 	// Free the memory and get rid of the block.
-	free(block->real);
-	block->prev->next = block->next;
-	block->next->prev = block->prev;
-	free(block);
+	Z_UnlinkBlock(block);
+	if (block->slab)
+		Z_SlabFree(block);
+	else
+	{
+		if (block->release)
+			block->release(block->real, block->size);
+		else if (block->real != (void *)block)
+			free(block->real);
+		free(block);
+	}
 #ifdef VALGRIND_DESTROY_MEMPOOL
 	VALGRIND_DESTROY_MEMPOOL(block);
 #endif
 }
 
+/** Frees purgable blocks, least recently used first, across all the
+  * purgable tags.
+  * \param bytes How much memory to give back, at least.
+  * \return Bytes actually freed, which is less than asked for only if
+  *         there was nothing purgable left.
+  */
+static size_t Z_EvictLRU(size_t bytes)
+{
+	memblock_t *block, *oldest;
+	size_t freed = 0;
+	INT32 list;
+
+	while (freed < bytes)
+	{
+		oldest = NULL;
+
+		for (list = PU_PURGELEVEL; list <= NUMZTAGS; list++)
+		{
+			block = heads[list].prev;
+			if (block == &heads[list])
+				continue;
+			if (!oldest || (INT32)(block->lastuse - oldest->lastuse) < 0)
+				oldest = block;
+		}
+
+		if (!oldest)
+			break;
+
+		freed += Z_HeapBytes(oldest);
+		zcachestats.evictions++;
+		zcachestats.evictedbytes += Z_HeapBytes(oldest);
+		Z_Free((UINT8 *)oldest->hdr + sizeof *oldest->hdr);
+	}
+
+	return freed;
+}
+
 // malloc() that doesn't accept failure.
 static void *xm(size_t size)
 {
@@ -214,9 +662,10 @@ static void *xm(size_t size)
 
 	if (p == NULL)
 	{
-		// Oh crumbs: we're out of heap. Try purging the cache and reallocating.
-		Z_FreeTags(PU_PURGELEVEL, INT32_MAX);
-		p = malloc(padedsize);
+		// Oh crumbs: we're out of heap. Try purging the cache, oldest
+		// blocks first, until we can allocate again.
+		while (p == NULL && Z_EvictLRU(padedsize))
+			p = malloc(padedsize);
 
 		if (p == NULL)
 		{
@@ -249,16 +698,26 @@ void *Z_MallocAlign(size_t size, INT32 tag, void *user, INT32 alignbits)
 	memhdr_t *hdr;
 	void *given;
 	size_t blocksize = extrabytes + sizeof *hdr + size;
+	zslab_t *slab = NULL;
 
 #ifdef ZDEBUG2
 	CONS_Debug(DBG_MEMORY, "Z_Malloc %s:%d\n", file, line);
 #endif
 
-	block = xm(sizeof *block);
 #ifdef HAVE_VALGRIND
 	padsize += (1<<sizeof(size_t))*2;
 #endif
-	ptr = xm(blocksize + padsize*2);
+	if (zonebackend == ZB_SLAB)
+	{
+		// The memblock_t sits right in front of the data.
+		block = Z_SlabAlloc(sizeof *block + blocksize, tag, &slab);
+		ptr = (UINT8 *)block + sizeof *block;
+	}
+	else
+	{
+		block = xm(sizeof *block);
+		ptr = xm(blocksize + padsize*2);
+	}
 
 	// This horrible calculation makes sure that "given" is aligned
 	// properly.
@@ -276,12 +735,9 @@ void *Z_MallocAlign(size_t size, INT32 tag, void *user, INT32 alignbits)
 	VALGRIND_MEMPOOL_ALLOC(block, hdr, size + sizeof *hdr);
 #endif
 
-	block->next = head.next;
-	block->prev = &head;
-	head.next = block;
-	block->next->prev = block;
-
-	block->real = ptr;
+	block->real = (zonebackend == ZB_SLAB) ? (void *)block : ptr;
+	block->slab = slab;
+	block->release = NULL;
 	block->hdr = hdr;
 	block->tag = tag;
 	block->user = NULL;
@@ -292,6 +748,13 @@ void *Z_MallocAlign(size_t size, INT32 tag, void *user, INT32 alignbits)
 	block->size = blocksize;
 	block->realsize = size;
 
+	Z_LinkBlock(block);
+
+	block->profsite = 0;
+	if (zprofiling)
+		Z_ProfileAlloc(block, zcaller ? zcaller : Z_CALLER());
+	zcaller = NULL;
+
 	hdr->id = ZONEID;
 	hdr->block = block;
 
@@ -311,6 +774,74 @@ void *Z_MallocAlign(size_t size, INT32 tag, void *user, INT32 alignbits)
 	return given;
 }
 
+/** Puts memory that wasn't allocated by the zone under its management.
+  *
+  * \param real The memory as allocated, to be given to release.
+  * \param realsize How much of it there is.
+  * \param given The data inside it, with room for the block header in
+  *              real in front of it; ZADOPTROOM bytes is always enough.
+  * \param size Size of the data.
+  * \param tag Purge tag, as for Z_Malloc.
+  * \param user User pointer, as for Z_Malloc.
+  * \param release Gives real back once the block is freed or purged.
+  * \return given.
+  */
+void *Z_Adopt(void *real, size_t realsize, void *given, size_t size, INT32 tag, void *user, zrelease_t release)
+{
+	memhdr_t *hdr = (memhdr_t *)((UINT8 *)given - sizeof *hdr);
+	memblock_t *block;
+
+	if ((size_t)((UINT8 *)given - (UINT8 *)real) < sizeof *hdr)
+		I_Error("Z_Adopt: no room for the block header");
+	if (user == NULL && tag >= PU_PURGELEVEL)
+		I_Error("Z_Adopt: attempted to adopt purgable block "
+			"(size %s) with no user", sizeu1(size));
+
+	block = xm(sizeof *block);
+
+#ifdef VALGRIND_CREATE_MEMPOOL
+	VALGRIND_CREATE_MEMPOOL(block, 0, false);
+#endif
+#ifdef VALGRIND_MEMPOOL_ALLOC
+	VALGRIND_MEMPOOL_ALLOC(block, hdr, size + sizeof *hdr);
+#endif
+
+	block->real = real;
+	block->slab = NULL;
+	block->release = release;
+	block->hdr = hdr;
+	block->tag = tag;
+	block->user = NULL;
+#ifdef ZDEBUG
+	block->ownerline = __LINE__;
+	block->ownerfile = __FILE__;
+#endif
+	block->size = realsize;
+	block->realsize = size;
+
+	Z_LinkBlock(block);
+
+	block->profsite = 0;
+	if (zprofiling)
+		Z_ProfileAlloc(block, Z_CALLER());
+	zcaller = NULL;
+
+	hdr->id = ZONEID;
+	hdr->block = block;
+
+#ifdef VALGRIND_MAKE_MEM_NOACCESS
+	VALGRIND_MAKE_MEM_NOACCESS(hdr, sizeof *hdr);
+#endif
+
+	if (user != NULL)
+	{
+		block->user = user;
+		*(void **)user = given;
+	}
+
+	return given;
+}
+
 #ifdef ZDEBUG
 void *Z_Calloc2(size_t size, INT32 tag, void *user, INT32 alignbits, const char *file, INT32 line)
 #else
@@ -320,6 +851,8 @@ void *Z_CallocAlign(size_t size, INT32 tag, void *user, INT32 alignbits)
 #ifdef VALGRIND_MEMPOOL_ALLOC
 	Z_calloc = true;
 #endif
+	if (zprofiling && !zcaller)
+		zcaller = Z_CALLER();
 #ifdef ZDEBUG
 	return memset(Z_Malloc2    (size, tag, user, alignbits, file, line), 0, size);
 #else
@@ -347,6 +880,9 @@ void *Z_ReallocAlign(void *ptr, size_t size,INT32 tag, void *user,  INT32 alignb
 		return NULL;
 	}
 
+	if (zprofiling)
+		zcaller = Z_CALLER();
+
 	if (!ptr)
 	{
 #ifdef ZDEBUG
@@ -363,7 +899,10 @@ void *Z_ReallocAlign(void *ptr, size_t size,INT32 tag, void *user,  INT32 alignb
 #endif
 
 	if (block == NULL)
+	{
+		zcaller = NULL;
 		return NULL;
+	}
 
 #ifdef ZDEBUG
 	// Write every Z_Realloc call to a debug file.
@@ -397,59 +936,74 @@ void *Z_ReallocAlign(void *ptr, size_t size,INT32 tag, void *user,  INT32 alignb
 	return rez;
 }
 
+static void Z_CheckList(INT32 i, memblock_t *head, UINT32 *blocknumon);
+
 void Z_FreeTags(INT32 lowtag, INT32 hightag)
 {
-	memblock_t *block, *next;
+	memblock_t *block, *next, *head;
+	UINT32 blocknumon = 0;
+	INT32 list;
 
-	Z_CheckHeap(420);
-	for (block = head.next; block != &head; block = next)
+	for (list = 0; list <= NUMZTAGS; list++)
 	{
-		next = block->next; // get link before freeing
+		if (list < NUMZTAGS && (list < lowtag || list > hightag))
+			continue;
+
+		head = &heads[list];
+		Z_CheckList(420, head, &blocknumon);
+
+		for (block = head->next; block != head; block = next)
+		{
+			next = block->next; // get link before freeing
 
-		if (block->tag >= lowtag && block->tag <= hightag)
-			Z_Free((UINT8 *)block->hdr + sizeof *block->hdr);
+			if (block->tag >= lowtag && block->tag <= hightag)
+				Z_Free((UINT8 *)block->hdr + sizeof *block->hdr);
+		}
 	}
+
+	// Level slabs hold nothing worth keeping now, so let them all go.
+	if (zonebackend == ZB_SLAB && lowtag <= PU_LEVEL && hightag >= PU_PURGELEVEL-1)
+		Z_ReleaseArena(ZA_LEVEL);
 }
 
 //
 // Z_CheckMemCleanup
 //
-// TODO: Currently blocks >= PU_PURGELEVEL are freed every
-// CLEANUPCOUNT. It might be better to keep track of
-// the total size of all purgable memory and free it when the
-// size exceeds some value.
+// Keeps the heap within cv_zonebudget megabytes (if set) by
+// freeing the least recently used blocks >= PU_PURGELEVEL.
 //
 // This was in Z_Malloc, but was freeing data at
 // unsafe times. Now it is only called when it is safe
 // to cleanup memory.
-
-#define CLEANUPCOUNT 2000
-
-static INT32 nextcleanup = CLEANUPCOUNT;
-
+//
 void Z_CheckMemCleanup(void)
 {
-	if (nextcleanup-- == 0)
-	{
-		nextcleanup = CLEANUPCOUNT;
-		Z_FreeTags(PU_PURGELEVEL, INT32_MAX);
-	}
+	const size_t budget = (size_t)cv_zonebudget.value<<20;
+	size_t used;
+
+	if (!budget)
+		return;
+
+	used = Z_TagsUsage(0, INT32_MAX);
+	if (used > budget)
+		Z_EvictLRU(used - budget);
 }
 
 
-/** Checks the heap, as well as the memhdr_ts, for any corruption or
-  * other problems.
-  * \param i Identifies from where in the code Z_CheckHeap was called.
-  * \author Graue <graue@oceanbase.org>
+/** Checks one of the tag lists, as well as the memhdr_ts in it, for any
+  * corruption or other problems.
+  * \param i Identifies from where in the code the check was called.
+  * \param head Head of the list to check.
+  * \param blocknumon_p Running count of blocks checked, for the messages.
   */
-void Z_CheckHeap(INT32 i)
+static void Z_CheckList(INT32 i, memblock_t *head, UINT32 *blocknumon_p)
 {
 	memblock_t *block;
 	memhdr_t *hdr;
-	UINT32 blocknumon = 0;
+	UINT32 blocknumon = *blocknumon_p;
 	void *given;
 
-	for (block = head.next; block != &head; block = block->next)
+	for (block = head->next; block != head; block = block->next)
 	{
 		blocknumon++;
 		hdr = block->hdr;
@@ -540,6 +1094,22 @@ void Z_CheckHeap(INT32 i)
 	VALGRIND_MAKE_MEM_NOACCESS(hdr, sizeof *hdr);
 #endif
 	}
+
+	*blocknumon_p = blocknumon;
+}
+
+/** Checks the heap, as well as the memhdr_ts, for any corruption or
+  * other problems.
+  * \param i Identifies from where in the code Z_CheckHeap was called.
+  * \author Graue <graue@oceanbase.org>
+  */
+void Z_CheckHeap(INT32 i)
+{
+	UINT32 blocknumon = 0;
+	INT32 list;
+
+	for (list = 0; list <= NUMZTAGS; list++)
+		Z_CheckList(i, &heads[list], &blocknumon);
 }
 
 #ifdef PARANOIA
@@ -584,7 +1154,9 @@ void Z_ChangeTag2(void *ptr, INT32 tag)
 		I_Error("Internal memory management error: "
 			"tried to make block purgable but it has no owner");
 
+	Z_UnlinkBlock(block);
 	block->tag = tag;
+	Z_LinkBlock(block);
 }
 
 /** Calculates memory usage for a given set of tags.
@@ -598,13 +1170,18 @@ size_t Z_TagsUsage(INT32 lowtag, INT32 hightag)
 {
 	size_t cnt = 0;
 	memblock_t *rover;
+	INT32 list;
 
-	for (rover = head.next; rover != &head; rover = rover->next)
-	{
-		if (rover->tag < lowtag || rover->tag > hightag)
-			continue;
-		cnt += rover->size + sizeof *rover;
-	}
+	for (list = max(lowtag, 0); list <= hightag && list < NUMZTAGS; list++)
+		cnt += ztagbytes[list];
+
+	if (hightag >= NUMZTAGS || lowtag < 0)
+		for (rover = heads[NUMZTAGS].next; rover != &heads[NUMZTAGS]; rover = rover->next)
+		{
+			if (rover->tag < lowtag || rover->tag > hightag)
+				continue;
+			cnt += Z_HeapBytes(rover);
+		}
 
 	return cnt;
 }
@@ -614,21 +1191,69 @@ size_t Z_TagUsage(INT32 tagnum)
 	return Z_TagsUsage(tagnum, tagnum);
 }
 
+/** Counts the blocks allocated with a given set of tags.
+  * \param lowtag The lowest tag to consider.
+  * \param hightag The highest tag to consider.
+  * \return Number of blocks currently allocated with the given tags.
+  * \sa Z_TagsUsage
+  */
+size_t Z_TagsCount(INT32 lowtag, INT32 hightag)
+{
+	size_t cnt = 0;
+	memblock_t *rover;
+	INT32 list;
+
+	for (list = max(lowtag, 0); list <= hightag && list < NUMZTAGS; list++)
+		cnt += ztagblocks[list];
+
+	if (hightag >= NUMZTAGS || lowtag < 0)
+		for (rover = heads[NUMZTAGS].next; rover != &heads[NUMZTAGS]; rover = rover->next)
+		{
+			if (rover->tag < lowtag || rover->tag > hightag)
+				continue;
+			cnt++;
+		}
+
+	return cnt;
+}
+
+size_t Z_TagCount(INT32 tagnum)
+{
+	return Z_TagsCount(tagnum, tagnum);
+}
+
 void Command_Memfree_f(void)
 {
 	UINT32 freebytes, totalbytes;
 
 	Z_CheckHeap(-1);
 	CONS_Printf("\x82%s", M_GetText("Memory Info\n"));
-	CONS_Printf(M_GetText("Total heap used   : %7s KB\n"), sizeu1(Z_TagsUsage(0, INT32_MAX)>>10));
-	CONS_Printf(M_GetText("Static            : %7s KB\n"), sizeu1(Z_TagUsage(PU_STATIC)>>10));
-	CONS_Printf(M_GetText("Static (sound)    : %7s KB\n"), sizeu1(Z_TagUsage(PU_SOUND)>>10));
-	CONS_Printf(M_GetText("Static (music)    : %7s KB\n"), sizeu1(Z_TagUsage(PU_MUSIC)>>10));
-	CONS_Printf(M_GetText("Locked cache      : %7s KB\n"), sizeu1(Z_TagUsage(PU_CACHE)>>10));
-	CONS_Printf(M_GetText("Level             : %7s KB\n"), sizeu1(Z_TagUsage(PU_LEVEL)>>10));
-	CONS_Printf(M_GetText("Special thinker   : %7s KB\n"), sizeu1(Z_TagUsage(PU_LEVSPEC)>>10));
-	CONS_Printf(M_GetText("All purgable      : %7s KB\n"),
-		sizeu1(Z_TagsUsage(PU_PURGELEVEL, INT32_MAX)>>10));
+	CONS_Printf(M_GetText("Total heap used   : %7s KB (%s blocks)\n"), sizeu1(Z_TagsUsage(0, INT32_MAX)>>10), sizeu2(Z_TagsCount(0, INT32_MAX)));
+	CONS_Printf(M_GetText("Static            : %7s KB (%s blocks)\n"), sizeu1(Z_TagUsage(PU_STATIC)>>10), sizeu2(Z_TagCount(PU_STATIC)));
+	CONS_Printf(M_GetText("Static (sound)    : %7s KB (%s blocks)\n"), sizeu1(Z_TagUsage(PU_SOUND)>>10), sizeu2(Z_TagCount(PU_SOUND)));
+	CONS_Printf(M_GetText("Static (music)    : %7s KB (%s blocks)\n"), sizeu1(Z_TagUsage(PU_MUSIC)>>10), sizeu2(Z_TagCount(PU_MUSIC)));
+	CONS_Printf(M_GetText("Locked cache      : %7s KB (%s blocks)\n"), sizeu1(Z_TagUsage(PU_CACHE)>>10), sizeu2(Z_TagCount(PU_CACHE)));
+	CONS_Printf(M_GetText("Level             : %7s KB (%s blocks)\n"), sizeu1(Z_TagUsage(PU_LEVEL)>>10), sizeu2(Z_TagCount(PU_LEVEL)));
+	CONS_Printf(M_GetText("Special thinker   : %7s KB (%s blocks)\n"), sizeu1(Z_TagUsage(PU_LEVSPEC)>>10), sizeu2(Z_TagCount(PU_LEVSPEC)));
+	CONS_Printf(M_GetText("All purgable      : %7s KB (%s blocks)\n"),
+		sizeu1(Z_TagsUsage(PU_PURGELEVEL, INT32_MAX)>>10), sizeu2(Z_TagsCount(PU_PURGELEVEL, INT32_MAX)));
+
+	CONS_Printf(M_GetText("Mapped lumps      : %7s KB (%s blocks)\n"), sizeu1(zmappedbytes>>10), sizeu2(zmappedblocks));
+	CONS_Printf(M_GetText("Heap high-water   : %7s KB\n"), sizeu1(zheappeak>>10));
+	CONS_Printf(M_GetText("Cache hits        : %7s (%s misses)\n"), sizeu1(zcachestats.hits), sizeu2(zcachestats.misses));
+	CONS_Printf(M_GetText("Cache evictions   : %7s (%s KB)\n"), sizeu1(zcachestats.evictions), sizeu2(zcachestats.evictedbytes>>10));
+	if (cv_zonebudget.value)
+		CONS_Printf(M_GetText("Zone budget       : %7d MB\n"), cv_zonebudget.value);
+
+	if (zonebackend == ZB_SLAB)
+	{
+		CONS_Printf(M_GetText("Slab pages        : %7s KB (%s blocks)\n"),
+			sizeu1((zslabpages[ZA_GENERAL] * ZSLABSIZE)>>10), sizeu2(zslablive[ZA_GENERAL]));
+		CONS_Printf(M_GetText("Level slab pages  : %7s KB (%s blocks)\n"),
+			sizeu1((zslabpages[ZA_LEVEL] * ZSLABSIZE)>>10), sizeu2(zslablive[ZA_LEVEL]));
+	}
+	else
+		CONS_Printf("%s", M_GetText("Zone backend      : malloc\n"));
 
 #ifdef HWRENDER
 	if (rendermode != render_soft && rendermode != render_none)
@@ -646,12 +1271,114 @@ void Command_Memfree_f(void)
 	CONS_Printf(M_GetText("Available physical memory: %7u KB\n"), freebytes>>10);
 }
 
+static int Z_CompareProfSites(const void *a, const void *b)
+{
+	const zprofsite_t *x = *(const zprofsite_t * const *)a, *y = *(const zprofsite_t * const *)b;
+
+	if (x->live != y->live)
+		return (x->live < y->live) ? 1 : -1;
+	if (x->peak != y->peak)
+		return (x->peak < y->peak) ? 1 : -1;
+	return 0;
+}
+
+/** Writes what the profiler has gathered so far, as tab separated
+  * columns: first every call site, biggest live usage first, then the
+  * totals and high-water marks of every tag.
+  */
+static boolean Z_DumpProfile(const char *filename)
+{
+	zprofsite_t **sorted;
+	size_t i, numsites = 0;
+	INT32 list;
+	FILE *f = fopen(filename, "w");
+
+	if (!f)
+		return false;
+
+	sorted = malloc((ZPROFSITES+1) * sizeof *sorted);
+	if (sorted)
+	{
+		for (i = 0; i <= ZPROFSITES; i++)
+			if (zprofsites[i].allocs)
+				sorted[numsites++] = &zprofsites[i];
+		qsort(sorted, numsites, sizeof *sorted, Z_CompareProfSites);
+	}
+
+	// Sites are return addresses; Z_Init's lets them be matched to the binary.
+	fprintf(f, "# Z_Init at %p\n", (void *)(size_t)Z_Init);
+	fprintf(f, "site\ttag\tlive_bytes\tlive_blocks\tpeak_bytes\tallocs\ttotal_bytes\n");
+	for (i = 0; i < numsites; i++)
+	{
+		const zprofsite_t *entry = sorted[i];
+		fprintf(f, "%p\t%d\t%s\t%u\t%s\t%u\t%s\n",
+			entry == &zprofsites[ZPROFSITES] ? NULL : entry->site, entry->tag,
+			sizeu1(entry->live), entry->blocks, sizeu2(entry->peak),
+			entry->allocs, sizeu3(entry->total));
+	}
+
+	fprintf(f, "\ntag\tlive_bytes\tlive_blocks\tpeak_bytes\n");
+	for (list = 0; list <= NUMZTAGS; list++)
+	{
+		if (!ztagpeak[list])
+			continue;
+		if (list < NUMZTAGS)
+			fprintf(f, "%d", list);
+		else
+			fprintf(f, "other");
+		fprintf(f, "\t%s\t%s\t%s\n", sizeu1(ztagbytes[list]), sizeu2(ztagblocks[list]), sizeu3(ztagpeak[list]));
+	}
+	fprintf(f, "all\t%s\t\t%s\n", sizeu1(zheapbytes), sizeu2(zheappeak));
+
+	free(sorted);
+	fclose(f);
+	return true;
+}
+
+static void Command_Memprofile_f(void)
+{
+	const char *arg = COM_Argv(1);
+
+	if (!stricmp(arg, "start"))
+	{
+		if (!zprofsites)
+			zprofsites = malloc((ZPROFSITES+1) * sizeof *zprofsites);
+		if (!zprofsites)
+		{
+			CONS_Alert(CONS_ERROR, M_GetText("Not enough memory to start profiling\n"));
+			return;
+		}
+		memset(zprofsites, 0, (ZPROFSITES+1) * sizeof *zprofsites);
+		zprofgen++;
+		zprofiling = true;
+		CONS_Printf(M_GetText("Memory profiling started\n"));
+	}
+	else if (!stricmp(arg, "stop"))
+	{
+		zprofiling = false;
+		CONS_Printf(M_GetText("Memory profiling stopped\n"));
+	}
+	else if (!stricmp(arg, "dump") && COM_Argc() > 2)
+	{
+		const char *filename = va("%s" PATHSEP "%s", srb2home, COM_Argv(2));
+
+		if (!zprofsites)
+			CONS_Printf(M_GetText("Nothing to dump, use \"memprofile start\" first\n"));
+		else if (Z_DumpProfile(filename))
+			CONS_Printf(M_GetText("Memory profile written to %s\n"), filename);
+		else
+			CONS_Alert(CONS_ERROR, M_GetText("Couldn't write memory profile to %s\n"), filename);
+	}
+	else
+		CONS_Printf(M_GetText("memprofile start|stop|dump <file>: profile allocations by call site\n"));
+}
+
 #ifdef ZDEBUG
 static void Command_Memdump_f(void)
 {
 	memblock_t *block;
 	INT32 mintag = 0, maxtag = INT32_MAX;
-	INT32 i;
+	INT32 i, list;
 
 	if ((i = COM_CheckParm("-min")))
 		mintag = atoi(COM_Argv(i + 1));
@@ -659,12 +1386,13 @@ static void Command_Memdump_f(void)
 	if ((i = COM_CheckParm("-max")))
 		maxtag = atoi(COM_Argv(i + 1));
 
-	for (block = head.next; block != &head; block = block->next)
-		if (block->tag >= mintag && block->tag <= maxtag)
-		{
-			char *filename = strrchr(block->ownerfile, PATHSEP[0]);
-			CONS_Printf("[%3d] %s (%s) bytes @ %s:%d\n", block->tag, sizeu1(block->size), sizeu2(block->realsize), filename ? filename + 1 : block->ownerfile, block->ownerline);
-		}
+	for (list = 0; list <= NUMZTAGS; list++)
+		for (block = heads[list].next; block != &heads[list]; block = block->next)
+			if (block->tag >= mintag && block->tag <= maxtag)
+			{
+				char *filename = strrchr(block->ownerfile, PATHSEP[0]);
+				CONS_Printf("[%3d] %s (%s) bytes @ %s:%d\n", block->tag, sizeu1(block->size), sizeu2(block->realsize), filename ? filename + 1 : block->ownerfile, block->ownerline);
+			}
 }
 #endif
 
@@ -58,6 +58,16 @@
                                   // stored in hardware format and downloaded as needed
 #define PU_HWRPATCHINFO_UNLOCKED 103
 
+// Lump cache and purge statistics
+typedef struct
+{
+	UINT32 hits, misses; // W_Cache* finding the lump already in memory, or not
+	UINT32 evictions; // purgable blocks freed by Z_CheckMemCleanup or on malloc failure
+	size_t evictedbytes;
+} zcachestats_t;
+
+extern zcachestats_t zcachestats;
+
 void Z_Init(void);
 void Z_FreeTags(INT32 lowtag, INT32 hightag);
 void Z_CheckMemCleanup(void);
@@ -96,8 +106,20 @@ void *Z_ReallocAlign(void *ptr, size_t size, INT32 tag, void *user, INT32 alignb
 #define Z_Realloc(p, s,t,u) Z_ReallocAlign(p, s, t, u, 0)
 #endif
 
+// Memory from elsewhere (such as a file mapping) can be handed to the zone
+// with Z_Adopt, and is then handled like any other block: it is given back
+// with the release function when freed or purged. The data must have
+// ZADOPTROOM writable bytes in front of it, within real, for the header.
+// Its size isn't counted as heap, nor against zonebudget.
+typedef void (*zrelease_t)(void *real, size_t realsize);
+#define ZADOPTROOM 16
+
+void *Z_Adopt(void *real, size_t realsize, void *given, size_t size, INT32 tag, void *user, zrelease_t release);
+
 size_t Z_TagUsage(INT32 tagnum);
 size_t Z_TagsUsage(INT32 lowtag, INT32 hightag);
+size_t Z_TagCount(INT32 tagnum);
+size_t Z_TagsCount(INT32 lowtag, INT32 hightag);
 
 char *Z_StrDup(const char *in);
 